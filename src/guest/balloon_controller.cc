@@ -0,0 +1,157 @@
+/*
+ * Copyright (c) 2022 Intel Corporation.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+#include <boost/property_tree/ptree.hpp>
+
+#include "guest/balloon_controller.h"
+#include "guest/qmp_client.h"
+#include "utils/log.h"
+
+namespace vm_manager {
+
+constexpr const char *kProcMeminfo = "/proc/meminfo";
+constexpr const int kBalloonQmpTimeoutMs = 1000;
+
+/* MemTotal and MemAvailable in bytes */
+static bool ReadHostMem(uint64_t *total, uint64_t *avail) {
+    std::ifstream ifs(kProcMeminfo);
+    std::string line;
+    int found = 0;
+    while (std::getline(ifs, line) && (found < 2)) {
+        std::istringstream is(line);
+        std::string key;
+        uint64_t kb = 0;
+        if (!(is >> key >> kb))
+            continue;
+        if (key.compare("MemTotal:") == 0) {
+            *total = kb << 10;
+            found++;
+        } else if (key.compare("MemAvailable:") == 0) {
+            *avail = kb << 10;
+            found++;
+        }
+    }
+    return found == 2;
+}
+
+BalloonController &BalloonController::Get(void) {
+    static BalloonController controller;
+    return controller;
+}
+
+void BalloonController::Start(void) {
+    if (thread_)
+        return;
+    thread_ = std::make_unique<boost::thread>([this] { Run(); });
+}
+
+void BalloonController::Stop(void) {
+    if (!thread_)
+        return;
+    thread_->interrupt();
+    thread_->join();
+    thread_.reset();
+}
+
+BalloonController::~BalloonController() {
+    Stop();
+}
+
+void BalloonController::Add(const std::string &vm, const std::string &qmp_sock, uint64_t max_bytes,
+                            uint64_t min_bytes) {
+    std::scoped_lock lock(mutex_);
+    guests_[vm] = { qmp_sock, max_bytes, std::min(min_bytes, max_bytes) };
+    LOG(info) << "Balloon of " << vm << ": " << (min_bytes >> 20) << "M - " << (max_bytes >> 20) << "M";
+}
+
+void BalloonController::Remove(const std::string &vm) {
+    std::scoped_lock lock(mutex_);
+    guests_.erase(vm);
+}
+
+void BalloonController::Run(void) {
+    try {
+        while (true) {
+            boost::this_thread::sleep_for(boost::chrono::seconds(kBalloonPeriodSec));
+            Balance();
+        }
+    } catch (boost::thread_interrupted &e) {
+        return;
+    }
+}
+
+void BalloonController::Balance(void) {
+    std::map<std::string, Guest> guests;
+    {
+        std::scoped_lock lock(mutex_);
+        guests = guests_;
+    }
+    if (guests.empty())
+        return;
+
+    uint64_t total = 0, avail = 0;
+    if (!ReadHostMem(&total, &avail))
+        return;
+    /* Each guest costs at most a few QMP timeouts, Stop() gets in between guests */
+    for (auto &g : guests) {
+        boost::this_thread::interruption_point();
+        BalanceGuest(g.first, g.second, total, avail);
+    }
+}
+
+/*
+ * A guest short of memory always grows by a step. Otherwise under host
+ * pressure it gives back half of what it has available above its reserve,
+ * and without pressure it grows back towards its configured size.
+ */
+void BalloonController::BalanceGuest(const std::string &vm, const Guest &g, uint64_t host_total,
+                                     uint64_t host_avail) {
+    QmpClient qmp(g.qmp_sock);
+    if (!qmp.Connect(kBalloonQmpTimeoutMs))
+        return;
+
+    boost::property_tree::ptree balloon, stats;
+    if (!qmp.Execute("query-balloon", &balloon))
+        return;
+    std::string args = std::string("{\"path\": \"") + kBalloonQomPath + "\", \"property\": \"guest-stats\"}";
+    if (!qmp.Execute("qom-get", args, &stats))
+        return;
+
+    uint64_t actual = balloon.get<uint64_t>("actual", 0);
+    /* No report from the guest driver yet */
+    if ((actual == 0) || (stats.get<int64_t>("last-update", 0) == 0))
+        return;
+    int64_t guest_avail = stats.get<int64_t>("stats.stat-available-memory", -1);
+    if (guest_avail < 0)
+        guest_avail = stats.get<int64_t>("stats.stat-free-memory", -1);
+    if (guest_avail < 0)
+        return;
+
+    uint64_t target = actual;
+    if (static_cast<uint64_t>(guest_avail) < kGuestMemReserve)
+        target = actual + kBalloonStep;
+    else if (host_avail < host_total / 100 * kHostMemLowPct)
+        target = actual - std::min((guest_avail - kGuestMemReserve) / 2, kBalloonStep);
+    else if (host_avail > host_total / 100 * kHostMemHighPct)
+        target = actual + kBalloonStep;
+    target = std::clamp(target, g.min_bytes, g.max_bytes);
+
+    /* Skip small moves, each one costs the guest driver page walks */
+    uint64_t diff = (target > actual) ? (target - actual) : (actual - target);
+    if ((diff == 0) || ((diff < kBalloonStep / 4) && (target != g.max_bytes)))
+        return;
+
+    boost::property_tree::ptree ret;
+    if (qmp.Execute("balloon", "{\"value\": " + std::to_string(target) + "}", &ret))
+        LOG(info) << "Balloon " << vm << ": " << (actual >> 20) << "M -> " << (target >> 20) << "M";
+}
+
+}  // namespace vm_manager
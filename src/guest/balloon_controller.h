@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2022 Intel Corporation.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#ifndef SRC_GUEST_BALLOON_CONTROLLER_H_
+#define SRC_GUEST_BALLOON_CONTROLLER_H_
+
+#include <cstdint>
+#include <string>
+#include <map>
+#include <mutex>
+#include <memory>
+
+#include <boost/thread.hpp>
+
+namespace vm_manager {
+
+inline constexpr const char *kBalloonQomPath = "/machine/peripheral/balloon0";
+inline constexpr int kBalloonStatsIntervalSec = 5;
+inline constexpr int kBalloonPeriodSec = 5;
+
+/* Host MemAvailable below low reclaims memory from guests, above high lets them grow back */
+inline constexpr int kHostMemLowPct = 10;
+inline constexpr int kHostMemHighPct = 20;
+/* Available memory a guest keeps for itself, and the most a balloon moves per period */
+inline constexpr uint64_t kGuestMemReserve = 256ULL << 20;
+inline constexpr uint64_t kBalloonStep = 256ULL << 20;
+
+/*
+ * Resizes the virtio balloons of running guests from the host memory pressure
+ * and the memory stats each guest reports, so that idle guests give memory
+ * back to the host and busy ones get it again.
+ */
+class BalloonController final {
+ public:
+    static BalloonController &Get(void);
+
+    void Start(void);
+    void Stop(void);
+
+    /* Manage the balloon of vm through its QMP socket, keeping its memory in [min_bytes, max_bytes] */
+    void Add(const std::string &vm, const std::string &qmp_sock, uint64_t max_bytes, uint64_t min_bytes);
+    void Remove(const std::string &vm);
+
+ private:
+    BalloonController() = default;
+    ~BalloonController();
+    BalloonController(const BalloonController &) = delete;
+    BalloonController& operator=(const BalloonController&) = delete;
+
+    struct Guest {
+        std::string qmp_sock;
+        uint64_t max_bytes;
+        uint64_t min_bytes;
+    };
+
+    void Run(void);
+    void Balance(void);
+    void BalanceGuest(const std::string &vm, const Guest &g, uint64_t host_total, uint64_t host_avail);
+
+    std::mutex mutex_;
+    std::map<std::string, Guest> guests_;
+    std::unique_ptr<boost::thread> thread_;
+};
+
+}  // namespace vm_manager
+
+#endif  // SRC_GUEST_BALLOON_CONTROLLER_H_
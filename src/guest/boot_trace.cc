@@ -0,0 +1,176 @@
+/*
+ * Copyright (c) 2022 Intel Corporation.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <deque>
+
+#include <boost/filesystem.hpp>
+#include <boost/algorithm/string.hpp>
+
+#include "guest/boot_trace.h"
+#include "utils/log.h"
+#include "utils/utils.h"
+
+namespace vm_manager {
+
+std::string BootTrace::HistoryPath(const std::string &vm_name) {
+    return std::string(GetConfigPath()) + "/." + vm_name + kBootHistorySuffix;
+}
+
+void BootTrace::Begin(std::chrono::steady_clock::time_point start) {
+    std::scoped_lock lock(mutex_);
+    begin_ = start;
+    wall_begin_ = std::time(nullptr);
+    marks_.clear();
+    started_ = true;
+    persisted_ = false;
+}
+
+void BootTrace::Mark(const std::string &phase) {
+    auto now = std::chrono::steady_clock::now();
+    std::scoped_lock lock(mutex_);
+    if (!started_ || persisted_)
+        return;
+    uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(now - begin_).count();
+    marks_.emplace_back(phase, us);
+}
+
+bool BootTrace::Persist(void) {
+    std::scoped_lock lock(mutex_);
+    if (!started_ || persisted_ || marks_.empty())
+        return false;
+    persisted_ = true;
+
+    std::string path = HistoryPath(vm_name_);
+    std::deque<std::string> history;
+    std::ifstream in(path);
+    std::string line;
+    while (std::getline(in, line)) {
+        if (!line.empty())
+            history.push_back(line);
+    }
+    in.close();
+
+    std::ostringstream rec;
+    rec << wall_begin_;
+    for (auto &m : marks_) {
+        rec << " " << m.first << "=" << m.second;
+    }
+    history.push_back(rec.str());
+    while (history.size() > kBootHistoryMax)
+        history.pop_front();
+
+    std::string tmp = path + "~";
+    std::ofstream out(tmp, std::ofstream::trunc);
+    if (!out.is_open()) {
+        LOG(warning) << "Failed to write boot history: " << path;
+        return false;
+    }
+    for (auto &h : history) {
+        out << h << "\n";
+    }
+    out.close();
+
+    boost::system::error_code ec;
+    boost::filesystem::rename(tmp, path, ec);
+    if (ec) {
+        LOG(warning) << "Failed to update boot history: " << ec.message();
+        return false;
+    }
+    LOG(info) << "Boot trace of " << vm_name_ << " saved, " << marks_.size() << " phases";
+    return true;
+}
+
+static std::string FormatTime(std::time_t t) {
+    struct tm timeinfo;
+    char t_buf[80];
+    localtime_r(&t, &timeinfo);
+    strftime(t_buf, 80 , "%Y-%m-%d_%T", &timeinfo);
+    return t_buf;
+}
+
+bool BootTrace::Report(const std::string &vm_name, std::ostream &os) {
+    std::ifstream in(HistoryPath(vm_name));
+    if (!in.is_open()) {
+        LOG(error) << "No boot history for " << vm_name;
+        return false;
+    }
+
+    /* Lines without a start time are skipped, e.g. one cut short by a crash */
+    std::vector<std::vector<std::string>> boots;
+    std::vector<std::time_t> starts;
+    std::string line;
+    while (std::getline(in, line)) {
+        std::vector<std::string> fields;
+        boost::split(fields, line, boost::is_any_of(" "), boost::token_compress_on);
+        if (fields.size() <= 1)
+            continue;
+        try {
+            starts.push_back(std::stoll(fields[0]));
+        } catch (std::exception &e) {
+            continue;
+        }
+        boots.push_back(std::move(fields));
+    }
+    if (boots.empty()) {
+        LOG(error) << "Empty boot history for " << vm_name;
+        return false;
+    }
+
+    auto split_mark = [](const std::string &f, std::string *phase, uint64_t *us) {
+        size_t pos = f.find('=');
+        if (pos == std::string::npos)
+            return false;
+        *phase = f.substr(0, pos);
+        try {
+            *us = std::stoull(f.substr(pos + 1));
+        } catch (std::exception &e) {
+            return false;
+        }
+        return true;
+    };
+
+    os << "Boot history of " << vm_name << " (" << boots.size() << " boots):\n";
+    for (size_t n = 0; n < boots.size(); n++) {
+        auto &b = boots[n];
+        std::string phase;
+        uint64_t us = 0, total = 0;
+        bool ready = false;
+        for (size_t i = 1; i < b.size(); i++) {
+            if (!split_mark(b[i], &phase, &us))
+                continue;
+            total = std::max(total, us);
+            if (phase.compare("vm_ready") == 0)
+                ready = true;
+        }
+        os << "  " << FormatTime(starts[n])
+           << "  total=" << std::fixed << std::setprecision(3) << std::setw(9) << total / 1000.0 << "ms"
+           << (ready ? "" : "  (not ready)") << "\n";
+    }
+
+    auto &last = boots.back();
+    os << "\nLatest boot @" << FormatTime(starts.back()) << ":\n";
+    os << "  " << std::left << std::setw(32) << "phase"
+       << std::right << std::setw(12) << "at(ms)" << std::setw(12) << "delta(ms)" << "\n";
+    uint64_t prev = 0;
+    for (size_t i = 1; i < last.size(); i++) {
+        std::string phase;
+        uint64_t us = 0;
+        if (!split_mark(last[i], &phase, &us))
+            continue;
+        os << "  " << std::left << std::setw(32) << phase
+           << std::right << std::fixed << std::setprecision(3)
+           << std::setw(12) << us / 1000.0
+           << std::setw(12) << (us - std::min(prev, us)) / 1000.0 << "\n";
+        prev = us;
+    }
+    return true;
+}
+
+}  // namespace vm_manager
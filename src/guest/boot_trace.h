@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2022 Intel Corporation.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#ifndef SRC_GUEST_BOOT_TRACE_H_
+#define SRC_GUEST_BOOT_TRACE_H_
+
+#include <ctime>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <utility>
+#include <ostream>
+
+namespace vm_manager {
+
+inline constexpr const char *kBootHistorySuffix = ".boot.history";
+inline constexpr const size_t kBootHistoryMax = 64U;
+
+/*
+ * Records the timestamp of each phase of one guest boot, relative to the
+ * moment the start request was received, and appends the breakdown to a
+ * per-VM history file under the config path.
+ */
+class BootTrace final {
+ public:
+    explicit BootTrace(std::string vm_name) : vm_name_(vm_name) {}
+
+    void Begin(std::chrono::steady_clock::time_point start);
+    void Mark(const std::string &phase);
+    bool Persist(void);
+
+    static bool Report(const std::string &vm_name, std::ostream &os);
+
+ private:
+    BootTrace(const BootTrace&) = delete;
+    BootTrace& operator=(const BootTrace&) = delete;
+
+    static std::string HistoryPath(const std::string &vm_name);
+
+    std::string vm_name_;
+    bool started_ = false;
+    bool persisted_ = false;
+    std::time_t wall_begin_ = 0;
+    std::chrono::steady_clock::time_point begin_;
+    std::vector<std::pair<std::string, uint64_t>> marks_;
+    std::mutex mutex_;
+};
+
+}  // namespace vm_manager
+
+#endif  // SRC_GUEST_BOOT_TRACE_H_
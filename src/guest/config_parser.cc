@@ -12,6 +12,7 @@
 #include <map>
 #include <vector>
 #include <string_view>
+#include <algorithm>
 
 #include <boost/filesystem.hpp>
 #include <boost/algorithm/string.hpp>
@@ -30,13 +31,20 @@ using boost::property_tree::ptree;
 map<string_view, vector<string_view>> kConfigMap = {
     { kGroupGlob,    { kGlobName, kGlobFlashfiles, kGlobCid, kGlobWaitReady } },
     { kGroupEmul,    { kEmulType, kEmulPath } },
-    { kGroupMem,     { kMemSize } },
-    { kGroupVcpu,    { kVcpuNum } },
+    { kGroupMem,     { kMemSize, kMemPageSize, kMemHostNodes, kMemBackend, kMemPath,
+                       kMemPrealloc, kMemPreallocThreads, kMemShare, kMemPolicy, kMemBalloon,
+                       kMemBalloonMin, kMemMerge } },
+    { kGroupVcpu,    { kVcpuNum, kVcpuPin, kVcpuEmulPin } },
     { kGroupFirm,    { kFirmType, kFirmPath, kFirmCode, kFirmVars } },
-    { kGroupDisk,    { kDiskSize, kDiskPath } },
+    { kGroupDisk,    { kDiskSize, kDiskPath, kDiskIothread, kDiskIothreadPin, kDiskQueues,
+                       kDiskAio, kDiskCache, kDiskBus, kDiskBootIndex, kDiskGolden, kDiskFormat,
+                       kDiskPrealloc, kDiskClusterSize, kDiskL2CacheSize, kDiskDiscard, kDiskDetectZeroes,
+                       kDiskThrottleGroup } },
     { kGroupVgpu,    { kVgpuType, kVgpuGvtgVer, kVgpuUuid, kVgpuMonId, kVgpuOutputs } },
     { kGroupDisplay, { kDispOptions } },
-    { kGroupNet,     { kNetModel, kNetAdbPort, kNetFastbootPort } },
+    { kGroupNet,     { kNetModel, kNetAdbPort, kNetFastbootPort, kNetBackend, kNetTap, kNetBridge,
+                       kNetQueues, kNetVhost, kNetPasstPath, kNetSwitch, kNetSwitchPath,
+                       kNetEgressRate, kNetIngressRate, kNetBurst, kNetPps } },
     { kGroupVtpm,    { kVtpmBinPath, kVtpmDataDir } },
     { kGroupRpmb,    { kRpmbBinPath, kRpmbDataDir } },
     { kGroupAaf,     { kAafPath, kAafSuspend, kAafAudioType }},
@@ -45,12 +53,38 @@ map<string_view, vector<string_view>> kConfigMap = {
     { kGroupAudio,   { kDisableEmul } },
     { kGroupMed,     { kMedBattery, kMedThermal, kMedCamera } },
     { kGroupService, { kServTimeKeep, kServPmCtrl, kServVinput } },
-    { kGroupExtra,   { kExtraCmd, kExtraService, kExtraPwrCtrlMultiOS } }
+    { kGroupExtra,   { kExtraCmd, kExtraService, kExtraPwrCtrlMultiOS } },
+    { kGroupLog,     { kLogDir, kLogRingSize, kLogMaxSize, kLogRotate, kLogCompress } },
+    { kGroupThrottle, { kThrottleIopsTotal, kThrottleIopsRead, kThrottleIopsWrite, kThrottleBpsTotal,
+                        kThrottleBpsRead, kThrottleBpsWrite, kThrottleIopsTotalMax, kThrottleIopsReadMax,
+                        kThrottleIopsWriteMax, kThrottleBpsTotalMax, kThrottleBpsReadMax, kThrottleBpsWriteMax,
+                        kThrottleBurstLength, kThrottleIopsSize } }
 };
 
+/* Extra disks "disk<N>" take the keys of "disk" */
+static bool IsExtraDiskGroup(const std::string &group) {
+    std::string prefix(kGroupDisk);
+    return (group.size() > prefix.size()) && (group.compare(0, prefix.size(), prefix) == 0) &&
+           std::all_of(group.begin() + prefix.size(), group.end(), ::isdigit);
+}
+
+/* Throttle groups "throttle_<name>" take the keys of "throttle" */
+static bool IsThrottleGroup(const std::string &group) {
+    std::string prefix = std::string(kGroupThrottle) + "_";
+    return (group.size() > prefix.size()) && (group.compare(0, prefix.size(), prefix) == 0) &&
+           std::all_of(group.begin() + prefix.size(), group.end(), [](char c) {
+               return ::isalnum(c) || (c == '_') || (c == '-');
+           });
+}
+
 bool CivConfig::SanitizeOpts(void) {
     for (auto& section : cfg_data_) {
-        auto group = kConfigMap.find(section.first);
+        std::string name = section.first;
+        if (IsExtraDiskGroup(name))
+            name = kGroupDisk;
+        else if (IsThrottleGroup(name))
+            name = kGroupThrottle;
+        auto group = kConfigMap.find(name);
         if (group != kConfigMap.end()) {
             for (auto& subsec : section.second) {
                 auto key = std::find(group->second.begin(), group->second.end(), subsec.first);
@@ -114,6 +148,33 @@ bool CivConfig::WriteConfigFile(std::string path) {
     return true;
 }
 
+std::vector<std::string> CivConfig::GetDiskGroups(void) {
+    std::vector<std::string> extra;
+    for (auto& section : cfg_data_) {
+        if (IsExtraDiskGroup(section.first))
+            extra.push_back(section.first);
+    }
+    std::sort(extra.begin(), extra.end(), [](const std::string &a, const std::string &b) {
+        return (a.size() != b.size()) ? (a.size() < b.size()) : (a < b);
+    });
+
+    std::vector<std::string> groups;
+    if (cfg_data_.find(kGroupDisk) != cfg_data_.not_found())
+        groups.push_back(kGroupDisk);
+    groups.insert(groups.end(), extra.begin(), extra.end());
+    return groups;
+}
+
+bool CivConfig::HasGroup(const std::string &group) {
+    return cfg_data_.find(group) != cfg_data_.not_found();
+}
+
+std::string CivConfig::ToString(void) {
+    std::ostringstream os;
+    write_ini(os, cfg_data_);
+    return os.str();
+}
+
 std::string CivConfig::GetValue(std::string group, std::string key) {
     try {
         std::string val = cfg_data_.get<std::string>(group + "." + key);
@@ -137,5 +198,11 @@ bool CivConfig::SetValue(const std::string group, const std::string key, const s
     return true;
 }
 
+void CivConfig::RemoveValue(const std::string group, const std::string key) {
+    auto g = cfg_data_.get_child_optional(group);
+    if (g)
+        g->erase(key);
+}
+
 }  // namespace vm_manager
 
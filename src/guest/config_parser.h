@@ -9,6 +9,7 @@
 #define SRC_GUEST_CONFIG_PARSER_H_
 
 #include <string>
+#include <vector>
 
 #include <boost/property_tree/ptree.hpp>
 
@@ -33,6 +34,9 @@ constexpr char kGroupAudio[]   = "audio";
 constexpr char kGroupMed[]     = "mediation";
 constexpr char kGroupService[] = "guest_control";
 constexpr char kGroupExtra[]   = "extra";
+constexpr char kGroupLog[]     = "log";
+/* Named disk throttle groups "throttle_<name>" */
+constexpr char kGroupThrottle[] = "throttle";
 
 /* Keys */
 constexpr char kGlobName[]       = "name";
@@ -44,8 +48,21 @@ constexpr char kEmulType[] = "type";
 constexpr char kEmulPath[] = "path";
 
 constexpr char kMemSize[] = "size";
+constexpr char kMemPageSize[] = "page_size";
+constexpr char kMemHostNodes[] = "host_nodes";
+constexpr char kMemBackend[] = "backend";
+constexpr char kMemPath[] = "mem_path";
+constexpr char kMemPrealloc[] = "prealloc";
+constexpr char kMemPreallocThreads[] = "prealloc_threads";
+constexpr char kMemShare[] = "share";
+constexpr char kMemPolicy[] = "policy";
+constexpr char kMemBalloon[] = "balloon";
+constexpr char kMemBalloonMin[] = "balloon_min";
+constexpr char kMemMerge[] = "merge";
 
 constexpr char kVcpuNum[] = "num";
+constexpr char kVcpuPin[] = "pin";
+constexpr char kVcpuEmulPin[] = "emulator_pin";
 
 constexpr char kFirmType[] = "type";
 constexpr char kFirmPath[] = "path";
@@ -54,6 +71,21 @@ constexpr char kFirmVars[] = "vars";
 
 constexpr char kDiskSize[] = "size";
 constexpr char kDiskPath[] = "path";
+constexpr char kDiskIothread[] = "iothread";
+constexpr char kDiskIothreadPin[] = "iothread_pin";
+constexpr char kDiskQueues[] = "queues";
+constexpr char kDiskAio[] = "aio";
+constexpr char kDiskCache[] = "cache";
+constexpr char kDiskBus[] = "bus";
+constexpr char kDiskBootIndex[] = "bootindex";
+constexpr char kDiskGolden[] = "golden";
+constexpr char kDiskFormat[] = "format";
+constexpr char kDiskPrealloc[] = "preallocation";
+constexpr char kDiskClusterSize[] = "cluster_size";
+constexpr char kDiskL2CacheSize[] = "l2_cache_size";
+constexpr char kDiskDiscard[] = "discard";
+constexpr char kDiskDetectZeroes[] = "detect_zeroes";
+constexpr char kDiskThrottleGroup[] = "throttle_group";
 
 constexpr char kVgpuType[]    = "type";
 constexpr char kVgpuGvtgVer[] = "gvtg_version";
@@ -66,6 +98,18 @@ constexpr char kDispOptions[] = "options";
 constexpr char kNetModel[] = "model";
 constexpr char kNetAdbPort[] = "adb_port";
 constexpr char kNetFastbootPort[] = "fastboot_port";
+constexpr char kNetBackend[] = "backend";
+constexpr char kNetTap[] = "tap";
+constexpr char kNetBridge[] = "bridge";
+constexpr char kNetQueues[] = "queues";
+constexpr char kNetVhost[] = "vhost";
+constexpr char kNetPasstPath[] = "passt_path";
+constexpr char kNetSwitch[] = "switch";
+constexpr char kNetSwitchPath[] = "switch_path";
+constexpr char kNetEgressRate[] = "egress_rate";
+constexpr char kNetIngressRate[] = "ingress_rate";
+constexpr char kNetBurst[] = "burst";
+constexpr char kNetPps[] = "pps";
 
 constexpr char kVtpmBinPath[] = "bin_path";
 constexpr char kVtpmDataDir[] = "data_dir";
@@ -95,6 +139,27 @@ constexpr char kExtraCmd[]     = "cmd";
 constexpr char kExtraService[] = "service";
 constexpr char kExtraPwrCtrlMultiOS[] = "pwr_ctrl_multios";
 
+constexpr char kLogDir[]      = "dir";
+constexpr char kLogRingSize[] = "ring_size";
+constexpr char kLogMaxSize[]  = "max_size";
+constexpr char kLogRotate[]   = "rotate";
+constexpr char kLogCompress[] = "compress";
+
+constexpr char kThrottleIopsTotal[] = "iops_total";
+constexpr char kThrottleIopsRead[] = "iops_read";
+constexpr char kThrottleIopsWrite[] = "iops_write";
+constexpr char kThrottleBpsTotal[] = "bps_total";
+constexpr char kThrottleBpsRead[] = "bps_read";
+constexpr char kThrottleBpsWrite[] = "bps_write";
+constexpr char kThrottleIopsTotalMax[] = "iops_total_max";
+constexpr char kThrottleIopsReadMax[] = "iops_read_max";
+constexpr char kThrottleIopsWriteMax[] = "iops_write_max";
+constexpr char kThrottleBpsTotalMax[] = "bps_total_max";
+constexpr char kThrottleBpsReadMax[] = "bps_read_max";
+constexpr char kThrottleBpsWriteMax[] = "bps_write_max";
+constexpr char kThrottleBurstLength[] = "burst_length";
+constexpr char kThrottleIopsSize[] = "iops_size";
+
 /* Options for Key to select */
 constexpr char kEmulTypeQemu[] = "QEMU";
 
@@ -114,6 +179,21 @@ constexpr char kGvtgV52[] = "i915-GVTg_V5_2";
 constexpr char kGvtgV54[] = "i915-GVTg_V5_4";
 constexpr char kGvtgV58[] = "i915-GVTg_V5_8";
 
+constexpr char kDiskBusVirtioBlk[] = "virtio-blk";
+constexpr char kDiskBusVirtioScsi[] = "virtio-scsi";
+constexpr char kDiskBusNvme[] = "nvme";
+
+constexpr char kDiskFormatQcow2[] = "qcow2";
+constexpr char kDiskFormatRaw[] = "raw";
+
+constexpr char kNetBackendUser[] = "user";
+constexpr char kNetBackendTap[] = "tap";
+constexpr char kNetBackendPasst[] = "passt";
+
+constexpr char kMemBackendMemfd[] = "memfd";
+constexpr char kMemBackendHugetlbfs[] = "hugetlbfs";
+constexpr char kMemBackendFile[] = "file";
+
 constexpr char kSuspendEnable[]  = "enable";
 constexpr char kSuspendDisable[] = "disable";
 
@@ -122,8 +202,13 @@ class CivConfig final {
  public:
   std::string GetValue(const std::string group, const std::string key);
   bool SetValue(const std::string group, const std::string key, const std::string value);
+  void RemoveValue(const std::string group, const std::string key);
   bool ReadConfigFile(const std::string path);
   bool WriteConfigFile(std::string path);
+  std::string ToString(void);
+  /* "disk" followed by the extra disks "disk<N>" in ascending N */
+  std::vector<std::string> GetDiskGroups(void);
+  bool HasGroup(const std::string &group);
  private:
   bool SanitizeOpts(void);
   boost::property_tree::ptree cfg_data_;
@@ -0,0 +1,665 @@
+/*
+ * Copyright (c) 2022 Intel Corporation.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+#include <unistd.h>
+#include <netinet/in.h>
+#include <net/if.h>
+#include <sys/socket.h>
+
+#include <cstring>
+#include <fstream>
+#include <future>
+#include <functional>
+#include <algorithm>
+#include <set>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/process/search_path.hpp>
+
+#include "guest/config_validator.h"
+#include "guest/host_inventory.h"
+#include "guest/vsock_cid_pool.h"
+#include "guest/cpu_affinity.h"
+#include "guest/cpu_allocator.h"
+#include "guest/hugepage_manager.h"
+#include "guest/net_tap.h"
+#include "guest/net_qos.h"
+#include "guest/vm_switch.h"
+#include "guest/disk_image.h"
+#include "guest/disk_throttle.h"
+#include "utils/log.h"
+#include "utils/utils.h"
+
+namespace vm_manager {
+
+constexpr const char *kValPciDevicePath = "/sys/bus/pci/devices/";
+constexpr const char *kValKvmDev = "/dev/kvm";
+constexpr const char *kValVhostVsockDev = "/dev/vhost-vsock";
+constexpr const char *kValMemInfo = "/proc/meminfo";
+constexpr const char *kValNodePath = "/sys/devices/system/node/node";
+constexpr const char *kValHugePagesPath = "/sys/kernel/mm/hugepages/";
+
+static bool FileExists(const std::string &path) {
+    boost::system::error_code ec;
+    return boost::filesystem::exists(path, ec) && !boost::filesystem::is_directory(path, ec);
+}
+
+static bool DirExists(const std::string &path) {
+    boost::system::error_code ec;
+    return boost::filesystem::is_directory(path, ec);
+}
+
+/* First word of a co-process command line, either a path or a name in PATH */
+static bool CmdExecutable(const std::string &cmd) {
+    std::string bin = cmd.substr(0, cmd.find_first_of(' '));
+    if (FileExists(bin))
+        return access(bin.c_str(), X_OK) == 0;
+    return !boost::process::search_path(bin).empty();
+}
+
+static long ReadMemAvailableMb(void) {
+    std::ifstream ifs(kValMemInfo);
+    std::string key;
+    long kb = 0;
+    std::string unit;
+    while (ifs >> key >> kb >> unit) {
+        if (key.compare("MemAvailable:") == 0)
+            return kb / 1024;
+    }
+    return -1;
+}
+
+static bool TcpPortFree(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return true;
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    /* As the emulator would, so a socket of the last run still in TIME_WAIT does not count */
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    bool free = (bind(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) == 0);
+    close(fd);
+    return free;
+}
+
+std::vector<std::string> ConfigValidator::CheckEmulator(void) {
+    std::vector<std::string> p;
+    std::string emul = cfg_.GetValue(kGroupEmul, kEmulPath);
+    if (emul.empty())
+        emul = "qemu-system-x86_64";
+    if (!CmdExecutable(emul))
+        p.push_back("emulator not found or not executable: " + emul);
+    if (access(kValKvmDev, R_OK | W_OK) != 0)
+        p.push_back(std::string("no access to ") + kValKvmDev);
+    if (access(kValVhostVsockDev, R_OK | W_OK) != 0)
+        p.push_back(std::string("no access to ") + kValVhostVsockDev);
+    return p;
+}
+
+std::vector<std::string> ConfigValidator::CheckFirmware(void) {
+    std::vector<std::string> p;
+    std::string type = cfg_.GetValue(kGroupFirm, kFirmType);
+    if (type.compare(kFirmUnified) == 0) {
+        std::string path = cfg_.GetValue(kGroupFirm, kFirmPath);
+        if (!FileExists(path))
+            p.push_back("firmware not found: " + path);
+    } else if (type.compare(kFirmSplited) == 0) {
+        std::string code = cfg_.GetValue(kGroupFirm, kFirmCode);
+        if (!FileExists(code))
+            p.push_back("firmware code not found: " + code);
+        std::string vars = cfg_.GetValue(kGroupFirm, kFirmVars);
+        if (!FileExists(vars))
+            p.push_back("firmware vars not found: " + vars);
+    } else {
+        p.push_back("invalid firmware type: " + type);
+    }
+    return p;
+}
+
+static bool IsTrue(const std::string &val) {
+    return (val.compare("true") == 0) || (val.compare("on") == 0) || (val.compare("yes") == 0);
+}
+
+std::vector<std::string> ConfigValidator::CheckDisk(void) {
+    std::vector<std::string> p;
+    std::set<std::string> paths, bootindexes;
+    std::vector<std::string> groups = cfg_.GetDiskGroups();
+    if (groups.empty())
+        p.push_back("no disk configured");
+
+    for (auto &group : groups) {
+        std::vector<std::string> gp = CheckDiskGroup(group);
+        p.insert(p.end(), gp.begin(), gp.end());
+
+        std::string path = cfg_.GetValue(group, kDiskPath);
+        if (!path.empty() && !paths.insert(path).second)
+            p.push_back(group + ": disk path used more than once: " + path);
+        std::string bootindex = cfg_.GetValue(group, kDiskBootIndex);
+        if (bootindex.empty() && (group.compare(kGroupDisk) == 0))
+            bootindex = "1";
+        if (!bootindex.empty() && !bootindexes.insert(bootindex).second)
+            p.push_back(group + ": duplicated bootindex " + bootindex);
+    }
+    return p;
+}
+
+/* Options of image creation and of the format node */
+std::vector<std::string> ConfigValidator::CheckDiskImageOpts(const std::string &group) {
+    std::vector<std::string> p;
+    std::string path = cfg_.GetValue(group, kDiskPath);
+    bool overlay = !cfg_.GetValue(group, kDiskGolden).empty();
+
+    std::string format = cfg_.GetValue(group, kDiskFormat);
+    if (!format.empty() && (format.compare(kDiskFormatQcow2) != 0) && (format.compare(kDiskFormatRaw) != 0))
+        p.push_back(group + ": invalid disk format: " + format);
+    else if (!format.empty() && overlay && (format.compare(kDiskFormatQcow2) != 0))
+        p.push_back(group + ": disk overlay of a golden image is always qcow2");
+    else if (!format.empty() && FileExists(path) && (DiskImageFormat(path).compare(format) != 0))
+        p.push_back(group + ": disk format is " + format + " but " + path + " is " + DiskImageFormat(path));
+    bool qcow2 = overlay || format.empty() || (format.compare(kDiskFormatQcow2) == 0);
+
+    std::string prealloc = cfg_.GetValue(group, kDiskPrealloc);
+    if (!prealloc.empty() && (prealloc.compare("off") != 0) && (prealloc.compare("metadata") != 0) &&
+        (prealloc.compare("falloc") != 0) && (prealloc.compare("full") != 0))
+        p.push_back(group + ": invalid disk preallocation: " + prealloc);
+    else if ((prealloc.compare("metadata") == 0) && !qcow2)
+        p.push_back(group + ": disk preallocation metadata requires qcow2");
+    else if (!prealloc.empty() && (prealloc.compare("off") != 0) && overlay)
+        p.push_back(group + ": disk preallocation does not apply to an overlay of a golden image");
+
+    std::string cluster = cfg_.GetValue(group, kDiskClusterSize);
+    if (!cluster.empty()) {
+        size_t sz = ParseSize(cluster);
+        if ((sz < 512) || (sz > 2_MB) || (sz & (sz - 1)))
+            p.push_back(group + ": invalid disk cluster_size, a power of 2 from 512 to 2M: " + cluster);
+        else if (!qcow2)
+            p.push_back(group + ": disk cluster_size requires qcow2");
+    }
+
+    std::string l2_cache = cfg_.GetValue(group, kDiskL2CacheSize);
+    if (!l2_cache.empty() && (ParseSize(l2_cache) == 0))
+        p.push_back(group + ": invalid disk l2_cache_size: " + l2_cache);
+    else if (!l2_cache.empty() && !qcow2)
+        p.push_back(group + ": disk l2_cache_size requires qcow2");
+
+    std::string discard = cfg_.GetValue(group, kDiskDiscard);
+    if (!discard.empty() && (discard.compare("unmap") != 0) && (discard.compare("ignore") != 0))
+        p.push_back(group + ": invalid disk discard: " + discard);
+    std::string detect_zeroes = cfg_.GetValue(group, kDiskDetectZeroes);
+    if (!detect_zeroes.empty() && (detect_zeroes.compare("on") != 0) && (detect_zeroes.compare("off") != 0) &&
+        (detect_zeroes.compare("unmap") != 0))
+        p.push_back(group + ": invalid disk detect_zeroes: " + detect_zeroes);
+    else if ((detect_zeroes.compare("unmap") == 0) && (discard.compare("ignore") == 0))
+        p.push_back(group + ": disk detect_zeroes unmap requires discard unmap");
+    return p;
+}
+
+/* QEMU refuses a burst limit without its average limit, or below it */
+std::vector<std::string> ConfigValidator::CheckDiskThrottle(const std::string &name) {
+    std::vector<std::string> p;
+    DiskThrottle t;
+    std::string err;
+    if (!LoadDiskThrottle(&cfg_, name, &t, &err)) {
+        p.push_back(err);
+        return p;
+    }
+
+    bool burst = false;
+    for (auto &it : t) {
+        if (!boost::ends_with(it.first, "_max") || (it.second == 0))
+            continue;
+        burst = true;
+        std::string avg = it.first.substr(0, it.first.size() - 4);
+        auto a = t.find(avg);
+        if ((a == t.end()) || (a->second == 0))
+            p.push_back(ThrottleGroupSection(name) + ": " + it.first + " requires " + avg);
+        else if (it.second < a->second)
+            p.push_back(ThrottleGroupSection(name) + ": " + it.first + " is below " + avg);
+    }
+    auto length = t.find(kThrottleBurstLength);
+    if ((length != t.end()) && (length->second > 0) && !burst)
+        p.push_back(ThrottleGroupSection(name) + ": burst_length without any *_max limit");
+    return p;
+}
+
+std::vector<std::string> ConfigValidator::CheckDiskGroup(const std::string &group) {
+    std::vector<std::string> p;
+    std::string path = cfg_.GetValue(group, kDiskPath);
+    std::string golden = cfg_.GetValue(group, kDiskGolden);
+    if (!golden.empty()) {
+        /* The overlay itself is created on first start */
+        if (!FileExists(golden))
+            p.push_back(group + ": golden image not found: " + golden);
+        else if (golden.compare(path) == 0)
+            p.push_back(group + ": disk path is the golden image itself: " + path);
+        if (!FileExists(path)) {
+            std::string dir = boost::filesystem::absolute(path).parent_path().string();
+            if (access(dir.c_str(), W_OK) != 0)
+                p.push_back(group + ": cannot create disk overlay in: " + dir);
+        } else if (access(path.c_str(), R_OK | W_OK) != 0) {
+            p.push_back(group + ": disk not writable: " + path);
+        }
+    } else if (!FileExists(path)) {
+        p.push_back(group + ": disk not found: " + path);
+    } else if (access(path.c_str(), R_OK | W_OK) != 0) {
+        p.push_back(group + ": disk not writable: " + path);
+    }
+
+    std::string cache = cfg_.GetValue(group, kDiskCache);
+    bool direct = (cache.compare("none") == 0) || (cache.compare("directsync") == 0);
+    if (!cache.empty() && !direct && (cache.compare("writeback") != 0) &&
+        (cache.compare("writethrough") != 0) && (cache.compare("unsafe") != 0))
+        p.push_back(group + ": invalid disk cache: " + cache);
+
+    std::string aio = cfg_.GetValue(group, kDiskAio);
+    if (!aio.empty() && (aio.compare("threads") != 0) && (aio.compare("native") != 0) &&
+        (aio.compare("io_uring") != 0))
+        p.push_back(group + ": invalid disk aio: " + aio);
+    else if ((aio.compare("native") == 0) && !direct)
+        p.push_back(group + ": disk aio native requires cache none or directsync");
+
+    std::string queues = cfg_.GetValue(group, kDiskQueues);
+    if (!queues.empty() && (queues.compare("auto") != 0)) {
+        try {
+            if (std::stoi(queues) <= 0)
+                p.push_back(group + ": invalid disk queues: " + queues);
+        } catch (std::exception &e) {
+            p.push_back(group + ": invalid disk queues: " + queues);
+        }
+    }
+
+    std::string bus = cfg_.GetValue(group, kDiskBus);
+    if (!bus.empty() && (bus.compare(kDiskBusVirtioBlk) != 0) && (bus.compare(kDiskBusVirtioScsi) != 0) &&
+        (bus.compare(kDiskBusNvme) != 0))
+        p.push_back(group + ": invalid disk bus: " + bus);
+    else if ((bus.compare(kDiskBusNvme) == 0) && IsTrue(cfg_.GetValue(group, kDiskIothread)))
+        p.push_back(group + ": iothread is not supported on nvme bus");
+
+    std::string bootindex = cfg_.GetValue(group, kDiskBootIndex);
+    if (!bootindex.empty()) {
+        try {
+            if (std::stoi(bootindex) < 0)
+                p.push_back(group + ": invalid bootindex: " + bootindex);
+        } catch (std::exception &e) {
+            p.push_back(group + ": invalid bootindex: " + bootindex);
+        }
+    }
+
+    std::vector<std::string> gp = CheckDiskImageOpts(group);
+    p.insert(p.end(), gp.begin(), gp.end());
+
+    std::string throttle = cfg_.GetValue(group, kDiskThrottleGroup);
+    if (!throttle.empty()) {
+        std::vector<std::string> tp = CheckDiskThrottle(throttle);
+        for (auto &it : tp)
+            p.push_back(group + ": " + it);
+    }
+
+    std::string io_pin = cfg_.GetValue(group, kDiskIothreadPin);
+    std::vector<int> cpus, unused;
+    std::string err;
+    if (!io_pin.empty() && !ResolveCpuPinning(io_pin, "", 1, &cpus, &unused, &err))
+        p.push_back(group + ": iothread_pin: " + err);
+    return p;
+}
+
+std::vector<std::string> ConfigValidator::CheckCoProcs(void) {
+    std::vector<std::string> p;
+
+    std::string rpmb_bin = cfg_.GetValue(kGroupRpmb, kRpmbBinPath);
+    std::string rpmb_data = cfg_.GetValue(kGroupRpmb, kRpmbDataDir);
+    if (!rpmb_bin.empty() && !rpmb_data.empty()) {
+        if (!CmdExecutable(rpmb_bin))
+            p.push_back("rpmb binary not found: " + rpmb_bin);
+        if (!DirExists(rpmb_data))
+            p.push_back("rpmb data dir not found: " + rpmb_data);
+    }
+
+    std::string vtpm_bin = cfg_.GetValue(kGroupVtpm, kVtpmBinPath);
+    std::string vtpm_data = cfg_.GetValue(kGroupVtpm, kVtpmDataDir);
+    if (!vtpm_bin.empty() && !vtpm_data.empty()) {
+        if (!CmdExecutable(vtpm_bin))
+            p.push_back("vtpm binary not found: " + vtpm_bin);
+        if (!DirExists(vtpm_data))
+            p.push_back("vtpm data dir not found: " + vtpm_data);
+    }
+
+    std::string aaf_path = cfg_.GetValue(kGroupAaf, kAafPath);
+    if (!aaf_path.empty() && !DirExists(aaf_path))
+        p.push_back("aaf path not found: " + aaf_path);
+
+    std::vector<std::string> cmds = {
+        cfg_.GetValue(kGroupMed, kMedBattery),
+        cfg_.GetValue(kGroupMed, kMedThermal),
+        cfg_.GetValue(kGroupService, kServTimeKeep),
+        cfg_.GetValue(kGroupService, kServPmCtrl),
+        cfg_.GetValue(kGroupService, kServVinput),
+    };
+    std::string ex_srvs = cfg_.GetValue(kGroupExtra, kExtraService);
+    boost::trim(ex_srvs);
+    if (!ex_srvs.empty()) {
+        std::vector<std::string> vec;
+        boost::split(vec, ex_srvs, boost::is_any_of(";"), boost::token_compress_on);
+        cmds.insert(cmds.end(), vec.begin(), vec.end());
+    }
+    for (auto &cmd : cmds) {
+        boost::trim(cmd);
+        if (!cmd.empty() && !CmdExecutable(cmd))
+            p.push_back("service binary not found: " + cmd);
+    }
+    return p;
+}
+
+std::vector<std::string> ConfigValidator::CheckPorts(void) {
+    std::vector<std::string> p;
+    std::string model = cfg_.GetValue(kGroupNet, kNetModel);
+    if (model.compare("none") == 0)
+        return p;
+
+    for (const char *key : { kNetAdbPort, kNetFastbootPort }) {
+        std::string str_port = cfg_.GetValue(kGroupNet, key);
+        if (str_port.empty())
+            continue;
+        int port = 0;
+        try {
+            port = std::stoi(str_port);
+        } catch (std::exception &e) {
+            port = 0;
+        }
+        if ((port <= 0) || (port > 65535))
+            p.push_back(std::string("invalid ") + key + ": " + str_port);
+        else if (!TcpPortFree(port))
+            p.push_back(std::string(key) + " already in use: " + str_port);
+    }
+    return p;
+}
+
+std::vector<std::string> ConfigValidator::CheckNet(void) {
+    std::vector<std::string> p;
+    std::string sw = cfg_.GetValue(kGroupNet, kNetSwitch);
+    if (!sw.empty()) {
+        if (!std::all_of(sw.begin(), sw.end(), [](char c) { return isalnum(c) || (c == '_') || (c == '-'); }))
+            p.push_back("invalid net switch name: " + sw);
+        std::string bin = cfg_.GetValue(kGroupNet, kNetSwitchPath);
+        if (!CmdExecutable(bin.empty() ? kVmSwitchBin : bin))
+            p.push_back("vm switch binary not found: " + (bin.empty() ? std::string(kVmSwitchBin) : bin));
+    }
+
+    std::string backend = cfg_.GetValue(kGroupNet, kNetBackend);
+    NetQos qos;
+    for (const char *key : { kNetEgressRate, kNetIngressRate, kNetBurst, kNetPps }) {
+        std::string val = cfg_.GetValue(kGroupNet, key);
+        std::string err;
+        if (!val.empty() && !SetNetQosValue(key, val, &qos, &err))
+            p.push_back(err);
+    }
+    if (!qos.Empty() && (backend.compare(kNetBackendTap) != 0))
+        p.push_back("net egress_rate, ingress_rate and pps need backend tap");
+    if (!qos.Empty() && !CmdExecutable("tc"))
+        p.push_back("tc not found, needed by net QoS");
+
+    if (backend.empty() || (backend.compare(kNetBackendUser) == 0))
+        return p;
+    if (backend.compare(kNetBackendPasst) == 0) {
+        std::string passt = cfg_.GetValue(kGroupNet, kNetPasstPath);
+        if (passt.empty())
+            passt = "passt";
+        if (!CmdExecutable(passt))
+            p.push_back("passt not found: " + passt);
+        return p;
+    }
+    if (backend.compare(kNetBackendTap) != 0) {
+        p.push_back("invalid net backend: " + backend);
+        return p;
+    }
+
+    std::string tap = cfg_.GetValue(kGroupNet, kNetTap);
+    if (tap.size() >= IFNAMSIZ)
+        p.push_back("net tap name too long: " + tap);
+    std::string bridge = cfg_.GetValue(kGroupNet, kNetBridge);
+    if (!bridge.empty() && !NetIfExists(bridge + "/bridge"))
+        p.push_back("net bridge not found: " + bridge);
+
+    std::string queues = cfg_.GetValue(kGroupNet, kNetQueues);
+    if (!queues.empty() && (queues.compare("auto") != 0)) {
+        try {
+            int q = std::stoi(queues);
+            if (q <= 0)
+                p.push_back("invalid net queues: " + queues);
+            else if ((q > 1) && !cfg_.GetValue(kGroupNet, kNetModel).empty() &&
+                     (cfg_.GetValue(kGroupNet, kNetModel).compare("virtio-net-pci") != 0))
+                p.push_back("net queues > 1 requires model virtio-net-pci");
+        } catch (std::exception &e) {
+            p.push_back("invalid net queues: " + queues);
+        }
+    }
+    return p;
+}
+
+std::vector<std::string> ConfigValidator::CheckCid(void) {
+    std::vector<std::string> p;
+    std::string str_cid = cfg_.GetValue(kGroupGlob, kGlobCid);
+    if (str_cid.empty())
+        return p;
+    uint32_t cid = 0;
+    try {
+        cid = std::stoul(str_cid);
+    } catch (std::exception &e) {
+        p.push_back("invalid vsock_cid: " + str_cid);
+        return p;
+    }
+    if ((cid < 3) || (cid >= kCivMaxCidNum))
+        p.push_back("vsock_cid out of range [3, " + std::to_string(kCivMaxCidNum) + "): " + str_cid);
+    else if (!VsockCidPool::Pool().Available(cid))
+        p.push_back("vsock_cid already in use: " + str_cid);
+    return p;
+}
+
+std::vector<std::string> ConfigValidator::CheckPciDevices(void) {
+    std::vector<std::string> p;
+    std::string pt_pci = cfg_.GetValue(kGroupPciPt, kPciPtDev);
+    boost::trim(pt_pci);
+    if (pt_pci.empty())
+        return p;
+
+    std::vector<std::string> vec;
+    boost::split(vec, pt_pci, boost::is_any_of(","), boost::token_compress_on);
+    for (auto &bdf : vec) {
+        boost::trim(bdf);
+        std::string dev = kValPciDevicePath + bdf;
+        if (!DirExists(dev))
+            p.push_back("PCI device not found: " + bdf);
+        else if (!DirExists(dev + "/iommu_group"))
+            p.push_back("PCI device has no IOMMU group: " + bdf);
+    }
+    return p;
+}
+
+std::vector<std::string> ConfigValidator::CheckVgpu(void) {
+    std::vector<std::string> p;
+    std::string type = cfg_.GetValue(kGroupVgpu, kVgpuType);
+    HostInventory &inv = HostInventory::Get();
+    if (type.compare(kVgpuGvtG) == 0) {
+        std::string ver = cfg_.GetValue(kGroupVgpu, kVgpuGvtgVer);
+        if (!inv.HasMdevType(ver))
+            p.push_back("GVT-g type not supported by host: " + ver);
+        if (cfg_.GetValue(kGroupVgpu, kVgpuUuid).empty())
+            p.push_back("GVT-g requires vgpu_uuid");
+    } else if (type.compare(kVgpuGvtD) == 0) {
+        if (inv.GpuDeviceId() < 0)
+            p.push_back("GVT-d requires an Intel GPU at 0000:00:02.0");
+    } else if (type.compare(kVgpuSriov) == 0) {
+        if (inv.SriovTotalVfs() <= 0)
+            p.push_back("SR-IOV is not supported by host GPU");
+    }
+    return p;
+}
+
+std::vector<std::string> ConfigValidator::CheckResources(void) {
+    std::vector<std::string> p;
+    std::string mem = cfg_.GetValue(kGroupMem, kMemSize);
+    int64_t mem_mb = ParseMemSizeMb(mem);
+    if (mem.empty()) {
+        /* Emulator default */
+    } else if (mem_mb <= 0) {
+        p.push_back("invalid memory size: " + mem);
+    }
+
+    std::string page_size = cfg_.GetValue(kGroupMem, kMemPageSize);
+    if (ParseHugePageSize(page_size) == 0)
+        p.push_back("unsupported hugepage size: " + page_size);
+    std::string host_nodes = cfg_.GetValue(kGroupMem, kMemHostNodes);
+    std::vector<int> nodes;
+    if (!host_nodes.empty() && !ParseCpuList(host_nodes, &nodes))
+        p.push_back("invalid host_nodes: " + host_nodes);
+    for (int n : nodes) {
+        if (!DirExists(kValNodePath + std::to_string(n)))
+            p.push_back("host NUMA node not found: " + std::to_string(n));
+    }
+    std::string policy = cfg_.GetValue(kGroupMem, kMemPolicy);
+    if (!policy.empty() && (policy.compare("bind") != 0) && (policy.compare("preferred") != 0) &&
+        (policy.compare("interleave") != 0) && (policy.compare("default") != 0))
+        p.push_back("invalid memory policy: " + policy);
+
+    std::string backend = cfg_.GetValue(kGroupMem, kMemBackend);
+    std::string mem_path = cfg_.GetValue(kGroupMem, kMemPath);
+    if (backend.empty() || (backend.compare(kMemBackendMemfd) == 0)) {
+        /* nothing on the host to check */
+    } else if (backend.compare(kMemBackendHugetlbfs) == 0) {
+        if (!DirExists(mem_path.empty() ? "/dev/hugepages" : mem_path))
+            p.push_back("hugetlbfs mount not found: " + (mem_path.empty() ? "/dev/hugepages" : mem_path));
+    } else if (backend.compare(kMemBackendFile) == 0) {
+        if (mem_path.empty())
+            p.push_back("memory backend file requires mem_path");
+        else if (!DirExists(boost::filesystem::path(mem_path).parent_path().string()) && !DirExists(mem_path))
+            p.push_back("directory of mem_path not found: " + mem_path);
+    } else {
+        p.push_back("invalid memory backend: " + backend);
+    }
+
+    /*
+     * Guest RAM is only taken up front when preallocated or backed by
+     * hugepages, otherwise it is allocated as touched and overcommit (balloon,
+     * KSM) is up to the admin.
+     */
+    bool sriov = (cfg_.GetValue(kGroupVgpu, kVgpuType).compare(kVgpuSriov) == 0);
+    bool hugepages = sriov || !page_size.empty() || (backend.compare(kMemBackendHugetlbfs) == 0);
+    long avail_mb = ReadMemAvailableMb();
+    if ((mem_mb > 0) && (avail_mb >= 0)) {
+        long host_mb = avail_mb;
+        uint32_t page_kb = ParseHugePageSize(page_size);
+        if (hugepages && (page_kb > 0)) {
+            std::ifstream ifs(kValHugePagesPath + std::string("hugepages-") + std::to_string(page_kb) +
+                              "kB/free_hugepages");
+            long free_hp = 0;
+            ifs >> free_hp;
+            host_mb += free_hp * (page_kb / 1024);
+        }
+        if (mem_mb > host_mb) {
+            std::string msg = "memory size " + mem + " exceeds available host memory " +
+                              std::to_string(host_mb) + "M";
+            if (hugepages || IsTrue(cfg_.GetValue(kGroupMem, kMemPrealloc)))
+                p.push_back(msg);
+            else
+                LOG(warning) << msg << ", relying on overcommit";
+        }
+    }
+
+    std::string threads = cfg_.GetValue(kGroupMem, kMemPreallocThreads);
+    if (!threads.empty()) {
+        try {
+            if (std::stoi(threads) <= 0)
+                p.push_back("invalid prealloc_threads: " + threads);
+        } catch (std::exception &e) {
+            p.push_back("invalid prealloc_threads: " + threads);
+        }
+    }
+
+    if (IsTrue(cfg_.GetValue(kGroupMem, kMemBalloon))) {
+        std::string balloon_min = cfg_.GetValue(kGroupMem, kMemBalloonMin);
+        int64_t min_mb = ParseMemSizeMb(balloon_min);
+        if (!balloon_min.empty() && (min_mb <= 0))
+            p.push_back("invalid balloon_min: " + balloon_min);
+        else if ((min_mb > 0) && (mem_mb > 0) && (min_mb > mem_mb))
+            p.push_back("balloon_min " + balloon_min + " exceeds memory size " + mem);
+
+        /* Such memory is pinned on the host, freeing it in the guest gives nothing back */
+        if (hugepages || IsTrue(cfg_.GetValue(kGroupMem, kMemPrealloc)) ||
+            !cfg_.GetValue(kGroupPciPt, kPciPtDev).empty())
+            p.push_back("balloon does not work with hugepages, preallocated memory or passthrough devices");
+    }
+
+    if (IsTrue(cfg_.GetValue(kGroupMem, kMemMerge))) {
+        if (hugepages)
+            p.push_back("memory merge does not work with hugepages");
+        if (!FileExists("/sys/kernel/mm/ksm/run"))
+            p.push_back("memory merge needs a kernel with KSM");
+    }
+
+    int nr_vcpus = 1;
+    std::string vcpu = cfg_.GetValue(kGroupVcpu, kVcpuNum);
+    if (!vcpu.empty()) {
+        try {
+            nr_vcpus = std::stoi(vcpu);
+        } catch (std::exception &e) {
+            nr_vcpus = 0;
+        }
+        if (nr_vcpus <= 0)
+            p.push_back("invalid vcpu number: " + vcpu);
+    }
+
+    std::string pin = cfg_.GetValue(kGroupVcpu, kVcpuPin);
+    std::string emul_pin = cfg_.GetValue(kGroupVcpu, kVcpuEmulPin);
+    if ((nr_vcpus > 0) && (!pin.empty() || !emul_pin.empty())) {
+        bool auto_pin = (pin.compare(kCpuPinAuto) == 0);
+        std::vector<int> vcpu_cpus, emul_cpus;
+        std::string err;
+        if (!ResolveCpuPinning(auto_pin ? "" : pin, emul_pin, nr_vcpus, &vcpu_cpus, &emul_cpus, &err))
+            p.push_back(err);
+        if (auto_pin && !CpuAllocator::Get().CanAllocate(nr_vcpus))
+            p.push_back("no free host cores for " + std::to_string(nr_vcpus) + " vCPUs");
+    }
+    return p;
+}
+
+bool ConfigValidator::Validate(std::vector<std::string> *problems) {
+    using Check = std::vector<std::string> (ConfigValidator::*)(void);
+    const Check checks[] = {
+        &ConfigValidator::CheckEmulator,
+        &ConfigValidator::CheckFirmware,
+        &ConfigValidator::CheckDisk,
+        &ConfigValidator::CheckCoProcs,
+        &ConfigValidator::CheckPorts,
+        &ConfigValidator::CheckNet,
+        &ConfigValidator::CheckCid,
+        &ConfigValidator::CheckPciDevices,
+        &ConfigValidator::CheckVgpu,
+        &ConfigValidator::CheckResources,
+    };
+
+    std::vector<std::future<std::vector<std::string>>> results;
+    for (auto check : checks)
+        results.push_back(std::async(std::launch::async, check, this));
+
+    bool ok = true;
+    for (auto &r : results) {
+        std::vector<std::string> p = r.get();
+        if (p.empty())
+            continue;
+        ok = false;
+        if (problems)
+            problems->insert(problems->end(), p.begin(), p.end());
+    }
+    return ok;
+}
+
+}  // namespace vm_manager
@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2022 Intel Corporation.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#ifndef SRC_GUEST_CONFIG_VALIDATOR_H_
+#define SRC_GUEST_CONFIG_VALIDATOR_H_
+
+#include <string>
+#include <vector>
+
+#include "guest/config_parser.h"
+
+namespace vm_manager {
+
+/*
+ * Pre-flight checks of a guest config: referenced files and binaries, host
+ * ports, vsock CID, PCI devices, graphics and memory needs. The checks run
+ * concurrently and only read host state, so they are done before any host
+ * preparation and every problem is reported at once.
+ */
+class ConfigValidator final {
+ public:
+    explicit ConfigValidator(CivConfig &cfg) : cfg_(cfg) {}
+
+    /* Return true if no problem found, otherwise problems are appended to *problems */
+    bool Validate(std::vector<std::string> *problems);
+
+ private:
+    ConfigValidator(const ConfigValidator &) = delete;
+    ConfigValidator& operator=(const ConfigValidator &) = delete;
+
+    std::vector<std::string> CheckEmulator(void);
+    std::vector<std::string> CheckFirmware(void);
+    std::vector<std::string> CheckDisk(void);
+    std::vector<std::string> CheckDiskGroup(const std::string &group);
+    std::vector<std::string> CheckDiskImageOpts(const std::string &group);
+    std::vector<std::string> CheckDiskThrottle(const std::string &name);
+    std::vector<std::string> CheckCoProcs(void);
+    std::vector<std::string> CheckPorts(void);
+    std::vector<std::string> CheckNet(void);
+    std::vector<std::string> CheckCid(void);
+    std::vector<std::string> CheckPciDevices(void);
+    std::vector<std::string> CheckVgpu(void);
+    std::vector<std::string> CheckResources(void);
+
+    CivConfig &cfg_;
+};
+
+}  // namespace vm_manager
+
+#endif  // SRC_GUEST_CONFIG_VALIDATOR_H_
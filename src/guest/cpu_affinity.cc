@@ -0,0 +1,160 @@
+/*
+ * Copyright (c) 2022 Intel Corporation.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+#include <sched.h>
+
+#include <cstring>
+#include <cerrno>
+#include <fstream>
+#include <algorithm>
+#include <iterator>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
+
+#include "guest/cpu_affinity.h"
+#include "utils/log.h"
+
+namespace vm_manager {
+
+constexpr const char *kSysCpuOnline = "/sys/devices/system/cpu/online";
+
+bool ParseCpuList(const std::string &str, std::vector<int> *cpus) {
+    if (!cpus)
+        return false;
+    cpus->clear();
+
+    std::vector<std::string> ranges;
+    boost::split(ranges, str, boost::is_any_of(","), boost::token_compress_on);
+    try {
+        for (auto &r : ranges) {
+            boost::trim(r);
+            if (r.empty())
+                continue;
+            std::size_t dash = r.find('-');
+            std::size_t pos = 0;
+            int first = std::stoi(r.substr(0, dash), &pos);
+            if (pos != r.substr(0, dash).size())
+                return false;
+            int last = first;
+            if (dash != std::string::npos) {
+                std::string l = r.substr(dash + 1);
+                last = std::stoi(l, &pos);
+                if (pos != l.size())
+                    return false;
+            }
+            if ((first < 0) || (last < first) || (last >= CPU_SETSIZE))
+                return false;
+            for (int c = first; c <= last; c++)
+                cpus->push_back(c);
+        }
+    } catch (std::exception &e) {
+        return false;
+    }
+
+    std::sort(cpus->begin(), cpus->end());
+    cpus->erase(std::unique(cpus->begin(), cpus->end()), cpus->end());
+    return !cpus->empty();
+}
+
+std::string CpuListToString(const std::vector<int> &cpus) {
+    std::string s;
+    for (size_t i = 0; i < cpus.size(); i++) {
+        size_t j = i;
+        while ((j + 1 < cpus.size()) && (cpus[j + 1] == cpus[j] + 1))
+            j++;
+        if (!s.empty())
+            s.append(",");
+        s.append(std::to_string(cpus[i]));
+        if (j > i)
+            s.append("-" + std::to_string(cpus[j]));
+        i = j;
+    }
+    return s;
+}
+
+std::vector<int> OnlineCpus(void) {
+    std::ifstream ifs(kSysCpuOnline);
+    std::string line;
+    std::vector<int> cpus;
+    if (!std::getline(ifs, line) || !ParseCpuList(line, &cpus))
+        cpus.clear();
+    return cpus;
+}
+
+std::vector<pid_t> ProcessThreads(pid_t pid) {
+    std::vector<pid_t> tids;
+    boost::system::error_code ec;
+    boost::filesystem::path task("/proc/" + std::to_string(pid) + "/task");
+    for (auto &x : boost::filesystem::directory_iterator(task, ec)) {
+        try {
+            tids.push_back(std::stoi(x.path().filename().string()));
+        } catch (std::exception &e) {
+            continue;
+        }
+    }
+    return tids;
+}
+
+bool SetThreadAffinity(pid_t tid, const std::vector<int> &cpus) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int c : cpus)
+        CPU_SET(c, &set);
+    if (sched_setaffinity(tid, sizeof(set), &set) != 0) {
+        LOG(warning) << "Failed to set affinity of thread " << tid << " to "
+                     << CpuListToString(cpus) << ": " << strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+static bool AllOnline(const std::vector<int> &cpus, const std::vector<int> &online) {
+    return std::includes(online.begin(), online.end(), cpus.begin(), cpus.end());
+}
+
+bool ResolveCpuPinning(const std::string &pin, const std::string &emul_pin, int nr_vcpus,
+                       std::vector<int> *vcpu_cpus, std::vector<int> *emul_cpus, std::string *err) {
+    if (!vcpu_cpus || !emul_cpus || !err)
+        return false;
+    vcpu_cpus->clear();
+    emul_cpus->clear();
+
+    std::vector<int> online = OnlineCpus();
+    if (online.empty()) {
+        *err = "cannot read online host CPUs";
+        return false;
+    }
+
+    if (!pin.empty()) {
+        if (!ParseCpuList(pin, vcpu_cpus)) {
+            *err = "invalid vcpu pin: " + pin;
+            return false;
+        }
+        if (!AllOnline(*vcpu_cpus, online)) {
+            *err = "vcpu pin has offline CPUs: " + pin;
+            return false;
+        }
+    }
+
+    if (!emul_pin.empty()) {
+        if (!ParseCpuList(emul_pin, emul_cpus)) {
+            *err = "invalid emulator pin: " + emul_pin;
+            return false;
+        }
+        if (!AllOnline(*emul_cpus, online)) {
+            *err = "emulator pin has offline CPUs: " + emul_pin;
+            return false;
+        }
+    } else if (!vcpu_cpus->empty()) {
+        std::set_difference(online.begin(), online.end(), vcpu_cpus->begin(), vcpu_cpus->end(),
+                            std::back_inserter(*emul_cpus));
+    }
+    return true;
+}
+
+}  // namespace vm_manager
@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2022 Intel Corporation.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#ifndef SRC_GUEST_CPU_AFFINITY_H_
+#define SRC_GUEST_CPU_AFFINITY_H_
+
+#include <sys/types.h>
+
+#include <string>
+#include <vector>
+
+namespace vm_manager {
+
+inline constexpr const char *kCpuPinAuto = "auto";
+
+/* Parse a kernel style cpu list, e.g. "2-5,8", into sorted unique cpu ids */
+bool ParseCpuList(const std::string &str, std::vector<int> *cpus);
+std::string CpuListToString(const std::vector<int> &cpus);
+
+/* CPUs listed in /sys/devices/system/cpu/online */
+std::vector<int> OnlineCpus(void);
+
+/* Thread ids of a process, from /proc/<pid>/task */
+std::vector<pid_t> ProcessThreads(pid_t pid);
+
+bool SetThreadAffinity(pid_t tid, const std::vector<int> &cpus);
+
+/*
+ * Resolve the [vcpu] pin and emulator_pin keys of a guest with nr_vcpus vCPUs.
+ * pin is a cpu list ("auto" is assigned by CpuAllocator instead). When
+ * *vcpu_cpus has exactly nr_vcpus CPUs,
+ * vCPU i is pinned to the i-th CPU, otherwise all vCPUs share the set.
+ * Without emulator_pin, the emulator threads get the online CPUs left over by
+ * the vCPUs, or stay unpinned if there are none.
+ */
+bool ResolveCpuPinning(const std::string &pin, const std::string &emul_pin, int nr_vcpus,
+                       std::vector<int> *vcpu_cpus, std::vector<int> *emul_cpus, std::string *err);
+
+}  // namespace vm_manager
+
+#endif  // SRC_GUEST_CPU_AFFINITY_H_
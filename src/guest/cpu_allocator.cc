@@ -0,0 +1,213 @@
+/*
+ * Copyright (c) 2022 Intel Corporation.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+#include <fstream>
+#include <map>
+#include <utility>
+#include <algorithm>
+
+#include <boost/filesystem.hpp>
+
+#include "guest/cpu_allocator.h"
+#include "guest/cpu_affinity.h"
+#include "utils/log.h"
+
+namespace vm_manager {
+
+constexpr const char *kSysCpuPath = "/sys/devices/system/cpu/cpu";
+constexpr const char *kSysNodePath = "/sys/devices/system/node/";
+
+static int ReadSysInt(const std::string &file, int def) {
+    std::ifstream ifs(file);
+    int val = def;
+    if (!(ifs >> val))
+        return def;
+    return val;
+}
+
+/* Id of the L3 cache of cpu, or -1 if it has none */
+static int CpuL3Id(int cpu) {
+    std::string cache = kSysCpuPath + std::to_string(cpu) + "/cache/";
+    for (int i = 0; ; i++) {
+        std::string index = cache + "index" + std::to_string(i);
+        boost::system::error_code ec;
+        if (!boost::filesystem::is_directory(index, ec))
+            return -1;
+        if (ReadSysInt(index + "/level", 0) == 3)
+            return ReadSysInt(index + "/id", 0);
+    }
+}
+
+void CpuAllocator::ReadTopology(void) {
+    std::map<int, int> cpu_node;
+    boost::system::error_code ec;
+    for (auto &x : boost::filesystem::directory_iterator(kSysNodePath, ec)) {
+        std::string name = x.path().filename().string();
+        if ((name.compare(0, 4, "node") != 0) || (name.size() == 4) ||
+            !std::all_of(name.begin() + 4, name.end(), ::isdigit))
+            continue;
+        std::ifstream ifs(x.path().string() + "/cpulist");
+        std::string line;
+        std::vector<int> cpus;
+        if (std::getline(ifs, line) && ParseCpuList(line, &cpus)) {
+            for (int c : cpus)
+                cpu_node[c] = std::stoi(name.substr(4));
+        }
+    }
+
+    /* (package, core_id) -> index in cores_ */
+    std::map<std::pair<int, int>, size_t> core_index;
+    for (int cpu : OnlineCpus()) {
+        std::string topo = kSysCpuPath + std::to_string(cpu) + "/topology/";
+        std::pair<int, int> key(ReadSysInt(topo + "physical_package_id", 0),
+                                ReadSysInt(topo + "core_id", cpu));
+        auto it = core_index.find(key);
+        if (it == core_index.end()) {
+            Core core;
+            core.node = cpu_node.count(cpu) ? cpu_node[cpu] : 0;
+            core.l3 = CpuL3Id(cpu);
+            it = core_index.emplace(key, cores_.size()).first;
+            cores_.push_back(core);
+        }
+        cores_[it->second].cpus.push_back(cpu);
+    }
+
+    std::sort(cores_.begin(), cores_.end(), [](const Core &a, const Core &b) {
+        return a.cpus.front() < b.cpus.front();
+    });
+    for (int i = 0; (i < kHostReservedCores) && (i < static_cast<int>(cores_.size())); i++)
+        cores_[i].host = true;
+
+    LOG(info) << "CPU allocator: " << cores_.size() << " cores, "
+              << kHostReservedCores << " reserved for host";
+}
+
+CpuAllocator::CpuAllocator() {
+    ReadTopology();
+}
+
+CpuAllocator &CpuAllocator::Get(void) {
+    static CpuAllocator ca_;
+    return ca_;
+}
+
+/* Free cores holding at least nr_vcpus CPUs, empty if they do not fit. Caller holds mutex_ */
+std::vector<size_t> CpuAllocator::PickCores(int nr_vcpus) {
+    /* Free cores grouped by locality domain: (node, l3) and node */
+    std::map<std::pair<int, int>, std::vector<size_t>> by_l3;
+    std::map<int, std::vector<size_t>> by_node;
+    std::vector<size_t> all;
+    for (size_t i = 0; i < cores_.size(); i++) {
+        if (cores_[i].host || !cores_[i].owner.empty())
+            continue;
+        by_l3[{ cores_[i].node, cores_[i].l3 }].push_back(i);
+        by_node[cores_[i].node].push_back(i);
+        all.push_back(i);
+    }
+
+    auto threads = [this](const std::vector<size_t> &v) {
+        size_t n = 0;
+        for (size_t i : v)
+            n += cores_[i].cpus.size();
+        return n;
+    };
+
+    /* Best fit: the domain with the fewest free CPUs that still holds the guest */
+    auto best_fit = [&](auto &domains, std::vector<size_t> *out) {
+        size_t best = SIZE_MAX;
+        for (auto &d : domains) {
+            size_t n = threads(d.second);
+            if ((n >= static_cast<size_t>(nr_vcpus)) && (n < best)) {
+                best = n;
+                *out = d.second;
+            }
+        }
+        return best != SIZE_MAX;
+    };
+
+    std::vector<size_t> pool;
+    if (!best_fit(by_l3, &pool) && !best_fit(by_node, &pool))
+        pool = all;
+
+    std::vector<size_t> picked;
+    size_t got = 0;
+    for (size_t i : pool) {
+        if (got >= static_cast<size_t>(nr_vcpus))
+            break;
+        picked.push_back(i);
+        got += cores_[i].cpus.size();
+    }
+    if (got < static_cast<size_t>(nr_vcpus))
+        picked.clear();
+    return picked;
+}
+
+bool CpuAllocator::Allocate(const std::string &vm, int nr_vcpus,
+                            std::vector<int> *vcpu_cpus, std::vector<int> *emul_cpus) {
+    if (!vcpu_cpus || !emul_cpus || (nr_vcpus <= 0))
+        return false;
+
+    std::scoped_lock lock(mutex_);
+    for (auto &c : cores_) {
+        if (c.owner.compare(vm) == 0)
+            c.owner.clear();
+    }
+
+    std::vector<size_t> picked = PickCores(nr_vcpus);
+    if (picked.empty()) {
+        LOG(error) << "No free host cores for " << nr_vcpus << " vCPUs of " << vm;
+        return false;
+    }
+
+    vcpu_cpus->clear();
+    emul_cpus->clear();
+    for (size_t i : picked) {
+        cores_[i].owner = vm;
+        for (int cpu : cores_[i].cpus) {
+            if (vcpu_cpus->size() < static_cast<size_t>(nr_vcpus))
+                vcpu_cpus->push_back(cpu);
+            else
+                emul_cpus->push_back(cpu);
+        }
+    }
+    for (auto &c : cores_) {
+        if (c.host)
+            emul_cpus->insert(emul_cpus->end(), c.cpus.begin(), c.cpus.end());
+    }
+    std::sort(emul_cpus->begin(), emul_cpus->end());
+
+    LOG(info) << "Assign CPUs " << CpuListToString(*vcpu_cpus) << " to " << vm;
+    return true;
+}
+
+void CpuAllocator::Release(const std::string &vm) {
+    std::scoped_lock lock(mutex_);
+    for (auto &c : cores_) {
+        if (c.owner.compare(vm) == 0)
+            c.owner.clear();
+    }
+}
+
+bool CpuAllocator::CanAllocate(int nr_vcpus) {
+    if (nr_vcpus <= 0)
+        return false;
+    std::scoped_lock lock(mutex_);
+    return !PickCores(nr_vcpus).empty();
+}
+
+std::vector<int> CpuAllocator::Assigned(const std::string &vm) {
+    std::vector<int> cpus;
+    std::scoped_lock lock(mutex_);
+    for (auto &c : cores_) {
+        if (c.owner.compare(vm) == 0)
+            cpus.insert(cpus.end(), c.cpus.begin(), c.cpus.end());
+    }
+    std::sort(cpus.begin(), cpus.end());
+    return cpus;
+}
+
+}  // namespace vm_manager
@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2022 Intel Corporation.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#ifndef SRC_GUEST_CPU_ALLOCATOR_H_
+#define SRC_GUEST_CPU_ALLOCATOR_H_
+
+#include <string>
+#include <vector>
+#include <mutex>
+
+namespace vm_manager {
+
+/* Physical cores kept for the host and emulator threads, starting from the core of CPU 0 */
+inline constexpr const int kHostReservedCores = 1;
+
+/*
+ * Assigns whole physical cores (all SMT siblings) to guests with "pin = auto",
+ * so that no two guests share a core. Cores are taken from a single L3 domain
+ * when possible, else from a single NUMA node, picking the domain that fits
+ * most tightly so that free cores stay together for later guests.
+ */
+class CpuAllocator final {
+ public:
+    static CpuAllocator &Get(void);
+
+    /*
+     * Reserve cores for nr_vcpus vCPUs of vm. *vcpu_cpus gets one CPU per vCPU,
+     * *emul_cpus gets the host reserved CPUs plus unused siblings of the cores.
+     */
+    bool Allocate(const std::string &vm, int nr_vcpus, std::vector<int> *vcpu_cpus, std::vector<int> *emul_cpus);
+    void Release(const std::string &vm);
+    bool CanAllocate(int nr_vcpus);
+    /* All CPUs of the cores owned by vm */
+    std::vector<int> Assigned(const std::string &vm);
+
+ private:
+    CpuAllocator();
+    ~CpuAllocator() = default;
+    CpuAllocator(const CpuAllocator &) = delete;
+    CpuAllocator& operator=(const CpuAllocator&) = delete;
+
+    struct Core {
+        std::vector<int> cpus;
+        int node = 0;
+        int l3 = 0;
+        bool host = false;
+        std::string owner;
+    };
+
+    void ReadTopology(void);
+    std::vector<size_t> PickCores(int nr_vcpus);
+
+    std::vector<Core> cores_;
+    std::mutex mutex_;
+};
+
+}  // namespace vm_manager
+
+#endif  // SRC_GUEST_CPU_ALLOCATOR_H_
@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) 2022 Intel Corporation.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/process.hpp>
+#include <boost/algorithm/string.hpp>
+
+#include "guest/disk_image.h"
+#include "utils/log.h"
+
+namespace vm_manager {
+
+constexpr const char *kQemuImg = "qemu-img";
+
+/* -blockdev needs the format driver, the image header is all -drive would have probed */
+std::string DiskImageFormat(const std::string &path) {
+    std::ifstream ifs(path, std::ios::binary);
+    char magic[4] = {};
+    if (ifs.read(magic, sizeof(magic)) && (memcmp(magic, "QFI\xfb", sizeof(magic)) == 0))
+        return "qcow2";
+    return "raw";
+}
+
+static uint64_t ReadBe(const unsigned char *p, int n) {
+    uint64_t v = 0;
+    for (int i = 0; i < n; i++)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+std::string DiskImageBacking(const std::string &path) {
+    /* qcow2 header: backing_file_offset at 8 (be64), backing_file_size at 16 (be32) */
+    std::ifstream ifs(path, std::ios::binary);
+    unsigned char hdr[20];
+    if (!ifs.read(reinterpret_cast<char *>(hdr), sizeof(hdr)) || (memcmp(hdr, "QFI\xfb", 4) != 0))
+        return "";
+    uint64_t offset = ReadBe(hdr + 8, 8);
+    uint64_t size = ReadBe(hdr + 16, 4);
+    if ((offset == 0) || (size == 0) || (size > 1023))
+        return "";
+
+    std::string backing(size, '\0');
+    ifs.seekg(offset);
+    if (!ifs.read(&backing[0], size))
+        return "";
+    /* Relative names are relative to the overlay */
+    if (backing[0] != '/')
+        backing = (boost::filesystem::path(path).parent_path() / backing).string();
+    return backing;
+}
+
+static bool RunQemuImg(const std::vector<std::string> &args) {
+    boost::filesystem::path bin = boost::process::search_path(kQemuImg);
+    if (bin.empty()) {
+        LOG(error) << kQemuImg << " not found";
+        return false;
+    }
+    LOG(info) << kQemuImg << " " << boost::algorithm::join(args, " ");
+    if (boost::process::system(bin, boost::process::args(args))) {
+        LOG(error) << "Failed to : " << kQemuImg << " " << boost::algorithm::join(args, " ");
+        return false;
+    }
+    return true;
+}
+
+bool CreateDiskImage(const std::string &path, const std::string &size, const std::string &format,
+                     const std::string &preallocation, const std::string &cluster_size) {
+    std::string fmt = format.empty() ? "qcow2" : format;
+    std::vector<std::string> opts;
+    if (!preallocation.empty())
+        opts.push_back("preallocation=" + preallocation);
+    if (!cluster_size.empty() && (fmt.compare("qcow2") == 0))
+        opts.push_back("cluster_size=" + cluster_size);
+
+    std::vector<std::string> args = { "create", "-f", fmt };
+    if (!opts.empty()) {
+        args.push_back("-o");
+        args.push_back(boost::algorithm::join(opts, ","));
+    }
+    args.push_back(path);
+    args.push_back(size);
+    return RunQemuImg(args);
+}
+
+bool CreateOverlay(const std::string &golden, const std::string &path, const std::string &size,
+                   const std::string &cluster_size) {
+    boost::system::error_code ec;
+    if (!boost::filesystem::is_regular_file(golden, ec)) {
+        LOG(error) << "Golden image not found: " << golden;
+        return false;
+    }
+    std::string abs_golden = boost::filesystem::absolute(golden).string();
+
+    std::vector<std::string> args = { "create", "-f", "qcow2", "-F", DiskImageFormat(golden), "-b", abs_golden };
+    /* Preallocating an overlay would need extended_l2, only the cluster size carries over */
+    if (!cluster_size.empty()) {
+        args.push_back("-o");
+        args.push_back("cluster_size=" + cluster_size);
+    }
+    args.push_back(path);
+    if (!size.empty())
+        args.push_back(size);
+    return RunQemuImg(args);
+}
+
+bool CommitOverlay(const std::string &path) {
+    if (DiskImageBacking(path).empty()) {
+        LOG(error) << "Not an overlay: " << path;
+        return false;
+    }
+    return RunQemuImg({ "commit", "-f", "qcow2", path });
+}
+
+bool RebaseOverlay(const std::string &path, const std::string &backing) {
+    boost::system::error_code ec;
+    if (!boost::filesystem::is_regular_file(backing, ec)) {
+        LOG(error) << "Backing image not found: " << backing;
+        return false;
+    }
+    /* Safe mode, clusters that differ between the old and new backing are copied into the overlay */
+    return RunQemuImg({ "rebase", "-f", "qcow2", "-F", DiskImageFormat(backing), "-b",
+                        boost::filesystem::absolute(backing).string(), path });
+}
+
+bool FlattenOverlay(const std::string &path) {
+    if (DiskImageBacking(path).empty()) {
+        LOG(info) << "Already standalone: " << path;
+        return true;
+    }
+    return RunQemuImg({ "rebase", "-f", "qcow2", "-b", "", path });
+}
+
+}  // namespace vm_manager
@@ -0,0 +1,48 @@
+/*
+ * Copyright (c) 2022 Intel Corporation.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#ifndef SRC_GUEST_DISK_IMAGE_H_
+#define SRC_GUEST_DISK_IMAGE_H_
+
+#include <string>
+
+namespace vm_manager {
+
+/* "qcow2" or "raw", from the image header */
+std::string DiskImageFormat(const std::string &path);
+
+/* Backing file recorded in a qcow2 header, empty if none */
+std::string DiskImageBacking(const std::string &path);
+
+/*
+ * Create a standalone image, format "qcow2" or "raw". preallocation is
+ * off|metadata|falloc|full, metadata for qcow2 only, and cluster_size applies
+ * to qcow2. Empty options keep the qemu-img defaults.
+ */
+bool CreateDiskImage(const std::string &path, const std::string &size, const std::string &format,
+                     const std::string &preallocation, const std::string &cluster_size);
+
+/*
+ * Create a qcow2 overlay at path on top of golden, which is only read from
+ * then. size may grow the virtual disk beyond golden, empty keeps its size.
+ */
+bool CreateOverlay(const std::string &golden, const std::string &path, const std::string &size,
+                   const std::string &cluster_size);
+
+/* Write the changes of overlay path into its backing file, shared by every overlay of it */
+bool CommitOverlay(const std::string &path);
+
+/* Point overlay path to backing, which must hold the same data as the old one did */
+bool RebaseOverlay(const std::string &path, const std::string &backing);
+
+/* Copy the backing data into overlay path, so that it stands alone */
+bool FlattenOverlay(const std::string &path);
+
+}  // namespace vm_manager
+
+#endif  // SRC_GUEST_DISK_IMAGE_H_
@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) 2022 Intel Corporation.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+#include <vector>
+
+#include <boost/algorithm/string.hpp>
+
+#include "guest/disk_throttle.h"
+#include "utils/utils.h"
+
+namespace vm_manager {
+
+constexpr const char *kThrottleKeys[] = {
+    kThrottleIopsTotal, kThrottleIopsRead, kThrottleIopsWrite, kThrottleBpsTotal, kThrottleBpsRead,
+    kThrottleBpsWrite, kThrottleIopsTotalMax, kThrottleIopsReadMax, kThrottleIopsWriteMax, kThrottleBpsTotalMax,
+    kThrottleBpsReadMax, kThrottleBpsWriteMax, kThrottleBurstLength, kThrottleIopsSize
+};
+
+std::string ThrottleGroupSection(const std::string &name) {
+    return std::string(kGroupThrottle) + "_" + name;
+}
+
+std::string ThrottleGroupId(const std::string &name) {
+    return "throttle-" + name;
+}
+
+bool SetDiskThrottleValue(const std::string &key, const std::string &val, DiskThrottle *t, std::string *err) {
+    bool known = false;
+    for (const char *k : kThrottleKeys)
+        known = known || (key.compare(k) == 0);
+    if (!known) {
+        *err = "unknown disk throttle key: " + key;
+        return false;
+    }
+
+    /* Sizes take K/M/G suffixes, e.g. bps_total=100M */
+    uint64_t v = ParseSize(val);
+    if ((v == 0) && (val.compare("0") != 0)) {
+        *err = "invalid " + key + ": " + val;
+        return false;
+    }
+    (*t)[key] = v;
+    return true;
+}
+
+bool ParseDiskThrottleSpec(const std::string &spec, DiskThrottle *t, std::string *err) {
+    std::vector<std::string> items;
+    boost::split(items, spec, boost::is_any_of(","), boost::token_compress_on);
+    for (auto &item : items) {
+        boost::trim(item);
+        if (item.empty())
+            continue;
+        size_t eq = item.find('=');
+        if (eq == std::string::npos) {
+            *err = "expect key=value: " + item;
+            return false;
+        }
+        if (!SetDiskThrottleValue(boost::trim_copy(item.substr(0, eq)), boost::trim_copy(item.substr(eq + 1)), t,
+                                  err))
+            return false;
+    }
+    return true;
+}
+
+bool LoadDiskThrottle(CivConfig *cfg, const std::string &name, DiskThrottle *t, std::string *err) {
+    std::string section = ThrottleGroupSection(name);
+    if (!cfg->HasGroup(section)) {
+        *err = "throttle group not defined: [" + section + "]";
+        return false;
+    }
+    t->clear();
+    for (const char *key : kThrottleKeys) {
+        std::string val = cfg->GetValue(section, key);
+        if (!val.empty() && !SetDiskThrottleValue(key, val, t, err))
+            return false;
+    }
+    return true;
+}
+
+/*
+ * QEMU names the limits with dashes, e.g. "iops-total-max", and takes one
+ * burst length per burst limit, here burst_length applies to all of them.
+ */
+static std::vector<std::pair<std::string, uint64_t>> QemuLimits(const DiskThrottle &t) {
+    std::vector<std::pair<std::string, uint64_t>> limits;
+    auto length = t.find(kThrottleBurstLength);
+    for (auto &it : t) {
+        if (it.first.compare(kThrottleBurstLength) == 0)
+            continue;
+        std::string name = boost::replace_all_copy(it.first, "_", "-");
+        limits.push_back({ name, it.second });
+        if (boost::ends_with(it.first, "_max") && (it.second > 0) && (length != t.end()) && (length->second > 0))
+            limits.push_back({ name + "-length", length->second });
+    }
+    return limits;
+}
+
+std::string DiskThrottleObject(const std::string &name, const DiskThrottle &t) {
+    std::string obj = "throttle-group,id=" + ThrottleGroupId(name);
+    for (auto &l : QemuLimits(t)) {
+        if (l.second > 0)
+            obj.append(",x-" + l.first + "=" + std::to_string(l.second));
+    }
+    return obj;
+}
+
+std::string DiskThrottleQomSet(const std::string &name, const DiskThrottle &t) {
+    std::vector<std::string> limits;
+    for (auto &l : QemuLimits(t))
+        limits.push_back("\"" + l.first + "\": " + std::to_string(l.second));
+    return "{\"path\": \"/objects/" + ThrottleGroupId(name) + "\", \"property\": \"limits\", \"value\": {" +
+           boost::algorithm::join(limits, ", ") + "}}";
+}
+
+}  // namespace vm_manager
@@ -0,0 +1,41 @@
+/*
+ * Copyright (c) 2022 Intel Corporation.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#ifndef SRC_GUEST_DISK_THROTTLE_H_
+#define SRC_GUEST_DISK_THROTTLE_H_
+
+#include <cstdint>
+#include <string>
+#include <map>
+
+#include "guest/config_parser.h"
+
+namespace vm_manager {
+
+/* Limits of a throttle group by [throttle_<name>] key, 0 is unlimited */
+using DiskThrottle = std::map<std::string, uint64_t>;
+
+/* Config group of throttle group name, and the QOM id of its throttle-group object */
+std::string ThrottleGroupSection(const std::string &name);
+std::string ThrottleGroupId(const std::string &name);
+
+/* Set one throttle key of *t */
+bool SetDiskThrottleValue(const std::string &key, const std::string &val, DiskThrottle *t, std::string *err);
+/* Update *t from "key=value,key=value" */
+bool ParseDiskThrottleSpec(const std::string &spec, DiskThrottle *t, std::string *err);
+/* Read group name of cfg into *t */
+bool LoadDiskThrottle(CivConfig *cfg, const std::string &name, DiskThrottle *t, std::string *err);
+
+/* Options of -object throttle-group */
+std::string DiskThrottleObject(const std::string &name, const DiskThrottle &t);
+/* Arguments of qom-set, replacing the limits present in t */
+std::string DiskThrottleQomSet(const std::string &name, const DiskThrottle &t);
+
+}  // namespace vm_manager
+
+#endif  // SRC_GUEST_DISK_THROTTLE_H_
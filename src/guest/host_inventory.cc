@@ -0,0 +1,239 @@
+/*
+ * Copyright (c) 2022 Intel Corporation.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+
+#include <cstring>
+#include <fstream>
+#include <chrono>
+#include <algorithm>
+
+#include <boost/filesystem.hpp>
+
+#include "guest/host_inventory.h"
+#include "utils/log.h"
+
+namespace vm_manager {
+
+constexpr const char *kSysModulePath = "/sys/module/";
+constexpr const char *kInvGpuDevice = "/sys/bus/pci/devices/0000:00:02.0/device";
+constexpr const char *kInvGpuSriovTotalVfs = "/sys/bus/pci/devices/0000:00:02.0/sriov_totalvfs";
+constexpr const char *kInvGpuSriovNumVfs = "/sys/bus/pci/devices/0000:00:02.0/sriov_numvfs";
+constexpr const char *kInvGpuMdevTypes = "/sys/bus/pci/devices/0000:00:02.0/mdev_supported_types/";
+constexpr const char *kInvSofHdaCard = "/proc/asound/sofhdadsp";
+constexpr const char *kInvPciDevices = "/sys/bus/pci/devices/";
+
+constexpr const int kUeventPollMs = 500;
+constexpr const size_t kUeventBufSize = 8192;
+/* Recheck of a PCI driver wait in case a uevent is lost, and without the listener */
+constexpr const int kPciWaitRecheckMs = 100;
+constexpr const int kPciWaitPollMs = 1;
+
+static int ReadSysInt(const char *file, std::ios_base::fmtflags base) {
+    std::ifstream ifs(file);
+    if (!ifs.is_open())
+        return -1;
+    ifs.setf(base, std::ios_base::basefield);
+    int val = -1;
+    ifs >> val;
+    return ifs.fail() ? -1 : val;
+}
+
+HostInventory &HostInventory::Get(void) {
+    static HostInventory inv_;
+    return inv_;
+}
+
+bool HostInventory::ProbeModule(const std::string &module) {
+    boost::system::error_code ec;
+    return boost::filesystem::exists(kSysModulePath + module, ec);
+}
+
+void HostInventory::ProbeGpu(void) {
+    std::set<std::string> types;
+    boost::system::error_code ec;
+    if (boost::filesystem::is_directory(kInvGpuMdevTypes, ec)) {
+        for (auto &x : boost::filesystem::directory_iterator(kInvGpuMdevTypes, ec))
+            types.insert(x.path().filename().string());
+    }
+
+    int dev_id = ReadSysInt(kInvGpuDevice, std::ios_base::hex);
+    int total_vfs = ReadSysInt(kInvGpuSriovTotalVfs, std::ios_base::dec);
+    int num_vfs = ReadSysInt(kInvGpuSriovNumVfs, std::ios_base::dec);
+
+    std::scoped_lock lock(mutex_);
+    gpu_device_id_ = dev_id;
+    sriov_total_vfs_ = total_vfs;
+    sriov_num_vfs_ = num_vfs;
+    mdev_types_.swap(types);
+}
+
+void HostInventory::ProbeSound(void) {
+    boost::system::error_code ec;
+    bool sof = boost::filesystem::exists(kInvSofHdaCard, ec);
+
+    std::scoped_lock lock(mutex_);
+    sof_hda_ = sof;
+}
+
+/* Kernel uevent: "ACTION@DEVPATH\0KEY=VALUE\0..." */
+void HostInventory::HandleUevent(const char *buf, size_t len) {
+    std::string action, subsystem, devpath;
+    size_t pos = 0;
+    while (pos < len) {
+        const char *s = buf + pos;
+        size_t n = strnlen(s, len - pos);
+        std::string kv(s, n);
+        if (kv.compare(0, 7, "ACTION=") == 0)
+            action = kv.substr(7);
+        else if (kv.compare(0, 10, "SUBSYSTEM=") == 0)
+            subsystem = kv.substr(10);
+        else if (kv.compare(0, 8, "DEVPATH=") == 0)
+            devpath = kv.substr(8);
+        pos += n + 1;
+    }
+
+    if (subsystem.compare("module") == 0) {
+        std::string module = boost::filesystem::path(devpath).filename().string();
+        std::scoped_lock lock(mutex_);
+        auto it = modules_.find(module);
+        if (it != modules_.end())
+            it->second = (action.compare("remove") != 0);
+    } else if ((subsystem.compare("pci") == 0) || (subsystem.compare("drm") == 0) ||
+               (subsystem.compare("mdev") == 0)) {
+        if ((subsystem.compare("pci") == 0) && ((action.compare("bind") == 0) || (action.compare("unbind") == 0))) {
+            /* Under the lock, so a waiter between its check and its wait cannot miss it */
+            std::scoped_lock lock(pci_mutex_);
+            pci_cv_.notify_all();
+        }
+        ProbeGpu();
+    } else if (subsystem.compare("sound") == 0) {
+        ProbeSound();
+    }
+}
+
+void HostInventory::ListenUevent(void) {
+    char buf[kUeventBufSize];
+    struct pollfd pfd = { uevent_fd_, POLLIN, 0 };
+    while (!stop_) {
+        int ret = poll(&pfd, 1, kUeventPollMs);
+        if (ret <= 0)
+            continue;
+        ssize_t n = recv(uevent_fd_, buf, sizeof(buf), 0);
+        if (n <= 0)
+            continue;
+        HandleUevent(buf, n);
+    }
+}
+
+void HostInventory::Start(void) {
+    ProbeGpu();
+    ProbeSound();
+    LOG(info) << "Host inventory: gpu=0x" << std::hex << gpu_device_id_ << std::dec
+              << ", sriov_totalvfs=" << sriov_total_vfs_
+              << ", mdev_types=" << mdev_types_.size()
+              << ", sof_hda=" << sof_hda_;
+
+    uevent_fd_ = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+    if (uevent_fd_ < 0) {
+        LOG(warning) << "Failed to open uevent socket, host inventory will not refresh";
+        return;
+    }
+    struct sockaddr_nl addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = 1;
+    if (bind(uevent_fd_, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0) {
+        LOG(warning) << "Failed to bind uevent socket, host inventory will not refresh";
+        close(uevent_fd_);
+        uevent_fd_ = -1;
+        return;
+    }
+
+    stop_ = false;
+    listener_ = std::make_unique<boost::thread>([this] { ListenUevent(); });
+}
+
+void HostInventory::Stop(void) {
+    stop_ = true;
+    if (listener_) {
+        listener_->join();
+        listener_.reset();
+    }
+    if (uevent_fd_ >= 0) {
+        close(uevent_fd_);
+        uevent_fd_ = -1;
+    }
+}
+
+HostInventory::~HostInventory() {
+    Stop();
+}
+
+bool HostInventory::WaitPciDriver(const std::string &bdf, bool bound, int timeout_ms) {
+    std::string link = kInvPciDevices + bdf + "/driver";
+    auto done = [&link, bound] {
+        boost::system::error_code ec;
+        return boost::filesystem::exists(link, ec) == bound;
+    };
+
+    auto recheck = std::chrono::milliseconds((uevent_fd_ >= 0) ? kPciWaitRecheckMs : kPciWaitPollMs);
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    std::unique_lock lock(pci_mutex_);
+    while (!done()) {
+        auto now = std::chrono::steady_clock::now();
+        if (now >= deadline)
+            return false;
+        pci_cv_.wait_for(lock, std::min<std::chrono::steady_clock::duration>(recheck, deadline - now));
+    }
+    return true;
+}
+
+bool HostInventory::ModuleLoaded(const std::string &module) {
+    std::scoped_lock lock(mutex_);
+    auto it = modules_.find(module);
+    if (it != modules_.end())
+        return it->second;
+    bool loaded = ProbeModule(module);
+    modules_.emplace(module, loaded);
+    return loaded;
+}
+
+void HostInventory::SetModuleLoaded(const std::string &module, bool loaded) {
+    std::scoped_lock lock(mutex_);
+    modules_[module] = loaded;
+}
+
+int HostInventory::GpuDeviceId(void) {
+    std::scoped_lock lock(mutex_);
+    return gpu_device_id_;
+}
+
+int HostInventory::SriovTotalVfs(void) {
+    std::scoped_lock lock(mutex_);
+    return sriov_total_vfs_;
+}
+
+int HostInventory::SriovNumVfs(void) {
+    std::scoped_lock lock(mutex_);
+    return sriov_num_vfs_;
+}
+
+bool HostInventory::HasMdevType(const std::string &type) {
+    std::scoped_lock lock(mutex_);
+    return mdev_types_.find(type) != mdev_types_.end();
+}
+
+bool HostInventory::SofHdaPresent(void) {
+    std::scoped_lock lock(mutex_);
+    return sof_hda_;
+}
+
+}  // namespace vm_manager
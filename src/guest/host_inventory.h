@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2022 Intel Corporation.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#ifndef SRC_GUEST_HOST_INVENTORY_H_
+#define SRC_GUEST_HOST_INVENTORY_H_
+
+#include <string>
+#include <set>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+
+#include <boost/thread.hpp>
+
+namespace vm_manager {
+
+/*
+ * Host capabilities needed to build and prepare guests, probed once when the
+ * server starts and refreshed from kernel uevents (module, pci, drm, sound),
+ * so that builders query memory instead of sysfs or helper processes.
+ */
+class HostInventory final {
+ public:
+    static HostInventory &Get(void);
+
+    void Start(void);
+    void Stop(void);
+
+    bool ModuleLoaded(const std::string &module);
+    void SetModuleLoaded(const std::string &module, bool loaded);
+    int GpuDeviceId(void);
+    int SriovTotalVfs(void);
+    int SriovNumVfs(void);
+    bool HasMdevType(const std::string &type);
+    bool SofHdaPresent(void);
+    /*
+     * Wait until PCI device bdf has a driver bound (bound) or none, woken by
+     * its bind/unbind uevent instead of polling sysfs
+     */
+    bool WaitPciDriver(const std::string &bdf, bool bound, int timeout_ms);
+
+    void ProbeGpu(void);
+
+ private:
+    HostInventory() = default;
+    ~HostInventory();
+    HostInventory(const HostInventory &) = delete;
+    HostInventory& operator=(const HostInventory&) = delete;
+
+    void ProbeSound(void);
+    bool ProbeModule(const std::string &module);
+    void ListenUevent(void);
+    void HandleUevent(const char *buf, size_t len);
+
+    std::mutex mutex_;
+    std::map<std::string, bool> modules_;
+    int gpu_device_id_ = -1;
+    int sriov_total_vfs_ = -1;
+    int sriov_num_vfs_ = -1;
+    std::set<std::string> mdev_types_;
+    bool sof_hda_ = false;
+
+    std::mutex pci_mutex_;
+    std::condition_variable pci_cv_;
+
+    int uevent_fd_ = -1;
+    std::atomic<bool> stop_ = false;
+    std::unique_ptr<boost::thread> listener_;
+};
+
+}  // namespace vm_manager
+
+#endif  // SRC_GUEST_HOST_INVENTORY_H_
@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2022 Intel Corporation.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+#include <fstream>
+#include <algorithm>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
+
+#include "guest/hugepage_manager.h"
+#include "utils/log.h"
+
+namespace vm_manager {
+
+constexpr const char *kSysHugePages = "/sys/kernel/mm/hugepages/";
+constexpr const char *kSysNodePath = "/sys/devices/system/node/node";
+
+int64_t ParseMemSizeMb(const std::string &size) {
+    if (size.empty())
+        return -1;
+    int64_t mb = 0;
+    std::size_t pos = 0;
+    try {
+        mb = std::stoll(size, &pos, 10);
+    } catch (std::exception &e) {
+        return -1;
+    }
+    if (mb <= 0)
+        return -1;
+    std::string suffix = size.substr(pos);
+    if (suffix.empty() || boost::iequals(suffix, "M"))
+        return mb;
+    if (boost::iequals(suffix, "G"))
+        return mb * 1024;
+    return -1;
+}
+
+uint32_t ParseHugePageSize(const std::string &size) {
+    if (size.empty() || boost::iequals(size, "2M"))
+        return kHugePage2M;
+    if (boost::iequals(size, "1G"))
+        return kHugePage1G;
+    return 0;
+}
+
+static int64_t ReadPoolCounter(const std::string &dir, const char *name) {
+    std::ifstream ifs(dir + name);
+    int64_t val = -1;
+    if (!(ifs >> val))
+        return -1;
+    return val;
+}
+
+static bool WritePoolCounter(const std::string &dir, const char *name, uint64_t val) {
+    std::ofstream ofs(dir + name);
+    ofs << val;
+    ofs.flush();
+    return ofs.good();
+}
+
+HugepageManager &HugepageManager::Get(void) {
+    static HugepageManager hm_;
+    return hm_;
+}
+
+std::string HugepageManager::PoolDir(uint32_t page_kb, int node) {
+    PoolKey key(page_kb, node);
+    auto it = pools_.find(key);
+    if (it != pools_.end())
+        return it->second;
+
+    std::string dir = (node < 0) ? std::string(kSysHugePages) :
+                      kSysNodePath + std::to_string(node) + "/hugepages/";
+    dir.append("hugepages-" + std::to_string(page_kb) + "kB/");
+
+    if (ReadPoolCounter(dir, "nr_hugepages") < 0) {
+        LOG(error) << "Hugepage pool not available: " << dir;
+        return "";
+    }
+    return pools_.emplace(key, dir).first->second;
+}
+
+/* Change nr_hugepages of the pool by delta from its current value. Caller holds mutex_ */
+bool HugepageManager::Resize(const std::string &dir, int64_t delta) {
+    int64_t nr = ReadPoolCounter(dir, "nr_hugepages");
+    if (nr < 0)
+        return false;
+    if (delta == 0)
+        return true;
+
+    int64_t target = std::max<int64_t>(nr + delta, 0);
+    /* The kernel allocates or frees pages within the write */
+    WritePoolCounter(dir, "nr_hugepages", target);
+    int64_t now = ReadPoolCounter(dir, "nr_hugepages");
+    if ((delta > 0) && (now < target)) {
+        LOG(error) << "Hugepage pool " << dir << " can only grow to " << now << " of " << target << " pages";
+        WritePoolCounter(dir, "nr_hugepages", nr);
+        return false;
+    }
+    return true;
+}
+
+bool HugepageManager::Reserve(const std::string &vm, uint64_t size_mb, uint32_t page_kb, int node) {
+    if ((size_mb == 0) || (page_kb == 0))
+        return false;
+
+    std::scoped_lock lock(mutex_);
+    std::string dir = PoolDir(page_kb, node);
+    if (dir.empty())
+        return false;
+
+    int64_t free = ReadPoolCounter(dir, "free_hugepages");
+    if (free < 0) {
+        LOG(error) << "Failed to read free hugepages of " << dir;
+        return false;
+    }
+    /* Per node pools have no resv_hugepages */
+    int64_t resv = ReadPoolCounter(dir, "resv_hugepages");
+    int64_t spare = std::max<int64_t>(free - std::max<int64_t>(resv, 0), 0);
+
+    uint64_t pages = (size_mb * 1024 + page_kb - 1) / page_kb;
+    uint64_t added = (pages > static_cast<uint64_t>(spare)) ? pages - spare : 0;
+    if (!Resize(dir, added))
+        return false;
+    reservations_.emplace(vm, Reservation{ PoolKey(page_kb, node), pages, added });
+    LOG(info) << "Reserved " << pages << " hugepages of " << page_kb << "kB"
+              << ((node < 0) ? "" : " on node " + std::to_string(node)) << " for " << vm
+              << ", pool grown by " << added;
+    return true;
+}
+
+void HugepageManager::Release(const std::string &vm) {
+    std::scoped_lock lock(mutex_);
+    auto range = reservations_.equal_range(vm);
+    for (auto it = range.first; it != range.second; ++it) {
+        Resize(pools_[it->second.pool], -static_cast<int64_t>(it->second.added));
+        LOG(info) << "Released " << it->second.pages << " hugepages of " << it->second.pool.first
+                  << "kB for " << vm;
+    }
+    reservations_.erase(range.first, range.second);
+}
+
+uint64_t HugepageManager::ReservedMb(const std::string &vm) {
+    std::scoped_lock lock(mutex_);
+    uint64_t kb = 0;
+    auto range = reservations_.equal_range(vm);
+    for (auto it = range.first; it != range.second; ++it)
+        kb += it->second.pages * it->second.pool.first;
+    return kb / 1024;
+}
+
+}  // namespace vm_manager
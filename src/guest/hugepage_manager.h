@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2022 Intel Corporation.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#ifndef SRC_GUEST_HUGEPAGE_MANAGER_H_
+#define SRC_GUEST_HUGEPAGE_MANAGER_H_
+
+#include <string>
+#include <map>
+#include <vector>
+#include <mutex>
+#include <utility>
+
+namespace vm_manager {
+
+inline constexpr const uint32_t kHugePage2M = 2048U;
+inline constexpr const uint32_t kHugePage1G = 1048576U;
+
+/* Memory size as accepted by QEMU -m: number in MiB, or with suffix M/G. Return -1 if invalid */
+int64_t ParseMemSizeMb(const std::string &size);
+/* "2M"/"1G" to page size in KiB, 0 if not supported */
+uint32_t ParseHugePageSize(const std::string &size);
+
+/*
+ * Hugepage pools of the host, per page size and optionally per NUMA node.
+ * Guests reserve pages through the manager, which grows the pool only by what
+ * the pages free at that time cannot cover, and shrinks it by that same count
+ * when the guest releases its reservation. Both resize from the current
+ * nr_hugepages, so changes others make to the pool meanwhile are kept.
+ * Resizing is serialized, so concurrent starts do not race on nr_hugepages.
+ */
+class HugepageManager final {
+ public:
+    static HugepageManager &Get(void);
+
+    /* node < 0 for the global pool */
+    bool Reserve(const std::string &vm, uint64_t size_mb, uint32_t page_kb, int node);
+    void Release(const std::string &vm);
+    /* Pages reserved by vm in all pools, in MiB */
+    uint64_t ReservedMb(const std::string &vm);
+
+ private:
+    HugepageManager() = default;
+    ~HugepageManager() = default;
+    HugepageManager(const HugepageManager &) = delete;
+    HugepageManager& operator=(const HugepageManager&) = delete;
+
+    using PoolKey = std::pair<uint32_t, int>;
+    struct Reservation {
+        PoolKey pool;
+        uint64_t pages;
+        /* Pages the pool was grown by for this reservation */
+        uint64_t added;
+    };
+
+    /* sysfs directory of a pool, empty if the host has none */
+    std::string PoolDir(uint32_t page_kb, int node);
+    bool Resize(const std::string &dir, int64_t delta);
+
+    std::map<PoolKey, std::string> pools_;
+    std::multimap<std::string, Reservation> reservations_;
+    std::mutex mutex_;
+};
+
+}  // namespace vm_manager
+
+#endif  // SRC_GUEST_HUGEPAGE_MANAGER_H_
@@ -0,0 +1,209 @@
+/*
+ * Copyright (c) 2022 Intel Corporation.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+#include <unistd.h>
+
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+#include <boost/filesystem.hpp>
+
+#include "guest/ksm_controller.h"
+#include "utils/log.h"
+
+namespace vm_manager {
+
+constexpr const char *kKsmSysPath = "/sys/kernel/mm/ksm/";
+
+static int64_t ReadKsm(const std::string &name) {
+    std::ifstream ifs(kKsmSysPath + name);
+    int64_t val = -1;
+    if (!(ifs >> val))
+        return -1;
+    return val;
+}
+
+static bool WriteKsm(const std::string &name, int64_t val) {
+    std::ofstream ofs(kKsmSysPath + name);
+    ofs << val;
+    ofs.flush();
+    if (!ofs.good()) {
+        LOG(warning) << "Failed to write " << kKsmSysPath << name;
+        return false;
+    }
+    return true;
+}
+
+/* utime + stime of the ksmd kernel thread, in clock ticks */
+static int64_t KsmdTicks(void) {
+    static pid_t ksmd = -1;
+    boost::system::error_code ec;
+    if ((ksmd < 0) || !boost::filesystem::exists("/proc/" + std::to_string(ksmd), ec)) {
+        ksmd = -1;
+        for (auto &x : boost::filesystem::directory_iterator("/proc", ec)) {
+            std::ifstream comm(x.path().string() + "/comm");
+            std::string name;
+            if ((comm >> name) && (name.compare("ksmd") == 0)) {
+                ksmd = std::stoi(x.path().filename().string());
+                break;
+            }
+        }
+        if (ksmd < 0)
+            return -1;
+    }
+
+    std::ifstream ifs("/proc/" + std::to_string(ksmd) + "/stat");
+    std::string stat((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+    size_t pos = stat.rfind(')');
+    if (pos == std::string::npos)
+        return -1;
+    /* Fields after the command: state is field 3, utime and stime are fields 14 and 15 */
+    std::istringstream is(stat.substr(pos + 1));
+    std::string field;
+    int64_t utime = 0, stime = 0;
+    for (int i = 3; i < 14; i++)
+        is >> field;
+    if (!(is >> utime >> stime))
+        return -1;
+    return utime + stime;
+}
+
+KsmController &KsmController::Get(void) {
+    static KsmController controller;
+    return controller;
+}
+
+void KsmController::Start(void) {
+    if (thread_)
+        return;
+    {
+        std::scoped_lock lock(mutex_);
+        host_run_ = ReadKsm("run");
+        host_pages_to_scan_ = ReadKsm("pages_to_scan");
+    }
+    thread_ = std::make_unique<boost::thread>([this] { Run(); });
+}
+
+void KsmController::Stop(void) {
+    if (!thread_)
+        return;
+    thread_->interrupt();
+    thread_->join();
+    thread_.reset();
+    std::scoped_lock lock(mutex_);
+    SetRunning(false);
+}
+
+KsmController::~KsmController() {
+    Stop();
+}
+
+void KsmController::SetRunning(bool run) {
+    if (run == running_)
+        return;
+    if (run) {
+        if (WriteKsm("pages_to_scan", pages_to_scan_) && WriteKsm("run", 1))
+            running_ = true;
+    } else {
+        if (host_pages_to_scan_ >= 0)
+            WriteKsm("pages_to_scan", host_pages_to_scan_);
+        /* 0 stops ksmd but keeps what is merged, the guests may still share those pages */
+        WriteKsm("run", (host_run_ == 1) ? 1 : 0);
+        running_ = false;
+    }
+    last_sharing_ = -1;
+    last_cpu_ticks_ = -1;
+    LOG(info) << "KSM " << (running_ ? "started" : "stopped");
+}
+
+void KsmController::Add(const std::string &vm, pid_t pid) {
+    std::scoped_lock lock(mutex_);
+    guests_[vm] = pid;
+    SetRunning(true);
+}
+
+void KsmController::Remove(const std::string &vm) {
+    std::scoped_lock lock(mutex_);
+    if ((guests_.erase(vm) > 0) && guests_.empty())
+        SetRunning(false);
+}
+
+void KsmController::Run(void) {
+    try {
+        while (true) {
+            boost::this_thread::sleep_for(boost::chrono::seconds(kKsmPeriodSec));
+            Tune();
+        }
+    } catch (boost::thread_interrupted &e) {
+        return;
+    }
+}
+
+/*
+ * Scanning pays off while at least 1% of the pages scanned in a period end up
+ * newly shared. Below that the scan rate halves, and ksmd above its CPU share
+ * halves it whatever the gain.
+ */
+void KsmController::Tune(void) {
+    std::scoped_lock lock(mutex_);
+    if (!running_)
+        return;
+
+    int64_t sharing = ReadKsm("pages_sharing");
+    int64_t ticks = KsmdTicks();
+    int64_t sleep_ms = std::max<int64_t>(ReadKsm("sleep_millisecs"), 1);
+    if ((sharing < 0) || (ticks < 0))
+        return;
+
+    if ((last_sharing_ >= 0) && (last_cpu_ticks_ >= 0)) {
+        cpu_pct_ = (ticks - last_cpu_ticks_) * 100 / (sysconf(_SC_CLK_TCK) * kKsmPeriodSec);
+        int64_t gain = sharing - last_sharing_;
+        int64_t scanned = static_cast<int64_t>(pages_to_scan_) * kKsmPeriodSec * 1000 / sleep_ms;
+
+        int pages = pages_to_scan_;
+        if (cpu_pct_ > kKsmMaxCpuPct)
+            pages /= 2;
+        else if (gain * 100 >= scanned)
+            pages *= 2;
+        else if (gain <= 0)
+            pages /= 2;
+        pages = std::clamp(pages, kKsmMinPagesToScan, kKsmMaxPagesToScan);
+
+        if ((pages != pages_to_scan_) && WriteKsm("pages_to_scan", pages)) {
+            LOG(info) << "KSM pages_to_scan " << pages_to_scan_ << " -> " << pages << ", gain " << gain
+                      << " pages, ksmd cpu " << cpu_pct_ << "%";
+            pages_to_scan_ = pages;
+        }
+    }
+    last_sharing_ = sharing;
+    last_cpu_ticks_ = ticks;
+}
+
+std::vector<std::string> KsmController::Stats(void) {
+    std::scoped_lock lock(mutex_);
+    int64_t page_kb = sysconf(_SC_PAGESIZE) >> 10;
+    int64_t sharing = std::max<int64_t>(ReadKsm("pages_sharing"), 0);
+
+    std::vector<std::string> s;
+    s.push_back(std::string("ksm: ") + (running_ ? "running" : "stopped"));
+    s.push_back("ksm_saved: " + std::to_string(sharing * page_kb >> 10) + "M");
+    s.push_back("ksm_pages_to_scan: " + std::to_string(pages_to_scan_));
+    s.push_back("ksm_cpu: " + std::to_string(cpu_pct_) + "%");
+    for (auto &g : guests_) {
+        /* Per process counter, kernel 5.19 and later */
+        std::ifstream ifs("/proc/" + std::to_string(g.second) + "/ksm_merging_pages");
+        int64_t pages = 0;
+        if (ifs >> pages)
+            s.push_back(g.first + ": ksm_merging " + std::to_string(pages * page_kb >> 10) + "M");
+        else
+            s.push_back(g.first + ": ksm_merging n/a");
+    }
+    return s;
+}
+
+}  // namespace vm_manager
@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2022 Intel Corporation.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#ifndef SRC_GUEST_KSM_CONTROLLER_H_
+#define SRC_GUEST_KSM_CONTROLLER_H_
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <memory>
+
+#include <boost/thread.hpp>
+
+namespace vm_manager {
+
+inline constexpr int kKsmPeriodSec = 10;
+/* Range of pages_to_scan, and the share of one CPU ksmd may take */
+inline constexpr int kKsmMinPagesToScan = 64;
+inline constexpr int kKsmMaxPagesToScan = 4096;
+inline constexpr int kKsmMaxCpuPct = 10;
+
+/*
+ * Runs KSM while guests with "merge" are up, and tunes its scan rate each
+ * period: faster while merging still pays off, slower once savings level off
+ * or ksmd takes more CPU than allowed. The run and pages_to_scan the host had
+ * at Start() are put back once no guest needs merging.
+ */
+class KsmController final {
+ public:
+    static KsmController &Get(void);
+
+    void Start(void);
+    void Stop(void);
+
+    /* vm is the emulator pid, for its per process merge counters */
+    void Add(const std::string &vm, pid_t pid);
+    void Remove(const std::string &vm);
+
+    /* "key: value" lines of host wide and per guest KSM state */
+    std::vector<std::string> Stats(void);
+
+ private:
+    KsmController() = default;
+    ~KsmController();
+    KsmController(const KsmController &) = delete;
+    KsmController& operator=(const KsmController&) = delete;
+
+    void Run(void);
+    void Tune(void);
+    void SetRunning(bool run);
+
+    std::mutex mutex_;
+    std::map<std::string, pid_t> guests_;
+    bool running_ = false;
+    int pages_to_scan_ = kKsmMinPagesToScan;
+    int64_t last_sharing_ = -1;
+    int64_t last_cpu_ticks_ = -1;
+    int cpu_pct_ = 0;
+    /* Host settings found at Start(), -1 if unknown */
+    int64_t host_run_ = -1;
+    int64_t host_pages_to_scan_ = -1;
+    std::unique_ptr<boost::thread> thread_;
+};
+
+}  // namespace vm_manager
+
+#endif  // SRC_GUEST_KSM_CONTROLLER_H_
@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2022 Intel Corporation.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+#include <sys/stat.h>
+
+#include <fstream>
+#include <sstream>
+
+#include <boost/filesystem.hpp>
+
+#include "guest/launch_plan.h"
+#include "utils/log.h"
+#include "utils/utils.h"
+
+namespace vm_manager {
+
+constexpr const char *kLaunchPlanMagic = "civ-launch-plan 1";
+
+std::string LaunchPlan::FilePath(const std::string &vm_name) {
+    return std::string(GetConfigPath()) + "/.cache/" + vm_name + ".plan";
+}
+
+/* Size and modification time, enough to notice a replaced or updated binary */
+std::string LaunchPlan::FileStamp(const std::string &path) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+        return std::string();
+    return std::to_string(st.st_size) + ":" + std::to_string(st.st_mtim.tv_sec) + "." +
+           std::to_string(st.st_mtim.tv_nsec);
+}
+
+/* 64-bit FNV-1a, stable across builds unlike std::hash */
+std::string LaunchPlan::Fingerprint(const std::string &data) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (unsigned char c : data) {
+        h ^= c;
+        h *= 0x100000001b3ULL;
+    }
+    std::ostringstream os;
+    os << std::hex << h;
+    return os.str();
+}
+
+void LaunchPlan::Clear(void) {
+    *this = LaunchPlan();
+}
+
+static bool HasLineBreak(const std::string &s) {
+    return s.find('\n') != std::string::npos;
+}
+
+bool LaunchPlan::Save(const std::string &file) const {
+    bool valid = !HasLineBreak(emulator) && (emulator.find('\t') == std::string::npos);
+    std::ostringstream os;
+    os << kLaunchPlanMagic << "\n";
+    os << "fingerprint\t" << fingerprint << "\n";
+    os << "emulator\t" << emulator << "\t" << emulator_stamp << "\n";
+    for (auto &a : argv) {
+        valid = valid && !HasLineBreak(a);
+        os << "arg\t" << a << "\n";
+    }
+    for (auto &c : co_procs) {
+        os << "coproc\t" << c.type << "\n";
+        for (auto &a : c.args) {
+            valid = valid && !HasLineBreak(a);
+            os << "coarg\t" << a << "\n";
+        }
+    }
+    for (auto &p : preps) {
+        valid = valid && !HasLineBreak(p.param);
+        os << "prep\t" << p.step << "\t" << p.param << "\n";
+    }
+    if (!valid) {
+        LOG(warning) << "Launch plan contains line breaks, not cached";
+        return false;
+    }
+
+    boost::system::error_code ec;
+    boost::filesystem::path p(file);
+    boost::filesystem::create_directories(p.parent_path(), ec);
+
+    std::string tmp = file + ".tmp";
+    std::ofstream out(tmp, std::ofstream::trunc);
+    if (!out.is_open())
+        return false;
+    out << os.str();
+    out.close();
+    if (out.fail())
+        return false;
+
+    boost::filesystem::rename(tmp, file, ec);
+    return !ec;
+}
+
+bool LaunchPlan::ParseLine(const std::string &line) {
+    size_t tab = line.find('\t');
+    if (tab == std::string::npos)
+        return false;
+    std::string key = line.substr(0, tab);
+    std::string val = line.substr(tab + 1);
+
+    if (key.compare("fingerprint") == 0) {
+        fingerprint = val;
+    } else if (key.compare("emulator") == 0) {
+        size_t t = val.find('\t');
+        if (t == std::string::npos)
+            return false;
+        emulator = val.substr(0, t);
+        emulator_stamp = val.substr(t + 1);
+    } else if (key.compare("arg") == 0) {
+        argv.push_back(val);
+    } else if (key.compare("coproc") == 0) {
+        co_procs.push_back(CoProcSpec{ val, {} });
+    } else if (key.compare("coarg") == 0) {
+        if (co_procs.empty())
+            return false;
+        co_procs.back().args.push_back(val);
+    } else if (key.compare("prep") == 0) {
+        size_t t = val.find('\t');
+        if (t == std::string::npos)
+            return false;
+        preps.push_back(HostPrep{ val.substr(0, t), val.substr(t + 1) });
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool LaunchPlan::Load(const std::string &file) {
+    Clear();
+
+    std::ifstream in(file);
+    if (!in.is_open())
+        return false;
+
+    std::string line;
+    if (!std::getline(in, line) || line.compare(kLaunchPlanMagic) != 0)
+        return false;
+
+    bool valid = true;
+    while (valid && std::getline(in, line))
+        valid = ParseLine(line);
+
+    if (valid && !fingerprint.empty() && !argv.empty())
+        return true;
+
+    LOG(warning) << "Ignore invalid launch plan: " << file;
+    Clear();
+    return false;
+}
+
+}  // namespace vm_manager
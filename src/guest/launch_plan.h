@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2022 Intel Corporation.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#ifndef SRC_GUEST_LAUNCH_PLAN_H_
+#define SRC_GUEST_LAUNCH_PLAN_H_
+
+#include <string>
+#include <vector>
+
+namespace vm_manager {
+
+/* Placeholders in a cached argv, resolved by the host preparation of each start */
+inline constexpr const char *kPlanCid = "@CID@";
+inline constexpr const char *kPlanSriovVf = "@SRIOV_VF@";
+inline constexpr const char *kPlanRpmbSock = "@RPMB_SOCK@";
+inline constexpr const char *kPlanPwrQmpSock = "@PWR_QMP_SOCK@";
+inline constexpr const char *kPlanNetTap = "@NET_TAP@";
+
+inline constexpr const char *kCoProcSimple = "simple";
+inline constexpr const char *kCoProcRpmb = "rpmb";
+inline constexpr const char *kCoProcVtpm = "vtpm";
+inline constexpr const char *kCoProcPasst = "passt";
+
+struct CoProcSpec {
+    std::string type;
+    std::vector<std::string> args;
+};
+
+struct HostPrep {
+    std::string step;
+    std::string param;
+};
+
+/*
+ * Everything needed to launch a guest once its config has been processed: the
+ * emulator argv, the co-processes and the host preparations to run before exec.
+ * It is cached in <config path>/.cache/<vm>.plan and reused as long as the
+ * fingerprint of config, vm-manager build and host state, and the emulator
+ * binary are unchanged.
+ */
+struct LaunchPlan {
+    std::string fingerprint;
+    std::string emulator;
+    std::string emulator_stamp;
+    std::vector<std::string> argv;
+    std::vector<CoProcSpec> co_procs;
+    std::vector<HostPrep> preps;
+
+    bool Save(const std::string &file) const;
+    bool Load(const std::string &file);
+    void Clear(void);
+
+    static std::string FilePath(const std::string &vm_name);
+    static std::string FileStamp(const std::string &path);
+    static std::string Fingerprint(const std::string &data);
+
+ private:
+    bool ParseLine(const std::string &line);
+};
+
+}  // namespace vm_manager
+
+#endif  // SRC_GUEST_LAUNCH_PLAN_H_
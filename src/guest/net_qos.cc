@@ -0,0 +1,162 @@
+/*
+ * Copyright (c) 2022 Intel Corporation.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+#include <vector>
+#include <algorithm>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/process.hpp>
+
+#include "guest/net_qos.h"
+#include "guest/config_parser.h"
+#include "utils/log.h"
+#include "utils/utils.h"
+
+namespace vm_manager {
+
+/* Smallest police burst, well above a jumbo frame */
+constexpr const uint64_t kMinBurstBytes = 16 * 1024;
+/* Filter priority of the limits, the rest of the clsact qdisc is left alone */
+constexpr const int kNetQosPref = 49152;
+
+bool ParseRate(const std::string &str, uint64_t *bps) {
+    size_t pos = 0;
+    uint64_t v = 0;
+    try {
+        v = std::stoull(str, &pos, 10);
+    } catch (std::exception &e) {
+        return false;
+    }
+
+    std::string unit = boost::algorithm::to_lower_copy(str.substr(pos));
+    uint64_t scale = 1;
+    if (!unit.empty() && (unit[0] == 'k' || unit[0] == 'm' || unit[0] == 'g')) {
+        scale = (unit[0] == 'k') ? 1000ULL : ((unit[0] == 'm') ? 1000000ULL : 1000000000ULL);
+        unit.erase(0, 1);
+    }
+    if (unit.compare("bps") == 0)
+        scale *= 8;
+    else if (!unit.empty() && (unit.compare("bit") != 0))
+        return false;
+
+    *bps = v * scale;
+    return true;
+}
+
+bool SetNetQosValue(const std::string &key, const std::string &val, NetQos *qos, std::string *err) {
+    bool ok = true;
+    if (key.compare(kNetEgressRate) == 0) {
+        ok = ParseRate(val, &qos->egress_bps);
+    } else if (key.compare(kNetIngressRate) == 0) {
+        ok = ParseRate(val, &qos->ingress_bps);
+    } else if (key.compare(kNetBurst) == 0) {
+        qos->burst_bytes = ParseSize(val);
+        ok = (qos->burst_bytes != 0) || (val.compare("0") == 0);
+    } else if (key.compare(kNetPps) == 0) {
+        try {
+            size_t pos = 0;
+            qos->pps = std::stoull(val, &pos, 10);
+            ok = (pos == val.size());
+        } catch (std::exception &e) {
+            ok = false;
+        }
+    } else {
+        *err = "unknown net qos key: " + key;
+        return false;
+    }
+
+    if (!ok)
+        *err = "invalid " + key + ": " + val;
+    return ok;
+}
+
+bool ParseNetQosSpec(const std::string &spec, NetQos *qos, std::string *err) {
+    std::vector<std::string> items;
+    boost::split(items, spec, boost::is_any_of(","), boost::token_compress_on);
+    for (auto &item : items) {
+        boost::trim(item);
+        if (item.empty())
+            continue;
+        size_t eq = item.find('=');
+        if (eq == std::string::npos) {
+            *err = "expect key=value: " + item;
+            return false;
+        }
+        if (!SetNetQosValue(boost::trim_copy(item.substr(0, eq)), boost::trim_copy(item.substr(eq + 1)), qos, err))
+            return false;
+    }
+    return true;
+}
+
+static bool RunTc(const std::string &args, bool quiet) {
+    std::string cmd = "tc " + args;
+    int ret = quiet ? boost::process::system(cmd, boost::process::std_err > boost::process::null) :
+                      boost::process::system(cmd);
+    if ((ret != 0) && !quiet)
+        LOG(error) << "Failed: " << cmd;
+    return ret == 0;
+}
+
+/*
+ * Filter policing rate bps and pps, on one clsact hook of ifname. flower
+ * without keys matches everything like matchall, but can be replaced in
+ * place, so changing limits leaves no window without policing.
+ */
+static bool SetPolice(const std::string &ifname, const char *hook, uint64_t bps, uint64_t burst, uint64_t pps) {
+    std::string filter = "filter replace dev " + ifname + " " + hook + " protocol all pref " +
+                         std::to_string(kNetQosPref) + " handle 1 flower";
+    if (!bps && !pps) {
+        RunTc("filter del dev " + ifname + " " + hook + " pref " + std::to_string(kNetQosPref), true);
+        return true;
+    }
+
+    if (bps) {
+        if (!burst)
+            burst = std::max(bps / 8 / 100, kMinBurstBytes);  // 10ms at line rate
+        filter.append(" action police rate " + std::to_string(bps) + "bit burst " + std::to_string(burst) +
+                      " conform-exceed drop/pipe");
+    }
+    if (pps) {
+        filter.append(" action police pkts_rate " + std::to_string(pps) + " pkts_burst " +
+                      std::to_string(std::max<uint64_t>(pps / 100, 1)) + " conform-exceed drop/pipe");
+    }
+    return RunTc(filter, false);
+}
+
+/*
+ * Packets sent by the guest enter the host on the ingress hook of the tap and
+ * packets to the guest leave on its egress hook, both policed on a clsact
+ * qdisc. A clsact qdisc already on the tap is shared, not replaced.
+ */
+bool ApplyNetQos(const std::string &ifname, const NetQos &qos, NetQosState *state) {
+    if (qos.Empty()) {
+        ClearNetQos(ifname, state);
+        return true;
+    }
+
+    if (!state->own_qdisc && !state->filters && RunTc("qdisc add dev " + ifname + " clsact", true))
+        state->own_qdisc = true;
+    state->filters = true;
+    if (!SetPolice(ifname, "ingress", qos.egress_bps, qos.burst_bytes, qos.pps) ||
+        !SetPolice(ifname, "egress", qos.ingress_bps, qos.burst_bytes, qos.pps))
+        return false;
+    LOG(info) << "Net QoS of " << ifname << ": egress " << qos.egress_bps << "bit ingress " << qos.ingress_bps
+              << "bit pps " << qos.pps;
+    return true;
+}
+
+void ClearNetQos(const std::string &ifname, NetQosState *state) {
+    if (state->own_qdisc) {
+        RunTc("qdisc del dev " + ifname + " clsact", true);
+    } else if (state->filters) {
+        RunTc("filter del dev " + ifname + " ingress pref " + std::to_string(kNetQosPref), true);
+        RunTc("filter del dev " + ifname + " egress pref " + std::to_string(kNetQosPref), true);
+    }
+    *state = NetQosState();
+}
+
+}  // namespace vm_manager
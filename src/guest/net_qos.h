@@ -0,0 +1,50 @@
+/*
+ * Copyright (c) 2022 Intel Corporation.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#ifndef SRC_GUEST_NET_QOS_H_
+#define SRC_GUEST_NET_QOS_H_
+
+#include <cstdint>
+#include <string>
+
+namespace vm_manager {
+
+/* Limits of a guest NIC, 0 is unlimited. Directions are seen from the guest */
+struct NetQos {
+    uint64_t egress_bps = 0;
+    uint64_t ingress_bps = 0;
+    /* Bytes the rate limits may exceed at once, 0 to derive from the rate */
+    uint64_t burst_bytes = 0;
+    /* Packets per second, each direction */
+    uint64_t pps = 0;
+
+    bool Empty(void) const { return !egress_bps && !ingress_bps && !pps; }
+};
+
+/* tc style rate, e.g. "100mbit", "10mbps", or a plain number of bit/s */
+bool ParseRate(const std::string &str, uint64_t *bps);
+
+/* Set one [net] QoS key (egress_rate, ingress_rate, burst or pps) of *qos */
+bool SetNetQosValue(const std::string &key, const std::string &val, NetQos *qos, std::string *err);
+/* Update *qos from "key=value,key=value" */
+bool ParseNetQosSpec(const std::string &spec, NetQos *qos, std::string *err);
+
+/* What ApplyNetQos installed on a tap, so that only that is removed */
+struct NetQosState {
+    bool own_qdisc = false;
+    bool filters = false;
+};
+
+/* Replace the limits on the host side of tap ifname, clearing them if qos is empty */
+bool ApplyNetQos(const std::string &ifname, const NetQos &qos, NetQosState *state);
+/* Remove what ApplyNetQos installed */
+void ClearNetQos(const std::string &ifname, NetQosState *state);
+
+}  // namespace vm_manager
+
+#endif  // SRC_GUEST_NET_QOS_H_
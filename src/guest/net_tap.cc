@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2022 Intel Corporation.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+#include <fcntl.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/if_tun.h>
+#include <linux/sockios.h>
+
+#include <cstring>
+#include <cerrno>
+
+#include <boost/filesystem.hpp>
+
+#include "guest/net_tap.h"
+#include "utils/log.h"
+
+namespace vm_manager {
+
+constexpr const char *kTunDev = "/dev/net/tun";
+
+bool NetIfExists(const std::string &ifname) {
+    return boost::filesystem::exists("/sys/class/net/" + ifname);
+}
+
+static int OpenTap(const std::string &name, int queues, std::string *ifname) {
+    if (name.size() >= IFNAMSIZ) {
+        LOG(error) << "Interface name too long: " << name;
+        return -1;
+    }
+
+    int fd = open(kTunDev, O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        LOG(error) << "Failed to open " << kTunDev << ": " << strerror(errno);
+        return -1;
+    }
+
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    ifr.ifr_flags = IFF_TAP | IFF_NO_PI | IFF_VNET_HDR;
+    if (queues > 1)
+        ifr.ifr_flags |= IFF_MULTI_QUEUE;
+    strncpy(ifr.ifr_name, name.c_str(), IFNAMSIZ - 1);
+    if (ioctl(fd, TUNSETIFF, &ifr) < 0) {
+        LOG(error) << "Failed to set up tap " << name << ": " << strerror(errno);
+        close(fd);
+        return -1;
+    }
+    if (ifname)
+        *ifname = ifr.ifr_name;
+    return fd;
+}
+
+bool CreateTap(const std::string &name, int queues, std::string *ifname) {
+    std::string tap;
+    int fd = OpenTap(name, queues, &tap);
+    if (fd < 0)
+        return false;
+
+    /* Keep the tap after close, the emulator attaches its own queues by name */
+    bool ret = (ioctl(fd, TUNSETPERSIST, 1) == 0);
+    if (!ret)
+        LOG(error) << "Failed to make tap " << tap << " persistent: " << strerror(errno);
+    close(fd);
+    if (ret && ifname)
+        *ifname = tap;
+    return ret;
+}
+
+bool DeleteTap(const std::string &ifname, int queues) {
+    int fd = OpenTap(ifname, queues, nullptr);
+    if (fd < 0)
+        return false;
+
+    bool ret = (ioctl(fd, TUNSETPERSIST, 0) == 0);
+    if (!ret)
+        LOG(warning) << "Failed to delete tap " << ifname << ": " << strerror(errno);
+    close(fd);
+    return ret;
+}
+
+bool SetNetIfUp(const std::string &ifname) {
+    int sock = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (sock < 0)
+        return false;
+
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, ifname.c_str(), IFNAMSIZ - 1);
+    bool ret = (ioctl(sock, SIOCGIFFLAGS, &ifr) == 0);
+    if (ret && !(ifr.ifr_flags & IFF_UP)) {
+        ifr.ifr_flags |= IFF_UP;
+        ret = (ioctl(sock, SIOCSIFFLAGS, &ifr) == 0);
+    }
+    if (!ret)
+        LOG(error) << "Failed to bring up " << ifname << ": " << strerror(errno);
+    close(sock);
+    return ret;
+}
+
+bool AttachBridge(const std::string &ifname, const std::string &bridge) {
+    int ifindex = if_nametoindex(ifname.c_str());
+    if (ifindex == 0) {
+        LOG(error) << "No such interface: " << ifname;
+        return false;
+    }
+
+    int sock = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (sock < 0)
+        return false;
+
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, bridge.c_str(), IFNAMSIZ - 1);
+    ifr.ifr_ifindex = ifindex;
+    bool ret = (ioctl(sock, SIOCBRADDIF, &ifr) == 0);
+    if (!ret)
+        LOG(error) << "Failed to add " << ifname << " to bridge " << bridge << ": " << strerror(errno);
+    close(sock);
+    return ret;
+}
+
+}  // namespace vm_manager
@@ -0,0 +1,35 @@
+/*
+ * Copyright (c) 2022 Intel Corporation.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#ifndef SRC_GUEST_NET_TAP_H_
+#define SRC_GUEST_NET_TAP_H_
+
+#include <string>
+
+namespace vm_manager {
+
+/* Interface name pattern of taps created by the server, completed by the kernel */
+inline constexpr const char *kTapNamePattern = "civtap%d";
+
+bool NetIfExists(const std::string &ifname);
+
+/*
+ * Create a persistent tap with virtio-net headers, multiqueue if queues > 1.
+ * name may hold a "%d" for the kernel to pick a free index, the final name
+ * is returned in *ifname.
+ */
+bool CreateTap(const std::string &name, int queues, std::string *ifname);
+/* queues must match the value the tap was created with */
+bool DeleteTap(const std::string &ifname, int queues);
+
+bool SetNetIfUp(const std::string &ifname);
+bool AttachBridge(const std::string &ifname, const std::string &bridge);
+
+}  // namespace vm_manager
+
+#endif  // SRC_GUEST_NET_TAP_H_
@@ -0,0 +1,204 @@
+/*
+ * Copyright (c) 2022 Intel Corporation.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+#include <poll.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include <boost/filesystem.hpp>
+#include <boost/process.hpp>
+#include <boost/thread.hpp>
+
+#include "guest/proc_log.h"
+#include "utils/log.h"
+
+namespace vm_manager {
+
+constexpr const int kProcLogPollMs = 200;
+constexpr const size_t kProcLogReadChunk = 4_KB;
+
+void ProcLog::SetPolicy(const ProcLogPolicy &policy) {
+    std::scoped_lock lock(mutex_);
+    policy_ = policy;
+    ring_.clear();
+    ring_.shrink_to_fit();
+    head_ = 0;
+}
+
+bool ProcLog::Open(const std::string &file) {
+    std::scoped_lock lock(mutex_);
+    if (ring_.empty() && policy_.ring_size)
+        ring_.resize(policy_.ring_size);
+
+    if (out_.is_open())
+        out_.close();
+
+    /* Reset here, a Stop() may come before the capture thread even runs */
+    stop_ = false;
+    file_ = file;
+    out_.open(file_, std::ofstream::app);
+    if (!out_.is_open()) {
+        LOG(error) << "Failed to open log file: " << file_;
+        return false;
+    }
+
+    boost::system::error_code ec;
+    file_size_ = boost::filesystem::file_size(file_, ec);
+    if (ec)
+        file_size_ = 0;
+
+    boost::filesystem::permissions(file_, boost::filesystem::perms::owner_read |
+                                          boost::filesystem::perms::owner_write |
+                                          boost::filesystem::perms::group_read |
+                                          boost::filesystem::perms::group_write |
+                                          boost::filesystem::perms::others_read |
+                                          boost::filesystem::perms::others_write |
+                                          boost::filesystem::add_perms, ec);
+    return true;
+}
+
+/* Caller holds mutex_ */
+void ProcLog::JoinCompressor(void) {
+    if (!compressor_)
+        return;
+    compressor_->join();
+    compressor_.reset();
+}
+
+void ProcLog::Rotate(void) {
+    out_.close();
+    /* The previous compression must be done with <file>.1 before it is renamed */
+    JoinCompressor();
+
+    boost::system::error_code ec;
+    if (policy_.rotate <= 0) {
+        boost::filesystem::remove(file_, ec);
+    } else {
+        for (int i = policy_.rotate - 1; i >= 1; i--) {
+            std::string from = file_ + "." + std::to_string(i);
+            std::string to = file_ + "." + std::to_string(i + 1);
+            if (boost::filesystem::exists(from, ec))
+                boost::filesystem::rename(from, to, ec);
+            if (boost::filesystem::exists(from + ".zst", ec))
+                boost::filesystem::rename(from + ".zst", to + ".zst", ec);
+        }
+        std::string rotated = file_ + ".1";
+        boost::filesystem::rename(file_, rotated, ec);
+
+        if (policy_.compress) {
+            boost::filesystem::path zstd = boost::process::search_path("zstd");
+            if (zstd.empty()) {
+                LOG(warning) << "zstd not found, keep " << rotated << " uncompressed";
+            } else {
+                /* Compress off the capture path, the child must not block on a full pipe */
+                compressor_ = std::make_unique<boost::thread>([zstd, rotated]() {
+                    std::error_code ec;
+                    boost::process::system(zstd, "-q", "-f", "--rm", rotated,
+                                           boost::process::std_out > boost::process::null,
+                                           boost::process::std_err > boost::process::null, ec);
+                });
+            }
+        }
+    }
+
+    out_.open(file_, std::ofstream::trunc);
+    file_size_ = 0;
+}
+
+void ProcLog::Append(const char *data, size_t len) {
+    std::scoped_lock lock(mutex_);
+    if (!ring_.empty()) {
+        size_t cap = ring_.size();
+        const char *p = data;
+        size_t n = len;
+        if (n > cap) {
+            p += n - cap;
+            n = cap;
+        }
+        size_t pos = (head_ + (len - n)) % cap;
+        size_t first = std::min(n, cap - pos);
+        std::copy(p, p + first, ring_.begin() + pos);
+        std::copy(p + first, p + n, ring_.begin());
+    }
+    head_ += len;
+
+    if (!out_.is_open())
+        return;
+    out_.write(data, len);
+    out_.flush();
+    file_size_ += len;
+    if (policy_.max_file_size && (file_size_ >= policy_.max_file_size))
+        Rotate();
+}
+
+void ProcLog::Write(const std::string &str) {
+    Append(str.data(), str.size());
+}
+
+/* Read from the child's pipe until EOF, or until stopped and the pipe is drained */
+void ProcLog::Capture(int fd) {
+    char buf[kProcLogReadChunk];
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    while (true) {
+        int ret = poll(&pfd, 1, kProcLogPollMs);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (ret == 0) {
+            if (stop_)
+                break;
+            continue;
+        }
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n < 0) {
+            if (errno == EINTR || errno == EAGAIN)
+                continue;
+            break;
+        }
+        if (n == 0)
+            break;
+        Append(buf, n);
+    }
+}
+
+void ProcLog::Stop(void) {
+    stop_ = true;
+    std::scoped_lock lock(mutex_);
+    JoinCompressor();
+}
+
+ProcLog::~ProcLog() {
+    Stop();
+}
+
+uint64_t ProcLog::Read(uint64_t from, size_t max, std::string *out) {
+    std::scoped_lock lock(mutex_);
+    if (!out)
+        return head_;
+    out->clear();
+
+    uint64_t start = (head_ > ring_.size()) ? head_ - ring_.size() : 0;
+    if (from == kProcLogTail)
+        from = head_ - std::min<uint64_t>(head_ - start, max);
+    from = std::clamp(from, start, head_);
+
+    size_t n = std::min<uint64_t>(max, head_ - from);
+    if (n == 0)
+        return from;
+
+    size_t cap = ring_.size();
+    size_t pos = from % cap;
+    size_t first = std::min(n, cap - pos);
+    out->append(ring_.begin() + pos, ring_.begin() + pos + first);
+    out->append(ring_.begin(), ring_.begin() + (n - first));
+    return from + n;
+}
+
+}  // namespace vm_manager
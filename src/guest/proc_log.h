@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2022 Intel Corporation.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#ifndef SRC_GUEST_PROC_LOG_H_
+#define SRC_GUEST_PROC_LOG_H_
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <fstream>
+#include <atomic>
+#include <limits>
+#include <memory>
+
+#include <boost/thread.hpp>
+
+#include "utils/utils.h"
+
+namespace vm_manager {
+
+/* Pass as offset to ProcLog::Read() to get the newest bytes of the ring */
+inline constexpr uint64_t kProcLogTail = std::numeric_limits<uint64_t>::max();
+
+struct ProcLogPolicy {
+    size_t ring_size = 256_KB;
+    size_t max_file_size = 8_MB;
+    int rotate = 3;
+    bool compress = false;
+};
+
+/*
+ * Captures the output of one child process: keeps the most recent bytes in an
+ * in-memory ring and spills everything to a size-capped log file, which is
+ * rotated to <file>.1 .. <file>.N (optionally zstd compressed) once full.
+ * Compression runs on one thread of its own, joined before the next
+ * rotation renames the files and by Stop().
+ */
+class ProcLog final {
+ public:
+    ProcLog() = default;
+    ~ProcLog();
+
+    void SetPolicy(const ProcLogPolicy &policy);
+    bool Open(const std::string &file);
+    void Write(const std::string &str);
+    void Capture(int fd);
+    void Stop(void);
+    uint64_t Read(uint64_t from, size_t max, std::string *out);
+
+ private:
+    ProcLog(const ProcLog&) = delete;
+    ProcLog& operator=(const ProcLog&) = delete;
+
+    void Append(const char *data, size_t len);
+    void Rotate(void);
+    void JoinCompressor(void);
+
+    ProcLogPolicy policy_;
+    std::vector<char> ring_;
+    uint64_t head_ = 0;
+
+    std::string file_;
+    std::ofstream out_;
+    size_t file_size_ = 0;
+    std::unique_ptr<boost::thread> compressor_;
+
+    std::atomic<bool> stop_ = false;
+    std::mutex mutex_;
+};
+
+}  // namespace vm_manager
+
+#endif  // SRC_GUEST_PROC_LOG_H_
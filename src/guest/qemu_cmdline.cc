@@ -0,0 +1,219 @@
+/*
+ * Copyright (c) 2022 Intel Corporation.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+#include <map>
+
+#include <boost/algorithm/string.hpp>
+
+#include "guest/qemu_cmdline.h"
+
+namespace vm_manager {
+
+constexpr const char *kQemuDefaultPciBus = "pcie.0";
+
+QemuDevice &QemuDevice::Set(const std::string &key, const std::string &value) {
+    if (key.compare("bus") == 0) {
+        bus = value;
+        return *this;
+    }
+    if (key.compare("addr") == 0) {
+        addr = value;
+        return *this;
+    }
+    for (auto &p : props) {
+        if (p.first.compare(key) == 0) {
+            p.second = value;
+            return *this;
+        }
+    }
+    props.emplace_back(key, value);
+    return *this;
+}
+
+std::string QemuDevice::Get(const std::string &key) const {
+    if (key.compare("bus") == 0)
+        return bus;
+    if (key.compare("addr") == 0)
+        return addr;
+    for (auto &p : props) {
+        if (p.first.compare(key) == 0)
+            return p.second;
+    }
+    return std::string();
+}
+
+std::string QemuDevice::ToString(void) const {
+    std::string s(driver);
+    for (auto &p : props) {
+        s.append("," + p.first);
+        if (!p.second.empty())
+            s.append("=" + p.second);
+    }
+    if (!bus.empty())
+        s.append(",bus=" + bus);
+    if (!addr.empty())
+        s.append(",addr=" + addr);
+    return s;
+}
+
+void QemuCmdline::AddMachineProp(const std::string &key, const std::string &value) {
+    for (auto &p : machine_props_) {
+        if (p.first.compare(key) == 0) {
+            p.second = value;
+            return;
+        }
+    }
+    machine_props_.emplace_back(key, value);
+}
+
+void QemuCmdline::SetOption(const std::string &opt, const std::string &value) {
+    for (auto &o : options_) {
+        if (o.first.compare(opt) == 0) {
+            o.second = value;
+            return;
+        }
+    }
+    options_.emplace_back(opt, value);
+}
+
+void QemuCmdline::AddFlag(const std::string &flag) {
+    if (std::find(flags_.begin(), flags_.end(), flag) == flags_.end())
+        flags_.push_back(flag);
+}
+
+void QemuCmdline::AddBackend(const std::string &opt, const std::string &spec) {
+    backends_.emplace_back(opt, spec);
+}
+
+void QemuCmdline::AddChardev(const std::string &spec) {
+    chardevs_.push_back(spec);
+}
+
+void QemuCmdline::AddQmp(const std::string &spec) {
+    qmps_.push_back(spec);
+}
+
+QemuDevice &QemuCmdline::AddDevice(const std::string &spec) {
+    std::vector<std::string> items;
+    boost::split(items, spec, boost::is_any_of(","));
+
+    QemuDevice &dev = devices_.emplace_back();
+    dev.driver = items[0];
+    for (size_t i = 1; i < items.size(); i++) {
+        size_t pos = items[i].find('=');
+        if (pos == std::string::npos)
+            dev.Set(items[i], "");
+        else
+            dev.Set(items[i].substr(0, pos), items[i].substr(pos + 1));
+    }
+    return dev;
+}
+
+void QemuCmdline::AddExtra(const std::vector<std::string> &args) {
+    extra_.insert(extra_.end(), args.begin(), args.end());
+}
+
+/* "slot[.function]" in hex, as QEMU parses the addr property */
+static bool ParsePciAddr(const std::string &addr, unsigned long *slot, unsigned long *func) {
+    try {
+        size_t pos = 0;
+        *slot = std::stoul(addr, &pos, 16);
+        *func = 0;
+        if (pos < addr.size()) {
+            if (addr[pos] != '.')
+                return false;
+            std::string f = addr.substr(pos + 1);
+            *func = std::stoul(f, &pos, 16);
+            if (pos != f.size())
+                return false;
+        }
+    } catch (std::exception &e) {
+        return false;
+    }
+    return (*slot < 32) && (*func < 8);
+}
+
+bool QemuCmdline::CheckPciSlots(std::string *err) const {
+    std::map<std::string, std::string> used;
+    for (auto &dev : devices_) {
+        if (dev.addr.empty())
+            continue;
+
+        unsigned long slot, func;
+        if (!ParsePciAddr(dev.addr, &slot, &func)) {
+            if (err)
+                *err = "invalid PCI addr " + dev.addr + " of " + dev.driver;
+            return false;
+        }
+
+        std::string bus = dev.bus.empty() ? kQemuDefaultPciBus : dev.bus;
+        std::string key = bus + ":" + std::to_string(slot) + "." + std::to_string(func);
+        auto it = used.find(key);
+        if (it != used.end()) {
+            if (err)
+                *err = dev.driver + " and " + it->second + " both use PCI slot " + dev.addr + " on " + bus;
+            return false;
+        }
+        used.emplace(key, dev.driver);
+    }
+    return true;
+}
+
+std::vector<std::string> QemuCmdline::ToArgv(void) const {
+    std::vector<std::string> argv;
+    if (binary_.empty())
+        return argv;
+
+    argv.push_back(binary_);
+    if (!name_.empty())
+        argv.insert(argv.end(), { "-name", name_ });
+
+    if (!machine_type_.empty() || !machine_props_.empty()) {
+        std::string m(machine_type_);
+        for (auto &p : machine_props_)
+            m.append((m.empty() ? "" : ",") + p.first + "=" + p.second);
+        argv.insert(argv.end(), { "-machine", m });
+    }
+    if (!cpu_.empty())
+        argv.insert(argv.end(), { "-cpu", cpu_ });
+    if (!smp_.empty())
+        argv.insert(argv.end(), { "-smp", smp_ });
+    if (!mem_.empty())
+        argv.insert(argv.end(), { "-m", mem_ });
+
+    for (auto &o : options_)
+        argv.insert(argv.end(), { o.first, o.second });
+    for (auto &b : backends_)
+        argv.insert(argv.end(), { b.first, b.second });
+    for (auto &c : chardevs_)
+        argv.insert(argv.end(), { "-chardev", c });
+    for (auto &q : qmps_)
+        argv.insert(argv.end(), { "-qmp", q });
+
+    for (auto &dev : devices_) {
+        if (!dev.last)
+            argv.insert(argv.end(), { "-device", dev.ToString() });
+    }
+    argv.insert(argv.end(), extra_.begin(), extra_.end());
+    for (auto &dev : devices_) {
+        if (dev.last)
+            argv.insert(argv.end(), { "-device", dev.ToString() });
+    }
+
+    argv.insert(argv.end(), flags_.begin(), flags_.end());
+    return argv;
+}
+
+std::string QemuCmdline::ToString(void) const {
+    return boost::algorithm::join(ToArgv(), " ");
+}
+
+void QemuCmdline::Clear(void) {
+    *this = QemuCmdline();
+}
+
+}  // namespace vm_manager
@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2022 Intel Corporation.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#ifndef SRC_GUEST_QEMU_CMDLINE_H_
+#define SRC_GUEST_QEMU_CMDLINE_H_
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <utility>
+
+namespace vm_manager {
+
+/* One -device, the spec "driver,bus=..,addr=..,k=v" split into its parts */
+struct QemuDevice {
+    std::string driver;
+    std::string bus;
+    std::string addr;
+    std::vector<std::pair<std::string, std::string>> props;
+    /* Emitted after all other devices, e.g. intel-iommu */
+    bool last = false;
+
+    QemuDevice &Set(const std::string &key, const std::string &value);
+    std::string Get(const std::string &key) const;
+    std::string ToString(void) const;
+};
+
+/*
+ * Typed model of a QEMU invocation, filled in by VmBuilderQemu and serialized
+ * once by ToArgv() in a fixed order:
+ *   binary, -name, -machine, -cpu, -smp, -m, options, backends, chardevs,
+ *   QMP monitors, devices, extra arguments, last devices, flags
+ */
+class QemuCmdline final {
+ public:
+    QemuCmdline() = default;
+
+    void SetBinary(const std::string &path) { binary_ = path; }
+    const std::string &GetBinary(void) const { return binary_; }
+    void SetName(const std::string &name) { name_ = name; }
+    void SetMachine(const std::string &type) { machine_type_ = type; }
+    void AddMachineProp(const std::string &key, const std::string &value);
+    void SetCpu(const std::string &cpu) { cpu_ = cpu; }
+    void SetSmp(const std::string &smp) { smp_ = smp; }
+    void SetMemory(const std::string &mem) { mem_ = mem; }
+
+    /* Single valued options (-display, -vga, -k ...), set again to override */
+    void SetOption(const std::string &opt, const std::string &value);
+    /* Argument-less switches (-enable-kvm, -nodefaults ...) */
+    void AddFlag(const std::string &flag);
+
+    /* Host side backends: -object, -netdev, -drive, -blockdev, -tpmdev, -audiodev, -virtfs */
+    void AddBackend(const std::string &opt, const std::string &spec);
+    void AddChardev(const std::string &spec);
+    void AddQmp(const std::string &spec);
+    QemuDevice &AddDevice(const std::string &spec);
+    void AddExtra(const std::vector<std::string> &args);
+
+    /* Devices with an explicit addr must not share a slot/function on the same bus */
+    bool CheckPciSlots(std::string *err) const;
+
+    std::vector<std::string> ToArgv(void) const;
+    std::string ToString(void) const;
+    void Clear(void);
+
+ private:
+    std::string binary_;
+    std::string name_;
+    std::string machine_type_;
+    std::vector<std::pair<std::string, std::string>> machine_props_;
+    std::string cpu_;
+    std::string smp_;
+    std::string mem_;
+    std::vector<std::pair<std::string, std::string>> options_;
+    std::vector<std::string> flags_;
+    std::vector<std::pair<std::string, std::string>> backends_;
+    std::vector<std::string> chardevs_;
+    std::vector<std::string> qmps_;
+    std::deque<QemuDevice> devices_;
+    std::vector<std::string> extra_;
+};
+
+}  // namespace vm_manager
+
+#endif  // SRC_GUEST_QEMU_CMDLINE_H_
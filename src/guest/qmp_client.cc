@@ -0,0 +1,167 @@
+/*
+ * Copyright (c) 2022 Intel Corporation.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+#include <poll.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <sstream>
+
+#include <boost/thread.hpp>
+#include <boost/property_tree/json_parser.hpp>
+
+#include "guest/qmp_client.h"
+#include "utils/log.h"
+
+namespace vm_manager {
+
+constexpr const size_t kQmpReadChunk = 4096;
+
+/* Wait until the socket is ready for events, false once deadline has passed */
+bool QmpClient::WaitSocket(short events, Deadline deadline) {
+    struct pollfd pfd = { sock_.native_handle(), events, 0 };
+    while (true) {
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+        if (left.count() <= 0)
+            break;
+        int ret = poll(&pfd, 1, left.count());
+        if (ret > 0)
+            return true;
+        if ((ret < 0) && (errno != EINTR))
+            return false;
+    }
+    LOG(warning) << "QMP monitor timed out: " << sock_path_;
+    return false;
+}
+
+bool QmpClient::ReadLine(std::string *line, Deadline deadline) {
+    while (true) {
+        auto data = buf_.data();
+        auto begin = boost::asio::buffers_begin(data);
+        auto end = boost::asio::buffers_end(data);
+        auto nl = std::find(begin, end, '\n');
+        if (nl != end) {
+            line->assign(begin, nl);
+            buf_.consume(nl - begin + 1);
+            return true;
+        }
+
+        if (!WaitSocket(POLLIN, deadline))
+            return false;
+        boost::system::error_code ec;
+        size_t n = sock_.read_some(buf_.prepare(kQmpReadChunk), ec);
+        if (ec == boost::asio::error::would_block)
+            continue;
+        if (ec)
+            return false;
+        buf_.commit(n);
+    }
+}
+
+bool QmpClient::WriteAll(const std::string &data, Deadline deadline) {
+    size_t done = 0;
+    while (done < data.size()) {
+        if (!WaitSocket(POLLOUT, deadline))
+            return false;
+        boost::system::error_code ec;
+        done += sock_.write_some(boost::asio::buffer(data.data() + done, data.size() - done), ec);
+        if (ec && (ec != boost::asio::error::would_block))
+            return false;
+    }
+    return true;
+}
+
+/* Connect to the QMP monitor and wait for its greeting banner */
+bool QmpClient::Connect(int timeout_ms) {
+    timeout_ms_ = timeout_ms;
+    Deadline deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    boost::system::error_code ec;
+    while (true) {
+        /* Non-blocking, a full listen backlog fails with EAGAIN instead of blocking */
+        sock_.open(boost::asio::local::stream_protocol(), ec);
+        if (!ec)
+            sock_.non_blocking(true, ec);
+        if (!ec)
+            sock_.connect(boost::asio::local::stream_protocol::endpoint(sock_path_), ec);
+        if (!ec)
+            break;
+        sock_.close(ec);
+        if (std::chrono::steady_clock::now() >= deadline)
+            return false;
+        boost::this_thread::sleep_for(boost::chrono::milliseconds(10));
+    }
+
+    std::string greeting;
+    if (!ReadLine(&greeting, deadline) || greeting.find("\"QMP\"") == std::string::npos) {
+        LOG(warning) << "Unexpected QMP greeting from " << sock_path_;
+        Close();
+        return false;
+    }
+    return true;
+}
+
+bool QmpClient::Execute(const std::string &cmd, boost::property_tree::ptree *ret) {
+    return Execute(cmd, "", ret);
+}
+
+bool QmpClient::Execute(const std::string &cmd, const std::string &args, boost::property_tree::ptree *ret) {
+    if (!ret)
+        return false;
+
+    if (!negotiated_) {
+        negotiated_ = true;
+        boost::property_tree::ptree caps;
+        if (!Execute("qmp_capabilities", &caps)) {
+            negotiated_ = false;
+            return false;
+        }
+    }
+
+    Deadline deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms_);
+    std::string req = "{\"execute\": \"" + cmd + "\"";
+    if (!args.empty())
+        req.append(", \"arguments\": " + args);
+    req.append("}\n");
+    if (!WriteAll(req, deadline))
+        return false;
+
+    std::string line;
+    while (ReadLine(&line, deadline)) {
+        boost::property_tree::ptree resp;
+        try {
+            std::istringstream is(line);
+            boost::property_tree::read_json(is, resp);
+        } catch (std::exception &e) {
+            LOG(warning) << "Invalid QMP response: " << line;
+            return false;
+        }
+        /* Asynchronous events may arrive before the response */
+        if (resp.count("event"))
+            continue;
+        if (resp.count("error")) {
+            LOG(warning) << "QMP " << cmd << " failed: " << resp.get<std::string>("error.desc", "");
+            return false;
+        }
+        *ret = resp.get_child("return", boost::property_tree::ptree());
+        return true;
+    }
+    return false;
+}
+
+void QmpClient::Close(void) {
+    boost::system::error_code ec;
+    if (sock_.is_open()) {
+        sock_.shutdown(boost::asio::local::stream_protocol::socket::shutdown_both, ec);
+        sock_.close(ec);
+    }
+}
+
+QmpClient::~QmpClient() {
+    Close();
+}
+
+}  // namespace vm_manager
@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2022 Intel Corporation.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#ifndef SRC_GUEST_QMP_CLIENT_H_
+#define SRC_GUEST_QMP_CLIENT_H_
+
+#include <string>
+#include <chrono>
+
+#include <boost/asio.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+namespace vm_manager {
+
+/*
+ * Client of a QMP monitor socket. The socket is non-blocking, Connect() and
+ * each Execute() give up once the timeout passed to Connect() is over, so a
+ * stalled or busy monitor cannot hang the caller.
+ */
+class QmpClient final {
+ public:
+    explicit QmpClient(std::string sock_path) : sock_path_(sock_path), sock_(io_) {}
+    ~QmpClient();
+
+    bool Connect(int timeout_ms);
+    void Close(void);
+    /* Run a QMP command without arguments, the "return" member is stored in *ret */
+    bool Execute(const std::string &cmd, boost::property_tree::ptree *ret);
+    /* args is the JSON object of the "arguments" member, numbers must stay unquoted */
+    bool Execute(const std::string &cmd, const std::string &args, boost::property_tree::ptree *ret);
+
+ private:
+    QmpClient(const QmpClient&) = delete;
+    QmpClient& operator=(const QmpClient&) = delete;
+
+    using Deadline = std::chrono::steady_clock::time_point;
+    bool WaitSocket(short events, Deadline deadline);
+    bool ReadLine(std::string *line, Deadline deadline);
+    bool WriteAll(const std::string &data, Deadline deadline);
+
+    std::string sock_path_;
+    boost::asio::io_context io_;
+    boost::asio::local::stream_protocol::socket sock_;
+    boost::asio::streambuf buf_;
+    bool negotiated_ = false;
+    int timeout_ms_ = 0;
+};
+
+}  // namespace vm_manager
+
+#endif  // SRC_GUEST_QMP_CLIENT_H_
@@ -28,4 +28,8 @@ namespace vm_manager {
     VmBuilder::VmState VmBuilder::GetState(void) {
         return state_;
     }
+
+    BootTrace &VmBuilder::GetBootTrace(void) {
+        return boot_trace_;
+    }
 }  //  namespace vm_manager
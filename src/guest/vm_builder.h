@@ -20,6 +20,7 @@
 
 #include "guest/config_parser.h"
 #include "guest/vm_process.h"
+#include "guest/boot_trace.h"
 #include "utils/log.h"
 
 namespace vm_manager {
@@ -36,9 +37,10 @@ class VmBuilder {
     };
 
  public:
-    explicit VmBuilder(std::string name) : name_(name), vsock_cid_(0) {}
+    explicit VmBuilder(std::string name) : name_(name), vsock_cid_(0), boot_trace_(name) {}
     virtual ~VmBuilder() = default;
     virtual bool BuildVmArgs(void) = 0;
+    virtual bool PrepareHost(void) = 0;
     virtual void StartVm(void) = 0;
     virtual void WaitVmExit(void) = 0;
     virtual void StopVm(void) = 0;
@@ -46,15 +48,20 @@ class VmBuilder {
     virtual bool WaitVmReady(void) = 0;
     virtual void SetVmReady(void) = 0;
     virtual void SetProcessEnv(std::vector<std::string> env) = 0;
+    virtual uint64_t ReadLog(uint64_t from, size_t max, std::string *out) = 0;
+    virtual bool SetNetQos(const std::string &spec) = 0;
+    virtual bool SetDiskThrottle(const std::string &name, const std::string &spec) = 0;
     std::string GetName(void);
     uint32_t GetCid(void);
     VmState GetState(void);
+    BootTrace &GetBootTrace(void);
 
  protected:
     std::string name_;
     uint32_t vsock_cid_;
     VmState state_ = VmBuilder::VmState::kVmEmpty;
     std::mutex state_lock_;
+    BootTrace boot_trace_;
 };
 
 static inline constexpr const char *VmStateToStr(VmBuilder::VmState s) {
@@ -6,10 +6,17 @@
  * SPDX-License-Identifier: Apache-2.0
  *
  */
+#include <sys/utsname.h>
+
 #include <mutex>
 #include <utility>
 #include <memory>
 #include <fstream>
+#include <map>
+#include <cstring>
+#include <algorithm>
+#include <future>
+#include <functional>
 
 #include <boost/process.hpp>
 #include <boost/uuid/uuid.hpp>
@@ -17,38 +24,47 @@
 #include <boost/format.hpp>
 #include <boost/algorithm/string.hpp>
 #include <boost/filesystem.hpp>
+#include <boost/program_options/parsers.hpp>
 
 #include "guest/vm_builder.h"
 #include "guest/vm_builder_qemu.h"
 #include "guest/config_parser.h"
 #include "guest/vsock_cid_pool.h"
 #include "guest/vm_process.h"
+#include "guest/qmp_client.h"
+#include "guest/host_inventory.h"
+#include "guest/cpu_affinity.h"
+#include "guest/cpu_allocator.h"
+#include "guest/hugepage_manager.h"
+#include "guest/net_tap.h"
+#include "guest/vm_switch.h"
+#include "guest/balloon_controller.h"
+#include "guest/ksm_controller.h"
+#include "guest/disk_image.h"
 
 #include "services/message.h"
 #include "utils/log.h"
 #include "utils/utils.h"
+#include "revision.h"
 
 #define MAX_NUM_GUEST 7
 
 namespace vm_manager {
 constexpr const char *kPciDevicePath = "/sys/bus/pci/devices/";
+constexpr const int kPciUnbindTimeoutMs = 2000;
 constexpr const char *kPciDriverPath = "/sys/bus/pci/drivers/";
 constexpr const char *kPciDriverProbe = "/sys/bus/pci/drivers_probe";
 
 constexpr const char *kIntelGpuBdf = "0000:00:02.0";
 constexpr const char *kIntelGpuDevPath = "/sys/bus/pci/devices/0000:00:02.0/";
-constexpr const char *kIntelGpuDevice = "/sys/bus/pci/devices/0000:00:02.0/device";
 constexpr const char *kIntelGpuDriver = "/sys/bus/pci/devices/0000:00:02.0/driver";
 constexpr const char *kIntelGpuDriverUnbind = "/sys/bus/pci/devices/0000:00:02.0/driver/unbind";
-constexpr const char *kIntelGpuSriovTotalVfs = "/sys/bus/pci/devices/0000:00:02.0/sriov_totalvfs";
 constexpr const char *kIntelGpuSriovAutoProbe = "/sys/bus/pci/devices/0000:00:02.0/sriov_drivers_autoprobe";
 constexpr const char *kIntelGpuSriovNumVfs = "/sys/bus/pci/devices/0000:00:02.0/sriov_numvfs";
 
 constexpr const char *kVfioPciNewId =    "/sys/bus/pci/drivers/vfio-pci/new_id";
 constexpr const char *kVfioPciRemoveId = "/sys/bus/pci/drivers/vfio-pci/remove_id";
 constexpr const char *kVfioPciUnbind =   "/sys/bus/pci/drivers/vfio-pci/unbind";
-constexpr const char *kVfioModulePath = "/sys/module/vfio/";
-constexpr const char *kVfioPciModulePath = "/sys/module/vfio_pci/";
 
 constexpr const char *kGvtgMdevTypePath = "/sys/bus/pci/devices/0000:00:02.0/mdev_supported_types/";
 constexpr const char *kGvtgMdevV51Path = "/sys/bus/pci/devices/0000:00:02.0/mdev_supported_types/i915-GVTg_V5_1/";
@@ -56,9 +72,6 @@ constexpr const char *kGvtgMdevV52Path = "/sys/bus/pci/devices/0000:00:02.0/mdev
 constexpr const char *kGvtgMdevV54Path = "/sys/bus/pci/devices/0000:00:02.0/mdev_supported_types/i915-GVTg_V5_4/";
 constexpr const char *kGvtgMdevV58Path = "/sys/bus/pci/devices/0000:00:02.0/mdev_supported_types/i915-GVTg_V5_8/";
 
-constexpr const char *kSys2MFreeHugePages = "/sys/kernel/mm/hugepages/hugepages-2048kB/free_hugepages";
-constexpr const char *kSys2MNrHugePages = "/sys/kernel/mm/hugepages/hugepages-2048kB/nr_hugepages";
-
 constexpr const char *kDrmCard0Vf = "/sys/class/drm/card0/iov/vf";
 constexpr const char *kGtPreemptTimeoutUs = "/gt/preempt_timeout_us";
 constexpr const char *kGtExecQuantumMs = "/gt/exec_quantum_ms";
@@ -68,6 +81,26 @@ constexpr const unsigned int kExecQuantum = 25;
 
 constexpr const char *kQmpPowerSocket = "/tmp/qmp-pwr-socket-";
 
+constexpr const int kQmpFirstResponseTimeoutMs = 5000;
+constexpr const int kQmpConnectTimeoutMs = 1000;
+
+/* Host preparation steps of a launch plan */
+constexpr const char *kPrepHugePages = "hugepages";
+constexpr const char *kPrepSriovVf = "sriov_vf";
+constexpr const char *kPrepGvtgVgpu = "gvtg_vgpu";
+constexpr const char *kPrepSoundCardHook = "sound_card_hook";
+constexpr const char *kPrepGpuPassthrough = "gpu_passthrough";
+constexpr const char *kPrepHciDown = "hci_down";
+constexpr const char *kPrepPciPassthrough = "pci_passthrough";
+constexpr const char *kPrepVsockCid = "vsock_cid";
+constexpr const char *kPrepRpmbSock = "rpmb_sock";
+constexpr const char *kPrepPwrQmpSock = "pwr_qmp_sock";
+constexpr const char *kPrepAaf = "aaf";
+constexpr const char *kPrepCpuAlloc = "cpu_alloc";
+constexpr const char *kPrepNetTap = "net_tap";
+constexpr const char *kPrepVmSwitch = "vm_switch";
+constexpr const char *kPrepDiskOverlay = "disk_overlay";
+
 static bool CheckUuid(std::string uuid) {
     try {
         boost::uuids::string_generator gen;
@@ -97,12 +130,14 @@ void VmBuilderQemu::SoundCardHook(void) {
         passthrough when sof-hda is enabled on host and reinsert
         snd-sof-pci-intel-tgl module before exit from guest.
     */
-    if (!boost::process::system("ls /proc/asound/sofhdadsp")) {
+    if (HostInventory::Get().SofHdaPresent()) {
         LOG(info) << "Removing snd-sof-pci-intel-tgl ...";
         if (!boost::process::system("modprobe -r snd-sof-pci-intel-tgl")) {
+            HostInventory::Get().SetModuleLoaded("snd_sof_pci_intel_tgl", false);
             end_call_.emplace([](){
                 LOG(info) << "Probing snd-sof-pci-intel-tgl ...";
-                boost::process::system("modprobe snd-sof-pci-intel-tgl");
+                if (!boost::process::system("modprobe snd-sof-pci-intel-tgl"))
+                    HostInventory::Get().SetModuleLoaded("snd_sof_pci_intel_tgl", true);
             });
         }
     }
@@ -147,87 +182,43 @@ static int WriteSysFile(const char *sys_file, const std::string &str) {
     }
 }
 
-static bool SetupHugePages(const std::string &mem_size) {
-    if (mem_size.empty())
-        return false;
-
-    int mem_mb = 0;
-    try {
-        mem_mb = std::stoi(mem_size, nullptr, 0);
-    } catch (std::exception &e) {
-        LOG(error) << e.what();
-        return false;
-    }
-
-    if (mem_mb <= 0)
-        return false;
-
-    switch (toupper(mem_size.back())) {
-    case '0' ... '9':
-    case 'A' ... 'F':
-    case 'M':
-        break;
-    case 'G':
-        if (mem_mb > INT32_MAX/1024)
-            return false;
-        else
-            mem_mb *= 1024;
-        break;
-    default:
-        return false;
-    }
-
-    /* Get free Huge pages */
-    int free_hp = ReadSysFile(kSys2MFreeHugePages, std::ios_base::dec);
-
-    if (free_hp >= mem_mb/2)
+static bool LoadKernelModule(const std::string &module) {
+    if (HostInventory::Get().ModuleLoaded(module))
         return true;
-
-    /* Get nr hugepages */
-    int nr_hp = ReadSysFile(kSys2MNrHugePages, std::ios_base::dec);
-    int required_hp = nr_hp - free_hp + mem_mb/2;
-
-    /* Try to allocate required huge pages */
-    WriteSysFile(kSys2MNrHugePages, std::to_string(required_hp));
-
-    /* check nr huge pages */
-    int wait_cnt = 0;
-    while (nr_hp != required_hp) {
-        nr_hp = ReadSysFile(kSys2MNrHugePages, std::ios_base::dec);
-        if (wait_cnt < 200) {
-            usleep(10000);
-            wait_cnt++;
-        } else {
-            LOG(error) << "Hugepage cannot achieve required size!\n";
-            return false;
-        }
-    }
-
+    if (boost::process::system("modprobe " + module))
+        return false;
+    HostInventory::Get().SetModuleLoaded(module, true);
     return true;
 }
 
-static bool LoadKernelModule(const char *path, const std::string &module) {
-    boost::system::error_code ec;
-    boost::filesystem::path p(path);
-    if (!boost::filesystem::exists(p, ec)) {
-        if (boost::process::system("modprobe " + module))
-            return false;
+static bool IsTrue(const std::string &val) {
+    return (val.compare("true") == 0) || (val.compare("on") == 0) || (val.compare("yes") == 0);
+}
+
+static int VcpuCount(const std::string &num) {
+    if (num.empty())
+        return 1;
+    try {
+        return std::stoi(num);
+    } catch (std::exception &e) {
+        LOG(warning) << "Invalid vcpu number: " << num;
+        return 0;
     }
-    return true;
 }
 
 static int SetAvailableVf(void) {
-    if (!LoadKernelModule(kVfioModulePath, "vfio"))
+    if (!LoadKernelModule("vfio"))
         return -1;
 
-    if (!LoadKernelModule(kVfioPciModulePath, "vfio-pci"))
+    if (!LoadKernelModule("vfio_pci"))
         return -1;
 
-    int totalvfs = ReadSysFile(kIntelGpuSriovTotalVfs, std::ios_base::dec);
+    HostInventory &inv = HostInventory::Get();
+    int totalvfs = inv.SriovTotalVfs();
     if (totalvfs <= 0)
         return -1;
 
-    int current_vfs = ReadSysFile(kIntelGpuSriovNumVfs, std::ios_base::dec);
+    int current_vfs = inv.SriovNumVfs();
     if (current_vfs < 0)
         return -1;
 
@@ -236,9 +227,10 @@ static int SetAvailableVf(void) {
         WriteSysFile(kIntelGpuSriovNumVfs, "0");
         WriteSysFile(kIntelGpuSriovNumVfs, std::to_string(totalvfs));
         WriteSysFile(kIntelGpuSriovAutoProbe, "1");
+        inv.ProbeGpu();
     }
 
-    int dev_id = ReadSysFile(kIntelGpuDevice, std::ios_base::hex);
+    int dev_id = inv.GpuDeviceId();
     if (dev_id < 0)
         return -1;
 
@@ -273,30 +265,19 @@ static int SetAvailableVf(void) {
     return -1;
 }
 
-bool VmBuilderQemu::SetupSriov(void) {
+bool VmBuilderQemu::BuildSriovCmd(void) {
     std::string vgpu_mon_id = cfg_.GetValue(kGroupVgpu, kVgpuMonId);
     if (vgpu_mon_id.empty()) {
-        emul_cmd_.append(" -display gtk,gl=on");
+        cmdline_.SetOption("-display", "gtk,gl=on");
     } else {
-        emul_cmd_.append(" -display gtk,gl=on,monitor=" + vgpu_mon_id);
-    }
-
-    std::string mem_size = cfg_.GetValue(kGroupMem, kMemSize);
-    boost::trim(mem_size);
-
-    if (!SetupHugePages(mem_size)) {
-        LOG(info) << "Failed to setup hugepage for SRIOV!";
-        return false;
+        cmdline_.SetOption("-display", "gtk,gl=on,monitor=" + vgpu_mon_id);
     }
-    int vf = SetAvailableVf();
-    if (vf < 0)
-        return false;
 
-    emul_cmd_.append(" -device virtio-vga,max_outputs=1,blob=true"
-                    " -device vfio-pci,host=0000:00:02." + std::to_string(vf) +
-                    " -object memory-backend-memfd,hugetlb=on,id=mem_sriov,size=" + mem_size +
-                    " -machine memory-backend=mem_sriov");
+    /* Guest RAM must be memfd backed hugepages, see BuildMemCmd */
+    plan_.preps.push_back({ kPrepSriovVf, "" });
 
+    cmdline_.AddDevice("virtio-vga,max_outputs=1,blob=true");
+    cmdline_.AddDevice("vfio-pci,host=0000:00:02." + std::string(kPlanSriovVf));
     return true;
 }
 
@@ -314,24 +295,27 @@ void VmBuilderQemu::BringDownBtHciIntf(void) {
 
 void VmBuilderQemu::BuildExtraGuestPmCtrlCmd(void) {
     std::string ex_cmd = cfg_.GetValue(kGroupExtra, kExtraPwrCtrlMultiOS);
-    if (ex_cmd == "true") {
-        static std::string socketPath;
-        for (int avail = 0; avail < MAX_NUM_GUEST; avail++) {
-            socketPath = kQmpPowerSocket + std::to_string(avail);
-            if (access(socketPath.c_str(), F_OK) != 0) {
-                std::string qmpCmd = " -qmp unix:" + socketPath + ",server,nowait";
-                emul_cmd_.append(qmpCmd);
-                break;
-            }
-        }
-
-        end_call_.emplace([](){
-            boost::system::error_code ec;
-            boost::filesystem::remove(socketPath, ec);
-        });
-    } else {
+    if (ex_cmd != "true")
         return;
+
+    cmdline_.AddQmp("unix:" + std::string(kPlanPwrQmpSock) + ",server,nowait");
+    plan_.preps.push_back({ kPrepPwrQmpSock, "" });
+}
+
+bool VmBuilderQemu::SetupPwrQmpSock(std::string *sock) {
+    for (int avail = 0; avail < MAX_NUM_GUEST; avail++) {
+        std::string path = kQmpPowerSocket + std::to_string(avail);
+        if (access(path.c_str(), F_OK) != 0) {
+            *sock = path;
+            end_call_.emplace([path](){
+                boost::system::error_code ec;
+                boost::filesystem::remove(path, ec);
+            });
+            return true;
+        }
     }
+    LOG(error) << "No free power control QMP socket";
+    return false;
 }
 
 enum PciPassthroughAction {
@@ -339,14 +323,21 @@ enum PciPassthroughAction {
     kPciRestore
 };
 
+/*
+ * IOMMU groups are prepared at once, new_id/remove_id of vfio-pci and the
+ * modprobes are shared by all of them, only the waits for unbind run in parallel.
+ */
+static std::mutex vfio_mutex;
+
 static bool PassthroughOnePciDev(const char *pci_id, PciPassthroughAction action) {
     if (!pci_id)
         return false;
 
-    if (!LoadKernelModule(kVfioModulePath, "vfio"))
+    std::unique_lock<std::mutex> lock(vfio_mutex);
+    if (!LoadKernelModule("vfio"))
         return false;
 
-    if (!LoadKernelModule(kVfioPciModulePath, "vfio-pci"))
+    if (!LoadKernelModule("vfio_pci"))
         return false;
 
     boost::filesystem::path p(kPciDevicePath);
@@ -358,7 +349,7 @@ static bool PassthroughOnePciDev(const char *pci_id, PciPassthroughAction action
     }
 
     for (boost::filesystem::directory_entry& x : boost::filesystem::directory_iterator(p)) {
-        std::cout << "  " << x.path() << "\n";
+        LOG(debug) << "IOMMU group device - " << x.path().string();
         std::string str_dev(x.path().string() + "/device");
         int device = ReadSysFile(str_dev.c_str(), std::ios_base::hex);
         std::string str_ven(x.path().string() + "/vendor");
@@ -371,9 +362,11 @@ static bool PassthroughOnePciDev(const char *pci_id, PciPassthroughAction action
             if (IsVfioDriver(driver.c_str())) {
                 WriteSysFile(kVfioPciRemoveId, ven_dev);
                 WriteSysFile(kVfioPciUnbind, x.path().filename().string());
+                lock.unlock();
+                if (!HostInventory::Get().WaitPciDriver(x.path().filename().string(), false, kPciUnbindTimeoutMs))
+                    LOG(warning) << "Still bound to vfio-pci - " << x.path().filename().string();
+                lock.lock();
             }
-            /* TODO: check whether unbind successfully instead of sleep */
-            sleep(1);
 
             if (WriteSysFile(kPciDriverProbe, x.path().filename().string()))
                 return false;
@@ -389,19 +382,12 @@ static bool PassthroughOnePciDev(const char *pci_id, PciPassthroughAction action
             LOG(info) << "Unbind PCI driver - " << x.path().filename().string();
             WriteSysFile(drv_unbind.c_str(), x.path().filename().string());
 
-            /* wait driver to be unbinded */
-            constexpr const int kCheckUnbindRepeatCount = 2000;
-            int cnt = 0;
-            while (cnt < kCheckUnbindRepeatCount) {
-                if (!boost::filesystem::exists(driver, ec))
-                    break;
-                boost::this_thread::sleep_for(boost::chrono::milliseconds(1));
-                cnt++;
-            }
-            if (cnt >= kCheckUnbindRepeatCount) {
+            lock.unlock();
+            if (!HostInventory::Get().WaitPciDriver(x.path().filename().string(), false, kPciUnbindTimeoutMs)) {
                 LOG(error) << "Failed to unbind - " << x.path().filename().string();
                 return false;
             }
+            lock.lock();
         }
 
         int errno_saved = WriteSysFile(kVfioPciNewId, ven_dev);
@@ -416,6 +402,52 @@ static bool PassthroughOnePciDev(const char *pci_id, PciPassthroughAction action
     return true;
 }
 
+/* IOMMU group number of PCI device bdf, bdf itself if it has none */
+static std::string IommuGroup(const std::string &bdf) {
+    boost::system::error_code ec;
+    boost::filesystem::path group = boost::filesystem::read_symlink(kPciDevicePath + bdf + "/iommu_group", ec);
+    return ec ? bdf : group.filename().string();
+}
+
+/*
+ * Run fn on each device, devices of different IOMMU groups at once. fn
+ * handles the whole IOMMU group of a device, so devices sharing one run in
+ * turn. Returns whether fn succeeded, per device.
+ */
+static std::vector<int> ForEachIommuGroup(const std::vector<std::string> &devs,
+                                          const std::function<bool(const std::string &)> &fn) {
+    std::map<std::string, std::vector<size_t>> groups;
+    for (size_t i = 0; i < devs.size(); i++)
+        groups[IommuGroup(devs[i])].push_back(i);
+
+    std::vector<int> ok(devs.size(), 0);
+    std::vector<std::future<void>> results;
+    for (auto &g : groups) {
+        results.push_back(std::async(std::launch::async, [&devs, &fn, &ok, idx = g.second] {
+            for (size_t i : idx)
+                ok[i] = fn(devs[i]);
+        }));
+    }
+    for (auto &r : results)
+        r.get();
+    return ok;
+}
+
+void VmBuilderQemu::PassthroughPciDevs(const std::vector<std::string> &devs, std::set<std::string> *dropped) {
+    std::vector<int> ok = ForEachIommuGroup(devs, [](const std::string &dev) {
+        return PassthroughOnePciDev(dev.c_str(), kPciPassthrough);
+    });
+    for (size_t i = 0; i < devs.size(); i++) {
+        if (ok[i]) {
+            pci_pt_dev_set_.insert(devs[i]);
+        } else {
+            LOG(warning) << "Failed to passthrough: " << devs[i];
+            dropped->insert("vfio-pci,host=" + devs[i] + ",x-no-kvm-intx=on");
+        }
+    }
+    SetPciDevicesCallback();
+}
+
 void VmBuilderQemu::BuildPtPciDevicesCmd(void) {
     std::string pt_pci = cfg_.GetValue(kGroupPciPt, kPciPtDev);
     boost::trim(pt_pci);
@@ -425,32 +457,33 @@ void VmBuilderQemu::BuildPtPciDevicesCmd(void) {
     std::vector<std::string> vec;
     boost::split(vec, pt_pci, boost::is_any_of(","), boost::token_compress_on);
 
-    BringDownBtHciIntf();  // Bring down blutooth hci interface before passthrough
+    plan_.preps.push_back({ kPrepHciDown, "" });  // Bring down blutooth hci interface before passthrough
     for (auto it=vec.begin(); it != vec.end(); ++it) {
         boost::trim(*it);
-        if (PassthroughOnePciDev(it->c_str(), kPciPassthrough)) {
-            pci_pt_dev_set_.insert(*it);
-            emul_cmd_.append(" -device vfio-pci,host=" + *it + ",x-no-kvm-intx=on");
-        } else {
-            LOG(warning) << "Failed to passthrough: " << *it;
-        }
+        plan_.preps.push_back({ kPrepPciPassthrough, *it });
+        cmdline_.AddDevice("vfio-pci,host=" + *it + ",x-no-kvm-intx=on");
     }
 }
 
+/* Registered with the first device passed through, so a later failing preparation still restores it */
 void VmBuilderQemu::SetPciDevicesCallback(void) {
-    if (pci_pt_dev_set_.empty())
+    if (pci_pt_dev_set_.empty() || pci_restore_set_)
         return;
+    pci_restore_set_ = true;
     end_call_.emplace([this](){
         LOG(info) << "Restore passthroughed PCI devices ...";
-        for (auto it=pci_pt_dev_set_.begin(); it != pci_pt_dev_set_.end(); ++it) {
-            PassthroughOnePciDev(it->c_str(), kPciRestore);
-        }
+        std::vector<std::string> devs(pci_pt_dev_set_.begin(), pci_pt_dev_set_.end());
+        ForEachIommuGroup(devs, [](const std::string &dev) {
+            return PassthroughOnePciDev(dev.c_str(), kPciRestore);
+        });
+        pci_restore_set_ = false;
     });
 }
 
 bool VmBuilderQemu::PassthroughGpu(void) {
     if (PassthroughOnePciDev(kIntelGpuBdf, kPciPassthrough)) {
         pci_pt_dev_set_.insert(kIntelGpuBdf);
+        SetPciDevicesCallback();
         return true;
     }
     return false;
@@ -458,6 +491,10 @@ bool VmBuilderQemu::PassthroughGpu(void) {
 
 bool VmBuilderQemu::CreateGvtgVgpu(void) {
     std::string gvtg_ver = cfg_.GetValue(kGroupVgpu, kVgpuGvtgVer);
+    if (!HostInventory::Get().HasMdevType(gvtg_ver)) {
+        LOG(error) << "GVT-g type " << gvtg_ver << " is not supported by host";
+        return false;
+    }
     std::string gvtg_create(kGvtgMdevTypePath + gvtg_ver + "/create");
     std::string uuid = cfg_.GetValue(kGroupVgpu, kVgpuUuid);
 
@@ -469,15 +506,15 @@ bool VmBuilderQemu::CreateGvtgVgpu(void) {
 void VmBuilderQemu::RunMediationSrv(void) {
     std::string batt_med = cfg_.GetValue(kGroupMed, kMedBattery);
     if (!batt_med.empty())
-        co_procs_.emplace_back(std::make_unique<VmProcSimple>(batt_med));
+        AddSimpleCoProc(batt_med);
 
     std::string ther_med = cfg_.GetValue(kGroupMed, kMedThermal);
     if (!ther_med.empty())
-        co_procs_.emplace_back(std::make_unique<VmProcSimple>(ther_med));
+        AddSimpleCoProc(ther_med);
 
     std::string cam_med = cfg_.GetValue(kGroupMed, kMedCamera);
     if ((cam_med.size() == 1) && (std::tolower(cam_med[0]) == 'y'))
-        co_procs_.emplace_back(std::make_unique<VmProcSimple>("/usr/local/bin/stream"));
+        AddSimpleCoProc("/usr/local/bin/stream");
 }
 
 void VmBuilderQemu::BuildGuestTimeKeepCmd(void) {
@@ -487,8 +524,8 @@ void VmBuilderQemu::BuildGuestTimeKeepCmd(void) {
 
     constexpr const char *kTimeKeepPipe = "/tmp/qmp-time-keep-pipe";
     tk.append(" " + std::string(kTimeKeepPipe));
-    co_procs_.emplace_back(std::make_unique<VmProcSimple>(tk));
-    emul_cmd_.append(" -qmp pipe:" + std::string(kTimeKeepPipe));
+    AddSimpleCoProc(tk);
+    cmdline_.AddQmp("pipe:" + std::string(kTimeKeepPipe));
 }
 
 void VmBuilderQemu::BuildGuestPmCtrlCmd(void) {
@@ -503,8 +540,9 @@ void VmBuilderQemu::BuildGuestPmCtrlCmd(void) {
     } else {
         pm.append(" " + std::string(kPmCtrlSock));
     }
-    co_procs_.emplace_back(std::make_unique<VmProcSimple>(pm));
-    emul_cmd_.append(" -qmp unix:" + std::string(kPmCtrlSock) + ",server=on,wait=off -no-reboot");
+    AddSimpleCoProc(pm);
+    cmdline_.AddQmp("unix:" + std::string(kPmCtrlSock) + ",server=on,wait=off");
+    cmdline_.AddFlag("-no-reboot");
 }
 
 static int GetUid(void) {
@@ -524,18 +562,19 @@ void VmBuilderQemu::BuildAudioCmd(void) {
     if (cfg_.GetValue(kGroupAudio, kDisableEmul).compare("true") == 0)
         return;
 
-    emul_cmd_.append(" -device intel-hda"
-                     " -device hda-duplex,audiodev=android_spk"
-                     " -audiodev id=android_spk,timer-period=5000,driver=pa,"
-                     "in.fixed-settings=off,out.fixed-settings=off,server=/run/user/" + std::to_string(uid) +
-                     "/pulse/native");
+    cmdline_.AddDevice("intel-hda");
+    cmdline_.AddDevice("hda-duplex,audiodev=android_spk");
+    cmdline_.AddBackend("-audiodev", "id=android_spk,timer-period=5000,driver=pa,"
+                        "in.fixed-settings=off,out.fixed-settings=off,server=/run/user/" + std::to_string(uid) +
+                        "/pulse/native");
 }
 
 void VmBuilderQemu::BuildExtraCmd(void) {
     std::string ex_cmd = cfg_.GetValue(kGroupExtra, kExtraCmd);
     if (ex_cmd.empty())
         return;
-    emul_cmd_.append(" " + ex_cmd);
+    /* Free form QEMU arguments from the config, split with shell-like quoting */
+    cmdline_.AddExtra(boost::program_options::split_unix(ex_cmd));
 }
 
 void VmBuilderQemu::SetExtraServices(void) {
@@ -551,7 +590,7 @@ void VmBuilderQemu::SetExtraServices(void) {
         if (it->empty())
             continue;
 
-        co_procs_.emplace_back(std::make_unique<VmProcSimple>(*it));
+        AddSimpleCoProc(*it);
     }
 }
 
@@ -571,105 +610,328 @@ bool VmBuilderQemu::BuildEmulPath(void) {
     if (emul_path.empty()) {
         return false;
     }
-    emul_cmd_.assign(emul_path.c_str());
+    cmdline_.SetBinary(emul_path.string());
     return true;
 }
 
 void VmBuilderQemu::BuildFixedCmd(void) {
-    emul_cmd_.append(
-        " -M q35"
-        " -machine kernel_irqchip=on"
-        " -k en-us"
-        " -cpu host,-waitpkg,pmu=off"
-        " -enable-kvm"
-        " -device qemu-xhci,id=xhci,p2=8,p3=8"
-        " -device usb-mouse"
-        " -device usb-kbd");
-    emul_cmd_.append(
-        /* Make sure this device be the last argument */
-        " -device intel-iommu,device-iotlb=on,caching-mode=on"
-        " -nodefaults ");
+    cmdline_.SetMachine("q35");
+    cmdline_.AddMachineProp("kernel_irqchip", "on");
+    cmdline_.SetOption("-k", "en-us");
+    cmdline_.SetCpu("host,-waitpkg,pmu=off");
+    cmdline_.AddFlag("-enable-kvm");
+    cmdline_.AddDevice("qemu-xhci,id=xhci,p2=8,p3=8");
+    cmdline_.AddDevice("usb-mouse");
+    cmdline_.AddDevice("usb-kbd");
+    /* Must follow every other device */
+    cmdline_.AddDevice("intel-iommu,device-iotlb=on,caching-mode=on").last = true;
+    cmdline_.AddFlag("-nodefaults");
 }
 
 bool VmBuilderQemu::BuildNameQmp(void) {
     std::string vm_name = cfg_.GetValue(kGroupGlob, kGlobName);
     boost::trim(vm_name);
     if (vm_name.empty()) {
-        emul_cmd_.clear();
+        cmdline_.Clear();
         return false;
     }
-    emul_cmd_.append(" -name " + vm_name);
+    cmdline_.SetName(vm_name);
+    cmdline_.AddQmp("unix:" + QmpSockPath() + ",server,nowait");
+    /* A monitor takes one client at a time, the periodic balloon polls get their own */
+    if (IsTrue(cfg_.GetValue(kGroupMem, kMemBalloon)))
+        cmdline_.AddQmp("unix:" + BalloonQmpSockPath() + ",server,nowait");
+    return true;
+}
+
+/* From the config rather than a member, the cached launch plan skips BuildNameQmp */
+std::string VmBuilderQemu::QmpSockPath(void) {
+    std::string vm_name = cfg_.GetValue(kGroupGlob, kGlobName);
+    boost::trim(vm_name);
     std::vector<std::string> name_param;
     boost::split(name_param, vm_name, boost::is_any_of(","));
-    emul_cmd_.append(" -qmp unix:" + std::string(GetConfigPath()) + "/." + name_param[0] +
-                     ".qmp.unix.socket,server,nowait");
-    return true;
+    return std::string(GetConfigPath()) + "/." + name_param[0] + CIV_GUEST_QMP_SUFFIX;
 }
 
-void VmBuilderQemu::BuildNetCmd(void) {
+std::string VmBuilderQemu::BalloonQmpSockPath(void) {
+    std::string vm_name = cfg_.GetValue(kGroupGlob, kGlobName);
+    boost::trim(vm_name);
+    std::vector<std::string> name_param;
+    boost::split(name_param, vm_name, boost::is_any_of(","));
+    return std::string(GetConfigPath()) + "/." + name_param[0] + ".balloon.qmp";
+}
+
+/* Queue pairs of the tap backend, one per vCPU unless configured */
+int VmBuilderQemu::NetQueues(void) {
+    std::string queues = cfg_.GetValue(kGroupNet, kNetQueues);
+    if (queues.empty() || (queues.compare("auto") == 0))
+        return std::max(VcpuCount(cfg_.GetValue(kGroupVcpu, kVcpuNum)), 1);
+    try {
+        return std::max(std::stoi(queues), 1);
+    } catch (std::exception &e) {
+        LOG(warning) << "Invalid net queues: " << queues;
+        return 1;
+    }
+}
+
+bool VmBuilderQemu::BuildNetCmd(void) {
+    std::string backend = cfg_.GetValue(kGroupNet, kNetBackend);
+    bool tap = (backend.compare(kNetBackendTap) == 0);
+    bool passt = (backend.compare(kNetBackendPasst) == 0);
+    if (!backend.empty() && !tap && !passt && (backend.compare(kNetBackendUser) != 0)) {
+        LOG(error) << "Invalid net backend: " << backend;
+        return false;
+    }
+
     std::string model = cfg_.GetValue(kGroupNet, kNetModel);
     if (model.empty())
-        model = "e1000";
+        model = (tap || passt) ? "virtio-net-pci" : "e1000";
 
     if (model.compare("none") == 0)
-        return;
+        return true;
 
-    std::string net_arg = " -netdev user,id=net0";
     std::string adb_port = cfg_.GetValue(kGroupNet, kNetAdbPort);
-    if (!adb_port.empty())
-        net_arg.append(",hostfwd=tcp::" + adb_port + "-:5555");
     std::string fb_port = cfg_.GetValue(kGroupNet, kNetFastbootPort);
-    if (!fb_port.empty())
-        net_arg.append(",hostfwd=tcp::" + fb_port + "-:5554");
+    if (passt) {
+        BuildPasstNetCmd(model, adb_port, fb_port);
+        return true;
+    }
+    if (!tap) {
+        std::string net_arg = "user,id=net0";
+        if (!adb_port.empty())
+            net_arg.append(",hostfwd=tcp::" + adb_port + "-:5555");
+        if (!fb_port.empty())
+            net_arg.append(",hostfwd=tcp::" + fb_port + "-:5554");
+
+        cmdline_.AddBackend("-netdev", net_arg);
+        cmdline_.AddDevice(model + ",netdev=net0,bus=pcie.0,addr=0xA");
+        return true;
+    }
+
+    if (!adb_port.empty() || !fb_port.empty())
+        LOG(warning) << "adb_port and fastboot_port are ignored by the tap backend";
+
+    bool virtio = (model.compare("virtio-net-pci") == 0);
+    int queues = NetQueues();
+    if (!virtio && (queues > 1)) {
+        LOG(warning) << "Multiqueue needs virtio-net-pci, " << model << " gets a single queue";
+        queues = 1;
+    }
+    std::string vhost = cfg_.GetValue(kGroupNet, kNetVhost);
+    bool use_vhost = virtio && (vhost.empty() || IsTrue(vhost));
+
+    std::string net_arg = std::string("tap,id=net0,ifname=") + kPlanNetTap + ",script=no,downscript=no";
+    if (use_vhost)
+        net_arg.append(",vhost=on");
+    if (queues > 1)
+        net_arg.append(",queues=" + std::to_string(queues));
+    cmdline_.AddBackend("-netdev", net_arg);
+
+    QemuDevice &dev = cmdline_.AddDevice(model + ",netdev=net0,bus=pcie.0,addr=0xA");
+    if (queues > 1) {
+        /* A vector per rx and tx queue, plus config and control */
+        dev.Set("mq", "on");
+        dev.Set("vectors", std::to_string(2 * queues + 2));
+    }
+    plan_.preps.push_back({ kPrepNetTap, std::to_string(queues) });
+    return true;
+}
+
+/*
+ * User mode networking through a passt co-process, connected to the emulator
+ * over a unix stream socket. Forwarded ports map as the user backend hostfwd.
+ */
+void VmBuilderQemu::BuildPasstNetCmd(const std::string &model, const std::string &adb_port,
+                                     const std::string &fb_port) {
+    std::string passt = cfg_.GetValue(kGroupNet, kNetPasstPath);
+    if (passt.empty())
+        passt = "passt";
+    std::string sock = "/tmp/" + name_ + "_passt.sock";
+
+    std::vector<std::string> args = { sock, passt, "--foreground", "--quiet", "--socket", sock };
+    if (!adb_port.empty()) {
+        args.push_back("--tcp-ports");
+        args.push_back(adb_port + ":5555");
+    }
+    if (!fb_port.empty()) {
+        args.push_back("--tcp-ports");
+        args.push_back(fb_port + ":5554");
+    }
+    plan_.co_procs.push_back({ kCoProcPasst, args });
+
+    cmdline_.AddBackend("-netdev", "stream,id=net0,server=off,addr.type=unix,addr.path=" + sock);
+    cmdline_.AddDevice(model + ",netdev=net0,bus=pcie.0,addr=0xA");
+}
+
+/*
+ * Second NIC on a vm switch shared with the other guests of the same switch.
+ * The MAC is derived from the guest name, the emulator default would be the
+ * same for every guest on the segment.
+ */
+void VmBuilderQemu::BuildSwitchNetCmd(void) {
+    std::string sw = cfg_.GetValue(kGroupNet, kNetSwitch);
+    if (sw.empty())
+        return;
+
+    size_t h = std::hash<std::string>{}(name_);
+    std::string mac = (boost::format("52:54:01:%02x:%02x:%02x") % ((h >> 16) & 0xff) % ((h >> 8) & 0xff) %
+                       (h & 0xff)).str();
+    cmdline_.AddBackend("-netdev", "vde,id=net1,sock=" + VmSwitchSockDir(sw));
+    cmdline_.AddDevice("virtio-net-pci,netdev=net1,bus=pcie.0,addr=0xB,mac=" + mac);
+    plan_.preps.push_back({ kPrepVmSwitch, sw });
+}
+
+/*
+ * Use the configured tap if it already exists, it is left untouched then.
+ * Otherwise create one, named as configured or picked by the kernel, and
+ * delete it when the guest stops.
+ */
+bool VmBuilderQemu::SetupNetTap(int queues, std::string *ifname) {
+    if (!LoadKernelModule("tun"))
+        return false;
+    std::string vhost = cfg_.GetValue(kGroupNet, kNetVhost);
+    if ((vhost.empty() || IsTrue(vhost)) && !LoadKernelModule("vhost_net"))
+        LOG(warning) << "Failed to load vhost_net";
+
+    std::string name = cfg_.GetValue(kGroupNet, kNetTap);
+    if (!name.empty() && NetIfExists(name)) {
+        *ifname = name;
+        /* Leave the pre-created tap as it was, without the limits of this guest */
+        end_call_.emplace([this, name](){
+            std::scoped_lock lock(net_qos_mutex_);
+            ClearNetQos(name, &net_qos_state_);
+        });
+    } else {
+        if (!CreateTap(name.empty() ? kTapNamePattern : name, queues, ifname))
+            return false;
+        std::string tap = *ifname;
+        end_call_.emplace([tap, queues](){
+            DeleteTap(tap, queues);
+        });
+
+        std::string bridge = cfg_.GetValue(kGroupNet, kNetBridge);
+        if (!bridge.empty() && !AttachBridge(tap, bridge))
+            return false;
+        if (!SetNetIfUp(tap))
+            return false;
+    }
+
+    std::scoped_lock lock(net_qos_mutex_);
+    net_tap_ = *ifname;
+    net_qos_ = NetQos();
+    net_qos_state_ = NetQosState();
+    for (const char *key : { kNetEgressRate, kNetIngressRate, kNetBurst, kNetPps }) {
+        std::string val = cfg_.GetValue(kGroupNet, key);
+        std::string err;
+        if (!val.empty() && !SetNetQosValue(key, val, &net_qos_, &err)) {
+            LOG(error) << err;
+            return false;
+        }
+    }
+    if (net_qos_.Empty())
+        return true;
+    return ApplyNetQos(net_tap_, net_qos_, &net_qos_state_);
+}
+
+/* Change the limits of throttle group name of a running guest, spec keys are those of [throttle_<name>] */
+bool VmBuilderQemu::SetDiskThrottle(const std::string &name, const std::string &spec) {
+    bool used = false;
+    for (auto &group : cfg_.GetDiskGroups())
+        used = used || (cfg_.GetValue(group, kDiskThrottleGroup).compare(name) == 0);
+    if (!used) {
+        LOG(error) << "No disk of " << name_ << " is in throttle group: " << name;
+        return false;
+    }
+
+    /* Burst lengths are resent with each burst limit, so keep what is in effect */
+    std::scoped_lock lock(disk_throttle_mutex_);
+    std::string err;
+    auto it = disk_throttle_.find(name);
+    if (it == disk_throttle_.end()) {
+        DiskThrottle t;
+        if (!LoadDiskThrottle(&cfg_, name, &t, &err)) {
+            LOG(error) << err;
+            return false;
+        }
+        it = disk_throttle_.emplace(name, t).first;
+    }
+    DiskThrottle t = it->second;
+    if (!ParseDiskThrottleSpec(spec, &t, &err)) {
+        LOG(error) << err;
+        return false;
+    }
+
+    QmpClient qmp(QmpSockPath());
+    boost::property_tree::ptree ret;
+    if (!qmp.Connect(kQmpConnectTimeoutMs) || !qmp.Execute("qom-set", DiskThrottleQomSet(name, t), &ret)) {
+        LOG(error) << "Failed to set throttle group " << name << " of " << name_;
+        return false;
+    }
+    it->second = t;
+    return true;
+}
+
+/* Change the limits of a running guest, spec keys are those of [net] */
+bool VmBuilderQemu::SetNetQos(const std::string &spec) {
+    std::scoped_lock lock(net_qos_mutex_);
+    if (net_tap_.empty()) {
+        LOG(error) << "Net QoS needs the tap backend: " << name_;
+        return false;
+    }
 
-    emul_cmd_.append(net_arg);
-    emul_cmd_.append(" -device "+ model + ",netdev=net0,bus=pcie.0,addr=0xA");
+    NetQos qos = net_qos_;
+    std::string err;
+    if (!ParseNetQosSpec(spec, &qos, &err)) {
+        LOG(error) << err;
+        return false;
+    }
+    if (!ApplyNetQos(net_tap_, qos, &net_qos_state_))
+        return false;
+    net_qos_ = qos;
+    return true;
 }
 
 bool VmBuilderQemu::BuildVsockCmd(void) {
     std::string str_cid = cfg_.GetValue(kGroupGlob, kGlobCid);
+    if (!str_cid.empty()) {
+        try {
+            std::stoul(str_cid);
+        } catch (std::exception &e) {
+            LOG(error) << "Invalid Cid!" << e.what();
+            cmdline_.Clear();
+            return false;
+        }
+    }
+    cmdline_.AddDevice("vhost-vsock-pci,id=vhost-vsock-pci0,bus=pcie.0,addr=0x10,guest-cid=" +
+                       std::string(kPlanCid));
+    plan_.preps.push_back({ kPrepVsockCid, str_cid });
+    return true;
+}
+
+bool VmBuilderQemu::SetupVsockCid(const std::string &str_cid) {
     if (str_cid.empty()) {
         vsock_cid_ = VsockCidPool::Pool().GetCid();
-        if (vsock_cid_ == 0) {
-            emul_cmd_.clear();
+        if (vsock_cid_ == 0)
             return false;
-        }
     } else {
-        try {
-            vsock_cid_ = VsockCidPool::Pool().GetCid(std::stoul(str_cid));
-            if (vsock_cid_ == 0) {
-                LOG(error) << "Cannot acquire cid(" << str_cid << ") from cid pool!";
-                emul_cmd_.clear();
-                return false;
-            }
-        } catch (std::exception &e) {
-            LOG(error) << "Invalid Cid!" << e.what();
-            emul_cmd_.clear();
+        vsock_cid_ = VsockCidPool::Pool().GetCid(std::stoul(str_cid));
+        if (vsock_cid_ == 0) {
+            LOG(error) << "Cannot acquire cid(" << str_cid << ") from cid pool!";
             return false;
         }
     }
-    emul_cmd_.append(" -device vhost-vsock-pci,id=vhost-vsock-pci0,bus=pcie.0,addr=0x10,guest-cid=" +
-                    std::to_string(vsock_cid_));
     return true;
 }
 
 void VmBuilderQemu::BuildRpmbCmd(void) {
     std::string rpmb_bin = cfg_.GetValue(kGroupRpmb, kRpmbBinPath);
     std::string rpmb_data = cfg_.GetValue(kGroupRpmb, kRpmbDataDir);
-    time_t rawtime;
-    struct tm timeinfo;
-    char t_buf[80];
-    time(&rawtime);
-    localtime_r(&rawtime, &timeinfo);
-    strftime(t_buf, 80 , "%Y-%m-%d_%T", &timeinfo);
-    std::string rpmb_sock = std::string(kRpmbSockPrefix) + t_buf;
 
     if (!rpmb_bin.empty() && !rpmb_data.empty()) {
-        emul_cmd_.append(" -device virtio-serial,addr=1"
-                         " -device virtserialport,chardev=rpmb0,name=rpmb0,nr=1"
-                          " -chardev socket,id=rpmb0,path=" + rpmb_sock);
-        co_procs_.emplace_back(std::make_unique<VmCoProcRpmb>(std::move(rpmb_bin), std::move(rpmb_data),
-                               std::move(rpmb_sock)));
+        cmdline_.AddDevice("virtio-serial,addr=1");
+        cmdline_.AddDevice("virtserialport,chardev=rpmb0,name=rpmb0,nr=1");
+        cmdline_.AddChardev("socket,id=rpmb0,path=" + std::string(kPlanRpmbSock));
+        plan_.co_procs.push_back({ kCoProcRpmb, { rpmb_bin, rpmb_data, kPlanRpmbSock } });
+        plan_.preps.push_back({ kPrepRpmbSock, "" });
     }
 }
 
@@ -677,43 +939,56 @@ void VmBuilderQemu::BuildVtpmCmd(void) {
     std::string vtpm_bin = cfg_.GetValue(kGroupVtpm, kVtpmBinPath);
     std::string vtpm_data = cfg_.GetValue(kGroupVtpm, kVtpmDataDir);
     if (!vtpm_bin.empty() && !vtpm_data.empty()) {
-        emul_cmd_.append(" -chardev socket,id=chrtpm,path=" +
-                         vtpm_data + "/" + kVtpmSock +
-                         " -tpmdev emulator,id=tpm0,chardev=chrtpm -device tpm-crb,tpmdev=tpm0");
-        co_procs_.emplace_back(std::make_unique<VmCoProcVtpm>(std::move(vtpm_bin), std::move(vtpm_data)));
+        cmdline_.AddChardev("socket,id=chrtpm,path=" + vtpm_data + "/" + kVtpmSock);
+        cmdline_.AddBackend("-tpmdev", "emulator,id=tpm0,chardev=chrtpm");
+        cmdline_.AddDevice("tpm-crb,tpmdev=tpm0");
+        plan_.co_procs.push_back({ kCoProcVtpm, { vtpm_bin, vtpm_data } });
     }
 }
 
-void VmBuilderQemu::InitAafCfg(void) {
+bool VmBuilderQemu::BuildAafCfg(void) {
     std::string aaf_path = cfg_.GetValue(kGroupAaf, kAafPath);
-    if (!aaf_path.empty()) {
-        aaf_cfg_ = std::make_unique<Aaf>(aaf_path.c_str());
+    if (aaf_path.empty())
+        return true;
+
+    std::string aaf_suspend = cfg_.GetValue(kGroupAaf, kAafSuspend);
+    if (!aaf_suspend.empty() &&
+        aaf_suspend.compare("true") != 0 && aaf_suspend.compare("enable") != 0 &&
+        aaf_suspend.compare("false") != 0 && aaf_suspend.compare("disable") != 0) {
+        LOG(error) << "Invalid value of 'support_suspend'";
+        return false;
     }
+
+    cmdline_.AddBackend("-virtfs", "local,mount_tag=aaf,security_model=none,path=" + aaf_path);
+    plan_.preps.push_back({ kPrepAaf, "" });
+    return true;
 }
 
-bool VmBuilderQemu::BuildAafCfg(void) {
+void VmBuilderQemu::SetupAafCfg(void) {
     std::string aaf_path = cfg_.GetValue(kGroupAaf, kAafPath);
-    if (!aaf_path.empty()) {
-        std::string aaf_suspend = cfg_.GetValue(kGroupAaf, kAafSuspend);
-        if (!aaf_suspend.empty()) {
-            if (aaf_suspend.compare("true") == 0 || aaf_suspend.compare("enable") == 0) {
-                aaf_cfg_->Set(kAafKeySuspend, "true");
-            } else if (aaf_suspend.compare("false") == 0 || aaf_suspend.compare("disable") == 0) {
-                aaf_cfg_->Set(kAafKeySuspend, "false");
-            } else {
-                LOG(error) << "Invalid value of 'support_suspend'";
-                return false;
-            }
-        }
+    aaf_cfg_ = std::make_unique<Aaf>(aaf_path.c_str());
 
-        std::string aaf_audio_type = cfg_.GetValue(kGroupAaf, kAafAudioType);
-        if (!aaf_audio_type.empty()) {
-            aaf_cfg_->Set(kAafKeyAudioType, aaf_audio_type);
-        }
+    std::string aaf_suspend = cfg_.GetValue(kGroupAaf, kAafSuspend);
+    if (aaf_suspend.compare("true") == 0 || aaf_suspend.compare("enable") == 0)
+        aaf_cfg_->Set(kAafKeySuspend, "true");
+    else if (aaf_suspend.compare("false") == 0 || aaf_suspend.compare("disable") == 0)
+        aaf_cfg_->Set(kAafKeySuspend, "false");
 
-        emul_cmd_.append(" -virtfs local,mount_tag=aaf,security_model=none,path=" + aaf_path);
-    }
-    return true;
+    std::string aaf_audio_type = cfg_.GetValue(kGroupAaf, kAafAudioType);
+    if (!aaf_audio_type.empty())
+        aaf_cfg_->Set(kAafKeyAudioType, aaf_audio_type);
+
+    std::string vgpu_type = cfg_.GetValue(kGroupVgpu, kVgpuType);
+    if (vgpu_type.compare(kVgpuGvtG) == 0)
+        aaf_cfg_->Set(kAafKeyGpuType, "gvtg");
+    else if (vgpu_type.compare(kVgpuGvtD) == 0)
+        aaf_cfg_->Set(kAafKeyGpuType, "gvtd");
+    else if ((vgpu_type.compare(kVgpuVirtio) == 0) || (vgpu_type.compare(kVgpuVirtio2D) == 0))
+        aaf_cfg_->Set(kAafKeyGpuType, "virtio");
+    else if (vgpu_type.compare(kVgpuSriov) == 0)
+        aaf_cfg_->Set(kAafKeyGpuType, "sriov");
+
+    aaf_cfg_->Flush();
 }
 
 bool VmBuilderQemu::BuildVgpuCmd(void) {
@@ -729,48 +1004,33 @@ bool VmBuilderQemu::BuildVgpuCmd(void) {
                 return false;
             }
 
-            if (!CreateGvtgVgpu()) {
-                return false;
-            }
+            plan_.preps.push_back({ kPrepGvtgVgpu, "" });
 
-            emul_cmd_.append(" -device vfio-pci-nohotplug,ramfb=on,display=on,addr=2.0,x-igd-opregion=on,sysfsdev=" +
-                             std::string(kIntelGpuDevPath) + vgpu_uuid);
-            if (aaf_cfg_)
-                aaf_cfg_->Set(kAafKeyGpuType, "gvtg");
+            cmdline_.AddDevice("vfio-pci-nohotplug,ramfb=on,display=on,addr=2.0,x-igd-opregion=on,sysfsdev=" +
+                               std::string(kIntelGpuDevPath) + vgpu_uuid);
         } else if (vgpu_type.compare(kVgpuGvtD) == 0) {
-            SoundCardHook();
-            if (!PassthroughGpu()) {
-                return false;
-            }
-            emul_cmd_.append(" -vga none -nographic"
-                " -device vfio-pci,host=00:02.0,x-igd-gms=2,id=hostdev0,bus=pcie.0,addr=0x2,x-igd-opregion=on"
-                " -display none");
-            if (aaf_cfg_)
-                aaf_cfg_->Set(kAafKeyGpuType, "gvtd");
+            plan_.preps.push_back({ kPrepSoundCardHook, "" });
+            plan_.preps.push_back({ kPrepGpuPassthrough, "" });
+            cmdline_.SetOption("-vga", "none");
+            cmdline_.AddFlag("-nographic");
+            cmdline_.AddDevice("vfio-pci,host=00:02.0,x-igd-gms=2,id=hostdev0,bus=pcie.0,addr=0x2,x-igd-opregion=on");
+            cmdline_.SetOption("-display", "none");
         } else if (vgpu_type.compare(kVgpuVirtio) == 0) {
-            emul_cmd_.append(" -device virtio-vga-gl");
+            QemuDevice &vga = cmdline_.AddDevice("virtio-vga-gl");
             std::string outputs = cfg_.GetValue(kGroupVgpu, kVgpuOutputs);
             if (!outputs.empty()) {
                 std::size_t pos{};
                 int o = std::stoi(outputs, &pos, 10);
                 if (pos == outputs.size())
-                    emul_cmd_.append(",max_outputs=" + outputs);
+                    vga.Set("max_outputs", outputs);
             }
-            if (aaf_cfg_)
-                aaf_cfg_->Set(kAafKeyGpuType, "virtio");
         } else if (vgpu_type.compare(kVgpuRamfb) == 0) {
-            emul_cmd_.append(" -device ramfb");
+            cmdline_.AddDevice("ramfb");
         } else if (vgpu_type.compare(kVgpuVirtio2D) == 0) {
-            emul_cmd_.append(" -device virtio-vga");
-            if (aaf_cfg_)
-                aaf_cfg_->Set(kAafKeyGpuType, "virtio");
+            cmdline_.AddDevice("virtio-vga");
         } else if (vgpu_type.compare(kVgpuSriov) == 0) {
-            if (!SetupSriov()) {
-                LOG(error) << "Failed to setup SRIOV!";
+            if (!BuildSriovCmd())
                 return false;
-            }
-            if (aaf_cfg_)
-                aaf_cfg_->Set(kAafKeyGpuType, "sriov");
         } else {
             LOG(warning) << "Invalid Graphics config";
             return false;
@@ -790,36 +1050,98 @@ void VmBuilderQemu::BuildVinputCmd(void) {
 
     if (vgpu_type.compare(kVgpuGvtD) == 0) {
         vinput.append(" --gvtd");
-        emul_cmd_.append(
-            " -qmp unix:./qmp-vinput-sock,server,nowait"
-            " -device virtio-input-host-pci,evdev=/dev/input/by-id/Power-Button-vm0"
-            " -device virtio-input-host-pci,evdev=/dev/input/by-id/Volume-Button-vm0"
-            " -device virtio-input-host-pci,evdev=/dev/input/by-id/Other-Button-vm0");
-    } else {
-        emul_cmd_.append(
-            " -device virtio-input-host-pci,evdev=/dev/input/by-id/Power-Button-vm0"
-            " -device virtio-input-host-pci,evdev=/dev/input/by-id/Volume-Button-vm0"
-            " -device virtio-input-host-pci,evdev=/dev/input/by-id/Other-Button-vm0");
+        cmdline_.AddQmp("unix:./qmp-vinput-sock,server,nowait");
     }
-    co_procs_.emplace_back(std::make_unique<VmProcSimple>(vinput));
+    cmdline_.AddDevice("virtio-input-host-pci,evdev=/dev/input/by-id/Power-Button-vm0");
+    cmdline_.AddDevice("virtio-input-host-pci,evdev=/dev/input/by-id/Volume-Button-vm0");
+    cmdline_.AddDevice("virtio-input-host-pci,evdev=/dev/input/by-id/Other-Button-vm0");
+    AddSimpleCoProc(vinput);
 }
 
 void VmBuilderQemu::BuildDispCmd(void) {
     std::string disp_op = cfg_.GetValue(kGroupDisplay, kDispOptions);
     if (disp_op.empty()) {
-        emul_cmd_.append(" -display gtk,gl=on");
+        cmdline_.SetOption("-display", "gtk,gl=on");
         return;
     }
 
-    emul_cmd_.append(" -display " + disp_op);
+    cmdline_.SetOption("-display", disp_op);
 }
 
 void VmBuilderQemu::BuildMemCmd(void) {
-    emul_cmd_.append(" -m " + cfg_.GetValue(kGroupMem, kMemSize));
+    std::string mem_size = cfg_.GetValue(kGroupMem, kMemSize);
+    cmdline_.SetMemory(mem_size);
+
+    std::string backend = cfg_.GetValue(kGroupMem, kMemBackend);
+    std::string page_size = cfg_.GetValue(kGroupMem, kMemPageSize);
+    bool sriov = (cfg_.GetValue(kGroupVgpu, kVgpuType).compare(kVgpuSriov) == 0);
+    /* KSM is opt-in per guest, the emulator would mark RAM mergeable by default */
+    std::string merge = IsTrue(cfg_.GetValue(kGroupMem, kMemMerge)) ? "on" : "off";
+    if (backend.empty() && sriov)
+        backend = kMemBackendMemfd;
+    if (backend.empty()) {
+        cmdline_.AddMachineProp("mem-merge", merge);
+        return;
+    }
+
+    bool hugepages = false;
+    std::string obj;
+    if (backend.compare(kMemBackendMemfd) == 0) {
+        obj = "memory-backend-memfd";
+        hugepages = sriov || !page_size.empty();
+        if (hugepages) {
+            obj.append(",hugetlb=on");
+            if (ParseHugePageSize(page_size) == kHugePage1G)
+                obj.append(",hugetlbsize=1G");
+        }
+    } else if (backend.compare(kMemBackendHugetlbfs) == 0) {
+        hugepages = true;
+        std::string path = cfg_.GetValue(kGroupMem, kMemPath);
+        obj = "memory-backend-file,mem-path=" + (path.empty() ? std::string("/dev/hugepages") : path);
+    } else {
+        obj = "memory-backend-file,mem-path=" + cfg_.GetValue(kGroupMem, kMemPath);
+    }
+    obj.append(",id=mem0,size=" + mem_size);
+
+    if (IsTrue(cfg_.GetValue(kGroupMem, kMemShare)))
+        obj.append(",share=on");
+    obj.append(",merge=" + merge);
+    if (IsTrue(cfg_.GetValue(kGroupMem, kMemPrealloc))) {
+        obj.append(",prealloc=on");
+        std::string threads = cfg_.GetValue(kGroupMem, kMemPreallocThreads);
+        if (!threads.empty())
+            obj.append(",prealloc-threads=" + threads);
+    }
+
+    std::string host_nodes = cfg_.GetValue(kGroupMem, kMemHostNodes);
+    if (!host_nodes.empty()) {
+        /* "0-1,3" has to be given as host-nodes=0-1,host-nodes=3 */
+        std::vector<std::string> ranges;
+        boost::split(ranges, host_nodes, boost::is_any_of(","), boost::token_compress_on);
+        for (auto &r : ranges)
+            obj.append(",host-nodes=" + boost::trim_copy(r));
+        std::string policy = cfg_.GetValue(kGroupMem, kMemPolicy);
+        obj.append(",policy=" + (policy.empty() ? std::string("bind") : policy));
+    }
+
+    if (hugepages)
+        plan_.preps.push_back({ kPrepHugePages, mem_size });
+    cmdline_.AddBackend("-object", obj);
+    cmdline_.AddMachineProp("memory-backend", "mem0");
+}
+
+void VmBuilderQemu::BuildBalloonCmd(void) {
+    if (!IsTrue(cfg_.GetValue(kGroupMem, kMemBalloon)))
+        return;
+    /* Free pages are reported to the host as the guest frees them, besides what the balloon takes */
+    cmdline_.AddDevice("virtio-balloon-pci,id=balloon0,free-page-reporting=on,deflate-on-oom=on");
 }
 
 void VmBuilderQemu::BuildVcpuCmd(void) {
-    emul_cmd_.append(" -smp " + cfg_.GetValue(kGroupVcpu, kVcpuNum));
+    std::string num = cfg_.GetValue(kGroupVcpu, kVcpuNum);
+    cmdline_.SetSmp(num);
+    if (cfg_.GetValue(kGroupVcpu, kVcpuPin).compare(kCpuPinAuto) == 0)
+        plan_.preps.push_back({ kPrepCpuAlloc, std::to_string(VcpuCount(num)) });
 }
 
 bool VmBuilderQemu::BuildFirmwareCmd(void) {
@@ -827,10 +1149,10 @@ bool VmBuilderQemu::BuildFirmwareCmd(void) {
     if (firm_type.empty())
         return false;
     if (firm_type.compare(kFirmUnified) == 0) {
-        emul_cmd_.append(" -drive if=pflash,format=raw,file=" + cfg_.GetValue(kGroupFirm, kFirmPath));
+        cmdline_.AddBackend("-drive", "if=pflash,format=raw,file=" + cfg_.GetValue(kGroupFirm, kFirmPath));
     } else if (firm_type.compare(kFirmSplited) == 0) {
-        emul_cmd_.append(" -drive if=pflash,format=raw,readonly,file=" + cfg_.GetValue(kGroupFirm, kFirmCode));
-        emul_cmd_.append(" -drive if=pflash,format=raw,file=" + cfg_.GetValue(kGroupFirm, kFirmVars));
+        cmdline_.AddBackend("-drive", "if=pflash,format=raw,readonly,file=" + cfg_.GetValue(kGroupFirm, kFirmCode));
+        cmdline_.AddBackend("-drive", "if=pflash,format=raw,file=" + cfg_.GetValue(kGroupFirm, kFirmVars));
     } else {
         LOG(error) << "Invalid virtual firmware";
         return false;
@@ -838,53 +1160,187 @@ bool VmBuilderQemu::BuildFirmwareCmd(void) {
     return true;
 }
 
-void VmBuilderQemu::BuildVdiskCmd(void) {
-    emul_cmd_.append(
-        " -drive file="+ cfg_.GetValue(kGroupDisk, kDiskPath) + ",if=none,id=disk1,discard=unmap,detect-zeroes=unmap"
-        " -device virtio-blk-pci,drive=disk1,bootindex=1");
-}
+/* One disk of config group, named after the group, e.g. -blockdev node "disk2" */
+bool VmBuilderQemu::BuildDiskCmd(const std::string &group) {
+    const std::string &id = group;
+    std::string path = cfg_.GetValue(group, kDiskPath);
+    std::string cache = cfg_.GetValue(group, kDiskCache);
+    std::string aio = cfg_.GetValue(group, kDiskAio);
+    std::string bus = cfg_.GetValue(group, kDiskBus);
+    std::string format = DiskImageFormat(path);
+
+    /* An overlay of a golden image, created on first start if not flashed yet */
+    if (!cfg_.GetValue(group, kDiskGolden).empty()) {
+        format = "qcow2";
+        plan_.preps.push_back({ kPrepDiskOverlay, group });
+    }
 
-bool VmBuilderQemu::BuildVmArgs(void) {
-    LOG(info) << "build qemu vm args";
+    /* cache modes of -drive, split into the node cache options and the device write cache */
+    std::string direct = "off", no_flush = "off", write_cache = "on";
+    if (cache.compare("none") == 0) {
+        direct = "on";
+    } else if (cache.compare("writethrough") == 0) {
+        write_cache = "off";
+    } else if (cache.compare("directsync") == 0) {
+        direct = "on";
+        write_cache = "off";
+    } else if (cache.compare("unsafe") == 0) {
+        no_flush = "on";
+    } else if (!cache.empty() && (cache.compare("writeback") != 0)) {
+        LOG(error) << "Invalid disk cache mode: " << cache;
+        return false;
+    }
+    std::string cache_opts = ",cache.direct=" + direct + ",cache.no-flush=" + no_flush;
+
+    std::string file = "driver=file,node-name=" + id + "-file,filename=" + path + cache_opts;
+    if (!aio.empty())
+        file.append(",aio=" + aio);
+    cmdline_.AddBackend("-blockdev", file);
+    /* detect-zeroes=unmap turns zero writes into discards, which needs discard=unmap */
+    std::string discard = cfg_.GetValue(group, kDiskDiscard);
+    std::string detect_zeroes = cfg_.GetValue(group, kDiskDetectZeroes);
+    if (discard.empty())
+        discard = "unmap";
+    if (detect_zeroes.empty())
+        detect_zeroes = (discard.compare("unmap") == 0) ? "unmap" : "on";
+    /* A throttled disk gets a throttle filter node on top, which then carries the disk name */
+    std::string throttle = cfg_.GetValue(group, kDiskThrottleGroup);
+    std::string fmt_id = throttle.empty() ? id : id + "-fmt";
+    std::string node = "driver=" + format + ",node-name=" + fmt_id + ",file=" + id + "-file" + cache_opts +
+                       ",discard=" + discard + ",detect-zeroes=" + detect_zeroes;
+    size_t l2_cache = ParseSize(cfg_.GetValue(group, kDiskL2CacheSize));
+    if ((l2_cache > 0) && (format.compare(kDiskFormatQcow2) == 0))
+        node.append(",l2-cache-size=" + std::to_string(l2_cache));
+    cmdline_.AddBackend("-blockdev", node);
+    if (!throttle.empty())
+        cmdline_.AddBackend("-blockdev", "driver=throttle,node-name=" + id + ",throttle-group=" +
+                            ThrottleGroupId(throttle) + ",file=" + fmt_id);
+
+    std::string iothread;
+    if (IsTrue(cfg_.GetValue(group, kDiskIothread))) {
+        iothread = "iothread-" + id;
+        cmdline_.AddBackend("-object", "iothread,id=" + iothread);
+    }
 
-    if (!BuildEmulPath())
+    std::string queues = cfg_.GetValue(group, kDiskQueues);
+    if (queues.compare("auto") == 0)
+        queues = std::to_string(VcpuCount(cfg_.GetValue(kGroupVcpu, kVcpuNum)));
+
+    std::string bootindex = cfg_.GetValue(group, kDiskBootIndex);
+    if (bootindex.empty() && (group.compare(kGroupDisk) == 0))
+        bootindex = "1";
+
+    QemuDevice *dev = nullptr;
+    if (bus.empty() || (bus.compare(kDiskBusVirtioBlk) == 0)) {
+        dev = &cmdline_.AddDevice("virtio-blk-pci,drive=" + id);
+        if (!iothread.empty())
+            dev->Set("iothread", iothread);
+        if (!queues.empty())
+            dev->Set("num-queues", queues);
+    } else if (bus.compare(kDiskBusVirtioScsi) == 0) {
+        /* A controller per disk, so each disk gets its own queues and iothread */
+        QemuDevice &ctrl = cmdline_.AddDevice("virtio-scsi-pci,id=scsi-" + id);
+        if (!iothread.empty())
+            ctrl.Set("iothread", iothread);
+        if (!queues.empty())
+            ctrl.Set("num_queues", queues);
+        dev = &cmdline_.AddDevice("scsi-hd,drive=" + id + ",bus=scsi-" + id + ".0");
+    } else if (bus.compare(kDiskBusNvme) == 0) {
+        dev = &cmdline_.AddDevice("nvme,drive=" + id + ",serial=civ-" + id);
+        if (!queues.empty())
+            dev->Set("max_ioqpairs", queues);
+    } else {
+        LOG(error) << "Invalid disk bus: " << bus;
         return false;
+    }
+
+    if (write_cache.compare("off") == 0)
+        dev->Set("write-cache", "off");
+    if (!bootindex.empty())
+        dev->Set("bootindex", bootindex);
+    return true;
+}
+
+bool VmBuilderQemu::BuildVdiskCmd(void) {
+    /* Disks naming the same throttle group share its limits */
+    std::set<std::string> throttles;
+    for (auto &group : cfg_.GetDiskGroups()) {
+        std::string name = cfg_.GetValue(group, kDiskThrottleGroup);
+        if (name.empty() || !throttles.insert(name).second)
+            continue;
+        DiskThrottle t;
+        std::string err;
+        if (!LoadDiskThrottle(&cfg_, name, &t, &err)) {
+            LOG(error) << err;
+            return false;
+        }
+        cmdline_.AddBackend("-object", DiskThrottleObject(name, t));
+    }
+
+    for (auto &group : cfg_.GetDiskGroups()) {
+        if (!BuildDiskCmd(group))
+            return false;
+    }
+    return true;
+}
+
+bool VmBuilderQemu::BuildLaunchPlan(void) {
+    LOG(info) << "build qemu vm args";
 
     if (!BuildNameQmp())
         return false;
+    boot_trace_.Mark("BuildNameQmp");
 
     BuildRpmbCmd();
+    boot_trace_.Mark("BuildRpmbCmd");
 
     BuildDispCmd();
-
-    InitAafCfg();
+    boot_trace_.Mark("BuildDispCmd");
 
     if (!BuildVgpuCmd())
         return false;
+    boot_trace_.Mark("BuildVgpuCmd");
 
     BuildVinputCmd();
+    boot_trace_.Mark("BuildVinputCmd");
 
     if (!BuildAafCfg())
         return false;
+    boot_trace_.Mark("BuildAafCfg");
+
+    if (!BuildNetCmd())
+        return false;
+    boot_trace_.Mark("BuildNetCmd");
 
-    BuildNetCmd();
+    BuildSwitchNetCmd();
+    boot_trace_.Mark("BuildSwitchNetCmd");
 
     if (!BuildVsockCmd())
         return false;
+    boot_trace_.Mark("BuildVsockCmd");
 
     BuildVtpmCmd();
+    boot_trace_.Mark("BuildVtpmCmd");
 
     BuildMemCmd();
+    boot_trace_.Mark("BuildMemCmd");
+
+    BuildBalloonCmd();
+    boot_trace_.Mark("BuildBalloonCmd");
 
     BuildVcpuCmd();
+    boot_trace_.Mark("BuildVcpuCmd");
 
     if (!BuildFirmwareCmd())
         return false;
+    boot_trace_.Mark("BuildFirmwareCmd");
 
-    BuildVdiskCmd();
+    if (!BuildVdiskCmd())
+        return false;
+    boot_trace_.Mark("BuildVdiskCmd");
 
     BuildPtPciDevicesCmd();
-    SetPciDevicesCallback();
+    boot_trace_.Mark("BuildPtPciDevicesCmd");
 
     RunMediationSrv();
 
@@ -892,6 +1348,7 @@ bool VmBuilderQemu::BuildVmArgs(void) {
 
     BuildGuestPmCtrlCmd();
     BuildExtraGuestPmCtrlCmd();
+    boot_trace_.Mark("BuildGuestCtrlCmd");
 
     BuildAudioCmd();
 
@@ -900,38 +1357,304 @@ bool VmBuilderQemu::BuildVmArgs(void) {
     BuildFixedCmd();
 
     SetExtraServices();
+    boot_trace_.Mark("BuildExtraCmd");
+
+    std::string err;
+    if (!cmdline_.CheckPciSlots(&err)) {
+        LOG(error) << "Conflicting emulator devices: " << err;
+        return false;
+    }
+
+    return true;
+}
 
-    if (aaf_cfg_)
-        aaf_cfg_->Flush();
+/* Everything the launch plan is derived from, besides the emulator binary */
+std::string VmBuilderQemu::PlanFingerprint(void) {
+    struct utsname un;
+    std::string kernel = (uname(&un) == 0) ? un.release : "";
+    std::string disk_formats;
+    for (auto &group : cfg_.GetDiskGroups()) {
+        if (cfg_.GetValue(group, kDiskGolden).empty())
+            disk_formats.append(DiskImageFormat(cfg_.GetValue(group, kDiskPath)) + " ");
+        else
+            disk_formats.append("qcow2 ");
+    }
+    return LaunchPlan::Fingerprint(cfg_.ToString() +
+                                   "\nbuild=" + BUILD_REVISION + " " + BUILD_TIMESTAMP +
+                                   "\nuid=" + std::to_string(GetUid()) +
+                                   "\nkernel=" + kernel +
+                                   "\ndisks=" + disk_formats);
+}
 
-    main_proc_ = std::make_unique<VmProcSimple>(emul_cmd_);
+/* Count parameter of a host preparation, -1 if invalid, as a cached plan may be corrupt */
+static int PrepCount(const std::string &param) {
+    try {
+        size_t pos = 0;
+        int v = std::stoi(param, &pos, 10);
+        return (pos == param.size()) ? v : -1;
+    } catch (std::exception &e) {
+        return -1;
+    }
+}
+
+static bool PrepsValid(const std::vector<HostPrep> &preps) {
+    for (auto &prep : preps) {
+        if (((prep.step.compare(kPrepCpuAlloc) == 0) || (prep.step.compare(kPrepNetTap) == 0)) &&
+            (PrepCount(prep.param) <= 0))
+            return false;
+    }
+    return true;
+}
+
+bool VmBuilderQemu::BuildVmArgs(void) {
+    std::string plan_file = LaunchPlan::FilePath(name_);
+    std::string fingerprint = PlanFingerprint();
+
+    /* Resolved on every start, another binary may come first in PATH since the plan was cached */
+    if (!BuildEmulPath())
+        return false;
+    boot_trace_.Mark("BuildEmulPath");
+
+    if (plan_.Load(plan_file)) {
+        if ((plan_.fingerprint.compare(fingerprint) == 0) &&
+            (plan_.emulator.compare(cmdline_.GetBinary()) == 0) &&
+            !plan_.emulator_stamp.empty() &&
+            (plan_.emulator_stamp.compare(LaunchPlan::FileStamp(plan_.emulator)) == 0) &&
+            PrepsValid(plan_.preps)) {
+            LOG(info) << "Use cached launch plan: " << plan_file;
+            boot_trace_.Mark("LoadLaunchPlan");
+            state_ = VmBuilder::VmState::kVmCreated;
+            return true;
+        }
+        plan_.Clear();
+    }
+
+    if (!BuildLaunchPlan())
+        return false;
+
+    plan_.fingerprint = fingerprint;
+    plan_.emulator = cmdline_.GetBinary();
+    plan_.emulator_stamp = LaunchPlan::FileStamp(plan_.emulator);
+    plan_.argv = cmdline_.ToArgv();
+    if (!plan_.Save(plan_file))
+        LOG(warning) << "Failed to cache launch plan: " << plan_file;
 
     state_ = VmBuilder::VmState::kVmCreated;
+    return true;
+}
 
+bool VmBuilderQemu::ReserveHugePages(const std::string &mem_size) {
+    int64_t mem_mb = ParseMemSizeMb(mem_size);
+    if (mem_mb <= 0) {
+        LOG(error) << "Invalid memory size for hugepages: " << mem_size;
+        return false;
+    }
+
+    std::string page_size = cfg_.GetValue(kGroupMem, kMemPageSize);
+    uint32_t page_kb = ParseHugePageSize(page_size);
+    if (page_kb == 0) {
+        LOG(error) << "Unsupported hugepage size: " << page_size;
+        return false;
+    }
+
+    /* Pages come from the node pool only if RAM is bound to a single node */
+    int node = -1;
+    std::string host_nodes = cfg_.GetValue(kGroupMem, kMemHostNodes);
+    std::string policy = cfg_.GetValue(kGroupMem, kMemPolicy);
+    std::vector<int> nodes;
+    if (!host_nodes.empty()) {
+        if (!ParseCpuList(host_nodes, &nodes)) {
+            LOG(error) << "Invalid host_nodes: " << host_nodes;
+            return false;
+        }
+        if ((nodes.size() == 1) && (policy.empty() || (policy.compare("bind") == 0)))
+            node = nodes[0];
+    }
+    return HugepageManager::Get().Reserve(name_, mem_mb, page_kb, node);
+}
+
+bool VmBuilderQemu::RunHostPrep(const HostPrep &prep, std::map<std::string, std::string> *values,
+                                std::set<std::string> *dropped) {
+    if (prep.step.compare(kPrepHugePages) == 0) {
+        if (!ReserveHugePages(prep.param)) {
+            LOG(error) << "Failed to reserve hugepages for the guest RAM!";
+            return false;
+        }
+    } else if (prep.step.compare(kPrepSriovVf) == 0) {
+        int vf = SetAvailableVf();
+        if (vf < 0) {
+            LOG(error) << "Failed to setup SRIOV!";
+            return false;
+        }
+        (*values)[kPlanSriovVf] = std::to_string(vf);
+    } else if (prep.step.compare(kPrepGvtgVgpu) == 0) {
+        return CreateGvtgVgpu();
+    } else if (prep.step.compare(kPrepSoundCardHook) == 0) {
+        SoundCardHook();
+    } else if (prep.step.compare(kPrepGpuPassthrough) == 0) {
+        return PassthroughGpu();
+    } else if (prep.step.compare(kPrepHciDown) == 0) {
+        BringDownBtHciIntf();
+    } else if (prep.step.compare(kPrepPciPassthrough) == 0) {
+        PassthroughPciDevs({ prep.param }, dropped);
+    } else if (prep.step.compare(kPrepCpuAlloc) == 0) {
+        int num = PrepCount(prep.param);
+        if ((num <= 0) || !CpuAllocator::Get().Allocate(name_, num, &vcpu_cpus_, &emul_cpus_))
+            return false;
+    } else if (prep.step.compare(kPrepNetTap) == 0) {
+        std::string tap;
+        int queues = PrepCount(prep.param);
+        if ((queues <= 0) || !SetupNetTap(queues, &tap))
+            return false;
+        (*values)[kPlanNetTap] = tap;
+    } else if (prep.step.compare(kPrepVmSwitch) == 0) {
+        std::string bin = cfg_.GetValue(kGroupNet, kNetSwitchPath);
+        if (!VmSwitch::Get().Join(prep.param, name_, bin.empty() ? kVmSwitchBin : bin))
+            return false;
+    } else if (prep.step.compare(kPrepDiskOverlay) == 0) {
+        boost::system::error_code ec;
+        std::string path = cfg_.GetValue(prep.param, kDiskPath);
+        if (!boost::filesystem::exists(path, ec) &&
+            !CreateOverlay(cfg_.GetValue(prep.param, kDiskGolden), path, cfg_.GetValue(prep.param, kDiskSize),
+                           cfg_.GetValue(prep.param, kDiskClusterSize)))
+            return false;
+    } else if (prep.step.compare(kPrepVsockCid) == 0) {
+        if (!SetupVsockCid(prep.param))
+            return false;
+        (*values)[kPlanCid] = std::to_string(vsock_cid_);
+    } else if (prep.step.compare(kPrepRpmbSock) == 0) {
+        time_t rawtime;
+        struct tm timeinfo;
+        char t_buf[80];
+        time(&rawtime);
+        localtime_r(&rawtime, &timeinfo);
+        strftime(t_buf, 80 , "%Y-%m-%d_%T", &timeinfo);
+        (*values)[kPlanRpmbSock] = std::string(kRpmbSockPrefix) + t_buf;
+    } else if (prep.step.compare(kPrepPwrQmpSock) == 0) {
+        std::string sock;
+        if (!SetupPwrQmpSock(&sock))
+            return false;
+        (*values)[kPlanPwrQmpSock] = sock;
+    } else if (prep.step.compare(kPrepAaf) == 0) {
+        SetupAafCfg();
+    } else {
+        LOG(error) << "Unknown host preparation: " << prep.step;
+        return false;
+    }
     return true;
 }
 
+static std::string ResolvePlaceholders(std::string arg, const std::map<std::string, std::string> &values) {
+    for (auto &v : values) {
+        size_t pos;
+        while ((pos = arg.find(v.first)) != std::string::npos)
+            arg.replace(pos, v.first.size(), v.second);
+    }
+    return arg;
+}
+
+/* Mutate host state as the launch plan requires, then create the processes to run */
+bool VmBuilderQemu::PrepareHost(void) {
+    std::map<std::string, std::string> values;
+    std::set<std::string> dropped;
+    for (size_t i = 0; i < plan_.preps.size(); i++) {
+        const HostPrep &prep = plan_.preps[i];
+        /* Passthrough devices come in a row, and are prepared together */
+        if (prep.step.compare(kPrepPciPassthrough) == 0) {
+            std::vector<std::string> devs;
+            for (; (i < plan_.preps.size()) && (plan_.preps[i].step.compare(kPrepPciPassthrough) == 0); i++)
+                devs.push_back(plan_.preps[i].param);
+            i--;
+            PassthroughPciDevs(devs, &dropped);
+            boot_trace_.Mark(kPrepPciPassthrough);
+            continue;
+        }
+        if (!RunHostPrep(prep, &values, &dropped)) {
+            LOG(error) << "Host preparation failed: " << prep.step << " " << prep.param;
+            return false;
+        }
+        boot_trace_.Mark(prep.step);
+    }
+
+    std::vector<std::string> argv;
+    for (size_t i = 0; i < plan_.argv.size(); i++) {
+        if ((plan_.argv[i].compare("-device") == 0) && (i + 1 < plan_.argv.size()) &&
+            (dropped.find(plan_.argv[i + 1]) != dropped.end())) {
+            i++;
+            continue;
+        }
+        argv.push_back(ResolvePlaceholders(plan_.argv[i], values));
+    }
+    LOG(info) << "Emulator command:" << boost::algorithm::join(argv, " ");
+    main_proc_ = std::make_unique<VmProcSimple>(std::move(argv));
+
+    co_procs_.clear();
+    for (auto &c : plan_.co_procs) {
+        std::vector<std::string> args;
+        for (auto &a : c.args)
+            args.push_back(ResolvePlaceholders(a, values));
+
+        if ((c.type.compare(kCoProcRpmb) == 0) && (args.size() == 3))
+            co_procs_.emplace_back(std::make_unique<VmCoProcRpmb>(args[0], args[1], args[2]));
+        else if ((c.type.compare(kCoProcVtpm) == 0) && (args.size() == 2))
+            co_procs_.emplace_back(std::make_unique<VmCoProcVtpm>(args[0], args[1]));
+        else if ((c.type.compare(kCoProcPasst) == 0) && (args.size() > 1))
+            co_procs_.emplace_back(std::make_unique<VmCoProcPasst>(args[0],
+                                   std::vector<std::string>(args.begin() + 1, args.end())));
+        else
+            co_procs_.emplace_back(std::make_unique<VmProcSimple>(std::move(args)));
+    }
+    boot_trace_.Mark("PrepareHost");
+    return true;
+}
+
+void VmBuilderQemu::AddSimpleCoProc(const std::string &cmd) {
+    plan_.co_procs.push_back({ kCoProcSimple, boost::program_options::split_unix(cmd) });
+}
+
 void VmBuilderQemu::SetProcessEnv(std::vector<std::string> env) {
     main_proc_->SetEnv(env);
 }
 
 void VmBuilderQemu::SetProcLogDir(void) {
-    time_t rawtime;
-    struct tm timeinfo;
-    char t_buf[80];
-    time(&rawtime);
-    localtime_r(&rawtime, &timeinfo);
-    strftime(t_buf, 80 , "%Y-%m-%d_%H%M%S", &timeinfo);
-    std::string dir("/tmp/" + name_ + "_" + t_buf);
+    std::string dir = cfg_.GetValue(kGroupLog, kLogDir);
+    if (dir.empty())
+        dir = "/tmp/" + name_ + "_logs";
+
+    ProcLogPolicy policy;
+    std::string ring_size = cfg_.GetValue(kGroupLog, kLogRingSize);
+    if (!ring_size.empty())
+        policy.ring_size = ParseSize(ring_size);
+    std::string max_size = cfg_.GetValue(kGroupLog, kLogMaxSize);
+    if (!max_size.empty())
+        policy.max_file_size = ParseSize(max_size);
+    std::string rotate = cfg_.GetValue(kGroupLog, kLogRotate);
+    if (!rotate.empty()) {
+        try {
+            policy.rotate = std::stoi(rotate);
+        } catch (std::exception &e) {
+            LOG(warning) << "Invalid log rotate count: " << rotate;
+        }
+    }
+    policy.compress = (cfg_.GetValue(kGroupLog, kLogCompress).compare("zstd") == 0);
+
     main_proc_->SetLogDir(dir.c_str());
+    main_proc_->SetLogPolicy(policy);
+    main_proc_->SetLogTag(name_, vsock_cid_);
     for (size_t i = 0; i < co_procs_.size(); ++i) {
         co_procs_[i]->SetLogDir(dir.c_str());
+        co_procs_[i]->SetLogPolicy(policy);
+        co_procs_[i]->SetLogTag(name_, vsock_cid_);
     }
 }
 
-void VmBuilderQemu::StartVm() {
-    LOG(info) << "Emulator command:" << emul_cmd_;
+uint64_t VmBuilderQemu::ReadLog(uint64_t from, size_t max, std::string *out) {
+    if (!main_proc_)
+        return 0;
+    return main_proc_->ReadLog(from, max, out);
+}
 
+void VmBuilderQemu::StartVm() {
     if (!main_proc_) {
         LOG(error) << "VM's main proc is not build up!";
         return;
@@ -940,13 +1663,143 @@ void VmBuilderQemu::StartVm() {
     SetProcLogDir();
 
     for (size_t i = 0; i < co_procs_.size(); ++i) {
-        if (!co_procs_[i]->Running())
+        if (!co_procs_[i]->Running()) {
             co_procs_[i]->Run();
+            boot_trace_.Mark("co_proc_spawn_" + std::to_string(i));
+        }
     }
 
     main_proc_->Run();
+    boot_trace_.Mark("qemu_exec");
+    if (IsTrue(cfg_.GetValue(kGroupMem, kMemMerge)))
+        KsmController::Get().Add(name_, main_proc_->GetPid());
     LOG(info) << "Main Proc is started";
     state_ = VmBuilder::VmState::kVmBooting;
+
+    QmpClient qmp(QmpSockPath());
+    if (main_proc_->Running() && qmp.Connect(kQmpFirstResponseTimeoutMs)) {
+        boot_trace_.Mark("qmp_first_response");
+        PinVcpus(&qmp);
+        PinIothreads(&qmp);
+        EnableBalloon(&qmp);
+    }
+}
+
+/* Turn on guest memory stats and hand the balloon over to the controller */
+void VmBuilderQemu::EnableBalloon(QmpClient *qmp) {
+    if (!IsTrue(cfg_.GetValue(kGroupMem, kMemBalloon)))
+        return;
+
+    boost::property_tree::ptree ret;
+    std::string args = std::string("{\"path\": \"") + kBalloonQomPath +
+                       "\", \"property\": \"guest-stats-polling-interval\", \"value\": " +
+                       std::to_string(kBalloonStatsIntervalSec) + "}";
+    if (!qmp->Execute("qom-set", args, &ret)) {
+        LOG(warning) << "Failed to enable balloon stats of " << name_;
+        return;
+    }
+
+    int64_t max_mb = ParseMemSizeMb(cfg_.GetValue(kGroupMem, kMemSize));
+    std::string min = cfg_.GetValue(kGroupMem, kMemBalloonMin);
+    int64_t min_mb = min.empty() ? max_mb / 2 : ParseMemSizeMb(min);
+    if ((max_mb <= 0) || (min_mb <= 0)) {
+        LOG(warning) << "Invalid memory size, balloon of " << name_ << " is not managed";
+        return;
+    }
+    uint64_t max_bytes = static_cast<uint64_t>(max_mb) << 20;
+    uint64_t min_bytes = static_cast<uint64_t>(min_mb) << 20;
+    BalloonController::Get().Add(name_, BalloonQmpSockPath(), max_bytes, min_bytes);
+    boot_trace_.Mark("balloon");
+}
+
+void VmBuilderQemu::PinVcpus(QmpClient *qmp) {
+    std::string pin = cfg_.GetValue(kGroupVcpu, kVcpuPin);
+    std::string emul_pin = cfg_.GetValue(kGroupVcpu, kVcpuEmulPin);
+    if (pin.empty() && emul_pin.empty())
+        return;
+
+    int nr_vcpus = VcpuCount(cfg_.GetValue(kGroupVcpu, kVcpuNum));
+
+    std::vector<int> vcpu_cpus, emul_cpus;
+    std::string err;
+    if (pin.compare(kCpuPinAuto) == 0) {
+        /* Assigned by CpuAllocator in PrepareHost, emulator_pin still overrides */
+        std::vector<int> unused;
+        if (!ResolveCpuPinning("", emul_pin, nr_vcpus, &unused, &emul_cpus, &err)) {
+            LOG(warning) << "Skip vCPU pinning: " << err;
+            return;
+        }
+        vcpu_cpus = vcpu_cpus_;
+        if (emul_pin.empty())
+            emul_cpus = emul_cpus_;
+    } else if (!ResolveCpuPinning(pin, emul_pin, nr_vcpus, &vcpu_cpus, &emul_cpus, &err)) {
+        LOG(warning) << "Skip vCPU pinning: " << err;
+        return;
+    }
+
+    boost::property_tree::ptree cpus;
+    if (!qmp->Execute("query-cpus-fast", &cpus)) {
+        LOG(warning) << "Skip vCPU pinning: failed to query vCPU threads";
+        return;
+    }
+
+    std::set<pid_t> vcpu_tids;
+    for (auto &c : cpus) {
+        int idx = c.second.get<int>("cpu-index", -1);
+        pid_t tid = c.second.get<pid_t>("thread-id", -1);
+        if ((idx < 0) || (tid <= 0))
+            continue;
+        vcpu_tids.insert(tid);
+        if (vcpu_cpus.empty())
+            continue;
+        if (vcpu_cpus.size() == static_cast<size_t>(nr_vcpus) && (idx < nr_vcpus))
+            SetThreadAffinity(tid, { vcpu_cpus[idx] });
+        else
+            SetThreadAffinity(tid, vcpu_cpus);
+    }
+
+    /* Main loop, iothreads and workers; threads created later inherit the affinity */
+    if (!emul_cpus.empty()) {
+        for (pid_t tid : ProcessThreads(main_proc_->GetPid())) {
+            if (vcpu_tids.find(tid) == vcpu_tids.end())
+                SetThreadAffinity(tid, emul_cpus);
+        }
+    }
+
+    LOG(info) << "vCPUs pinned to " << (vcpu_cpus.empty() ? "all" : CpuListToString(vcpu_cpus))
+              << ", emulator threads to " << (emul_cpus.empty() ? "all" : CpuListToString(emul_cpus));
+    boot_trace_.Mark("vcpu_pin");
+}
+
+/* Iothreads with their own pin, after PinVcpus has given them the emulator CPUs */
+void VmBuilderQemu::PinIothreads(QmpClient *qmp) {
+    std::map<std::string, std::vector<int>> pins;
+    for (auto &group : cfg_.GetDiskGroups()) {
+        std::string pin = cfg_.GetValue(group, kDiskIothreadPin);
+        std::vector<int> cpus;
+        if (pin.empty() || !IsTrue(cfg_.GetValue(group, kDiskIothread)))
+            continue;
+        if (ParseCpuList(pin, &cpus))
+            pins["iothread-" + group] = cpus;
+        else
+            LOG(warning) << "Invalid iothread pin of " << group << ": " << pin;
+    }
+    if (pins.empty())
+        return;
+
+    boost::property_tree::ptree iothreads;
+    if (!qmp->Execute("query-iothreads", &iothreads)) {
+        LOG(warning) << "Skip iothread pinning: failed to query iothreads";
+        return;
+    }
+    for (auto &t : iothreads) {
+        auto it = pins.find(t.second.get<std::string>("id", ""));
+        pid_t tid = t.second.get<pid_t>("thread-id", -1);
+        if ((it == pins.end()) || (tid <= 0))
+            continue;
+        SetThreadAffinity(tid, it->second);
+        LOG(info) << it->first << " pinned to " << CpuListToString(it->second);
+    }
 }
 
 bool VmBuilderQemu::WaitVmReady(void) {
@@ -990,6 +1843,15 @@ void VmBuilderQemu::StopVm() {
     co_procs_.clear();
 
     VsockCidPool::Pool().ReleaseCid(vsock_cid_);
+    CpuAllocator::Get().Release(name_);
+    HugepageManager::Get().Release(name_);
+    BalloonController::Get().Remove(name_);
+    KsmController::Get().Remove(name_);
+    VmSwitch::Get().Leave(name_);
+    {
+        std::scoped_lock lock(net_qos_mutex_);
+        net_tap_.clear();
+    }
 
     while (!end_call_.empty()) {
         end_call_.front()();
@@ -16,6 +16,7 @@
 #include <utility>
 #include <memory>
 #include <queue>
+#include <map>
 
 #include <boost/ptr_container/ptr_vector.hpp>
 #include <boost/thread/latch.hpp>
@@ -23,6 +24,11 @@
 #include "guest/config_parser.h"
 #include "guest/vm_builder.h"
 #include "guest/aaf.h"
+#include "guest/qemu_cmdline.h"
+#include "guest/net_qos.h"
+#include "guest/disk_throttle.h"
+#include "guest/launch_plan.h"
+#include "guest/qmp_client.h"
 
 namespace vm_manager {
 
@@ -32,6 +38,7 @@ class VmBuilderQemu : public VmBuilder {
                        VmBuilder(name), cfg_(cfg), vm_ready_latch_(1) {}
     ~VmBuilderQemu();
     bool BuildVmArgs(void);
+    bool PrepareHost(void);
     void StartVm(void);
     void StopVm(void);
     void WaitVmExit(void);
@@ -39,24 +46,33 @@ class VmBuilderQemu : public VmBuilder {
     bool WaitVmReady(void);
     void SetVmReady(void);
     void SetProcessEnv(std::vector<std::string> env);
+    uint64_t ReadLog(uint64_t from, size_t max, std::string *out);
+    bool SetNetQos(const std::string &spec);
+    bool SetDiskThrottle(const std::string &name, const std::string &spec);
 
  private:
     bool BuildEmulPath(void);
     void BuildFixedCmd(void);
     bool BuildNameQmp(void);
-    void BuildNetCmd(void);
+    bool BuildNetCmd(void);
+    int NetQueues(void);
+    void BuildSwitchNetCmd(void);
+    void BuildPasstNetCmd(const std::string &model, const std::string &adb_port, const std::string &fb_port);
+    bool SetupNetTap(int queues, std::string *ifname);
     bool BuildVsockCmd(void);
     void BuildRpmbCmd(void);
     void BuildVtpmCmd(void);
-    void InitAafCfg(void);
     bool BuildAafCfg(void);
+    void SetupAafCfg(void);
     bool BuildVgpuCmd(void);
     void BuildVinputCmd(void);
     void BuildDispCmd(void);
     void BuildMemCmd(void);
+    void BuildBalloonCmd(void);
     void BuildVcpuCmd(void);
     bool BuildFirmwareCmd(void);
-    void BuildVdiskCmd(void);
+    bool BuildVdiskCmd(void);
+    bool BuildDiskCmd(const std::string &group);
     void BringDownBtHciIntf(void);
     void BuildPtPciDevicesCmd(void);
     void BuildGuestTimeKeepCmd(void);
@@ -70,19 +86,43 @@ class VmBuilderQemu : public VmBuilder {
     bool CreateGvtgVgpu(void);
 
     void SetPciDevicesCallback(void);
-    bool SetupSriov(void);
+    void PassthroughPciDevs(const std::vector<std::string> &devs, std::set<std::string> *dropped);
+    bool BuildSriovCmd(void);
+    bool SetupVsockCid(const std::string &str_cid);
+    bool SetupPwrQmpSock(std::string *sock);
+    bool ReserveHugePages(const std::string &mem_size);
     void RunMediationSrv(void);
     void SetExtraServices(void);
     void SetProcLogDir(void);
+    void AddSimpleCoProc(const std::string &cmd);
+    void PinVcpus(QmpClient *qmp);
+    void PinIothreads(QmpClient *qmp);
+    void EnableBalloon(QmpClient *qmp);
+    std::string QmpSockPath(void);
+    std::string BalloonQmpSockPath(void);
+    bool BuildLaunchPlan(void);
+    std::string PlanFingerprint(void);
+    bool RunHostPrep(const HostPrep &prep, std::map<std::string, std::string> *values,
+                     std::set<std::string> *dropped);
 
     CivConfig cfg_;
     std::unique_ptr<Aaf> aaf_cfg_;
 
     std::unique_ptr<VmProcess> main_proc_;
     std::vector<std::unique_ptr<VmProcess>> co_procs_;
-    std::string emul_cmd_;
+    QemuCmdline cmdline_;
+    LaunchPlan plan_;
+    std::vector<int> vcpu_cpus_;
+    std::vector<int> emul_cpus_;
+    std::string net_tap_;
+    NetQos net_qos_;
+    NetQosState net_qos_state_;
+    std::mutex net_qos_mutex_;
+    std::map<std::string, DiskThrottle> disk_throttle_;
+    std::mutex disk_throttle_mutex_;
     // std::vector<std::string> env_data_;
     std::set<std::string> pci_pt_dev_set_;
+    bool pci_restore_set_ = false;
     boost::latch vm_ready_latch_;
     std::queue<std::function<void(void)>> end_call_;
     std::mutex stopvm_mutex_;
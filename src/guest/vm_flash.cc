@@ -16,6 +16,7 @@
 #include "guest/vm_flash.h"
 #include "guest/config_parser.h"
 #include "guest/vm_process.h"
+#include "guest/disk_image.h"
 #include "utils/utils.h"
 #include "utils/log.h"
 
@@ -144,16 +145,9 @@ bool VmFlasher::QemuCreateVirtUsbDisk(void) {
 }
 
 bool VmFlasher::QemuCreateVirtualDisk(void) {
-    std::string path = cfg_.GetValue(kGroupDisk, kDiskPath);
-    std::string size = cfg_.GetValue(kGroupDisk, kDiskSize);
-
-    std::string cmd("qemu-img create -f qcow2 " + path + " " + size);
-    LOG(info) << cmd;
-    if (boost::process::system(cmd)) {
-        LOG(error) << "Failed to : " << cmd;
-        return false;
-    }
-    return true;
+    return CreateDiskImage(cfg_.GetValue(kGroupDisk, kDiskPath), cfg_.GetValue(kGroupDisk, kDiskSize),
+                           cfg_.GetValue(kGroupDisk, kDiskFormat), cfg_.GetValue(kGroupDisk, kDiskPrealloc),
+                           cfg_.GetValue(kGroupDisk, kDiskClusterSize));
 }
 
 bool VmFlasher::FlashWithQemu(void) {
@@ -222,7 +216,8 @@ bool VmFlasher::FlashWithQemu(void) {
 
     qemu_args.append(
         " -device virtio-scsi-pci,id=scsi0,addr=0x8"
-        " -drive if=none,format=qcow2,id=scsidisk1,file=" + cfg_.GetValue(kGroupDisk, kDiskPath) +
+        " -drive if=none,format=" + DiskImageFormat(cfg_.GetValue(kGroupDisk, kDiskPath)) +
+        ",id=scsidisk1,file=" + cfg_.GetValue(kGroupDisk, kDiskPath) +
         " -device scsi-hd,drive=scsidisk1,bus=scsi0.0");
 
     qemu_args.append(" -name civ_flashing"
@@ -272,6 +267,18 @@ bool VmFlasher::FlashGuest(std::string path) {
         return false;
     }
 
+    /* The golden image is flashed once, a guest on top of it only needs a fresh overlay */
+    std::string golden = cfg_.GetValue(kGroupDisk, kDiskGolden);
+    if (!golden.empty()) {
+        std::string disk = cfg_.GetValue(kGroupDisk, kDiskPath);
+        boost::filesystem::remove(disk, ec);
+        if (!CreateOverlay(golden, disk, cfg_.GetValue(kGroupDisk, kDiskSize),
+                           cfg_.GetValue(kGroupDisk, kDiskClusterSize)))
+            return false;
+        LOG(info) << "Flash done! " << disk << " is an overlay of " << golden;
+        return true;
+    }
+
     std::string emul_type = cfg_.GetValue(kGroupEmul, kEmulType);
     if ((emul_type.compare(kEmulTypeQemu) == 0) || emul_type.empty()) {
         return FlashWithQemu();
@@ -6,21 +6,95 @@
  *
  */
 
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
 #include <fstream>
 #include <ctime>
 
+#include <boost/algorithm/string/join.hpp>
+#include <boost/filesystem.hpp>
 #include <boost/process.hpp>
-#include <boost/process/environment.hpp>
+#include <boost/program_options/parsers.hpp>
 #include <boost/thread.hpp>
-#include <boost/process/extend.hpp>
 
 #include "utils/log.h"
 #include "guest/vm_process.h"
 
+extern char **environ;
+
 namespace vm_manager {
 
+VmProcSimple::VmProcSimple(const std::string &cmd) :
+        argv_(boost::program_options::split_unix(cmd)), child_latch_(1) {}
+
+/*
+ * Spawn argv[0] (searched in PATH) with exactly argv/envp, stdout and stderr
+ * redirected to out_fd. Signal mask and dispositions are reset in the child and
+ * every other inherited descriptor is closed, whatever its close-on-exec flag.
+ */
+static pid_t SpawnProcess(const std::vector<std::string> &argv, const std::vector<std::string> &envp,
+                          int out_fd, int *pidfd) {
+    std::vector<char *> c_argv;
+    for (const std::string &a : argv)
+        c_argv.push_back(const_cast<char *>(a.c_str()));
+    c_argv.push_back(nullptr);
+
+    std::vector<char *> c_envp;
+    for (const std::string &e : envp)
+        c_envp.push_back(const_cast<char *>(e.c_str()));
+    c_envp.push_back(nullptr);
+
+    posix_spawn_file_actions_t fa;
+    posix_spawn_file_actions_init(&fa);
+    posix_spawn_file_actions_adddup2(&fa, out_fd, STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&fa, out_fd, STDERR_FILENO);
+#if __GLIBC_PREREQ(2, 34)
+    posix_spawn_file_actions_addclosefrom_np(&fa, STDERR_FILENO + 1);
+#else
+    /*
+     * No closefrom action, close what is open now. glibc ignores closing a
+     * descriptor that is gone by then, such as the one of the listing itself.
+     */
+    boost::system::error_code ec;
+    for (auto &x : boost::filesystem::directory_iterator("/proc/self/fd", ec)) {
+        int fd = atoi(x.path().filename().c_str());
+        if (fd > STDERR_FILENO)
+            posix_spawn_file_actions_addclose(&fa, fd);
+    }
+#endif
+
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    sigset_t mask;
+    sigemptyset(&mask);
+    posix_spawnattr_setsigmask(&attr, &mask);
+    sigfillset(&mask);
+    posix_spawnattr_setsigdefault(&attr, &mask);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+
+    pid_t pid = -1;
+    int ret = posix_spawnp(&pid, c_argv[0], &fa, &attr, c_argv.data(), c_envp.data());
+
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&fa);
+
+    if (ret != 0) {
+        LOG(error) << "Failed to spawn " << argv[0] << ": " << strerror(ret);
+        return -1;
+    }
+
+    /* Not reaped until waitpid() of the monitor thread, so the pid cannot be reused yet */
+    *pidfd = syscall(SYS_pidfd_open, pid, 0);
+    return pid;
+}
+
 void VmProcSimple::ThreadMon(void) {
-    std::error_code ec;
+    logger::ScopedVmTag tag(vm_name_, cid_);
 
     time_t rawtime;
     struct tm timeinfo;
@@ -29,58 +103,79 @@ void VmProcSimple::ThreadMon(void) {
     localtime_r(&rawtime, &timeinfo);
     strftime(t_buf, 80 , "%Y-%m-%d_%T", &timeinfo);
 
-    boost::process::environment env;
+    std::vector<std::string> envp;
     for (std::string s : env_data_) {
-        if (s.length() == 0)
+        if (s.find('=') == std::string::npos)
             continue;
-        env.set(s.substr(0, s.find('=')), s.substr(s.find('=') + 1));
+        envp.push_back(std::move(s));
     }
 
-    LOG(info) << "CMD: " << cmd_;
-    size_t exe_pos_begin = cmd_.find_first_not_of(' ');
-    if (exe_pos_begin == std::string::npos)
+    std::string cmd = boost::algorithm::join(argv_, " ");
+    LOG(info) << "CMD: " << cmd;
+    if (argv_.empty() || argv_[0].empty()) {
+        child_latch_.count_down();
         return;
+    }
 
-    size_t exe_pos_end = cmd_.find_first_of(' ', exe_pos_begin);
-    if (exe_pos_end == std::string::npos)
-        exe_pos_end = cmd_.size();
-    std::string exe = cmd_.substr(exe_pos_begin, exe_pos_end - exe_pos_begin);
+    std::string exe = boost::filesystem::path(argv_[0]).filename().string();
 
     std::string tid = boost::lexical_cast<std::string>(mon_->get_id());
 
-    std::string f_out = log_dir_ + std::string(basename(exe.c_str())) + "_" + t_buf + "_" + tid + "_out.log";
-    std::ofstream fo(f_out);
-    fo.close();
-
-    boost::filesystem::permissions(f_out, boost::filesystem::perms::owner_read |
-                                          boost::filesystem::perms::owner_write |
-                                          boost::filesystem::perms::group_read |
-                                          boost::filesystem::perms::group_write |
-                                          boost::filesystem::perms::others_read |
-                                          boost::filesystem::perms::others_write |
-                                          boost::filesystem::add_perms);
-
-    c_ = std::make_unique<boost::process::child>(
-        cmd_,
-        boost::process::env = env,
-        (boost::process::std_out & boost::process::std_err) > f_out,
-        ec,
-        boost::process::extend::on_success = [this](auto & exec) {
-            child_latch_.count_down();
-        },
-        boost::process::extend::on_error = [this](auto & exec, const std::error_code& ec) {
-            child_latch_.count_down();
+    std::string f_out = log_dir_ + exe + "_out.log";
+    log_.Open(f_out);
+    log_.Write(std::string("\n===== ") + t_buf + " CMD: " + cmd + "\n");
+
+    /* Close-on-exec, so that only this child holds the write end of its pipe */
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) != 0) {
+        LOG(error) << "Failed to create log pipe for " << exe;
+        child_latch_.count_down();
+        return;
+    }
+
+    int pidfd = -1;
+    pid_t pid = SpawnProcess(argv_, envp, fds[1], &pidfd);
+    close(fds[1]);
+    if (pid < 0) {
+        close(fds[0]);
+        log_.Write("\n===== failed to spawn\n");
+        child_latch_.count_down();
+        return;
+    }
+    {
+        std::scoped_lock lock(proc_mutex_);
+        pid_ = pid;
+        pidfd_ = pidfd;
+        running_ = true;
+    }
+    child_latch_.count_down();
+
+    LOG(info) << logger::event("proc_start") << "Child-" << pid << " started: " << exe;
+
+    boost::thread reader([this, &fds]() {
+        log_.Capture(fds[0]);
     });
 
-    c_->wait(ec);
+    int status = 0;
+    while ((waitpid(pid, &status, 0) < 0) && (errno == EINTR)) {}
+
+    {
+        std::scoped_lock lock(proc_mutex_);
+        running_ = false;
+        if (pidfd_ >= 0)
+            close(pidfd_);
+        pidfd_ = -1;
+    }
 
-    std::ofstream out(f_out, std::fstream::app);
-    out << "\n\nCMD: " << cmd_;
+    log_.Stop();
+    reader.join();
+    close(fds[0]);
 
-    int result = c_->exit_code();
+    int result = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    log_.Write("\n===== exited, exit code=" + std::to_string(result) + "\n");
 
-    LOG(info) << "Thread-0x" << tid << " Exiting"
-              << "\n\t\tChild-" << c_->id() << " exited, exit code=" << result
+    LOG(info) << logger::event("proc_exit") << "Thread-0x" << tid << " Exiting"
+              << "\n\t\tChild-" << pid << " exited, exit code=" << result
               << "\n\t\tlog: " << f_out;
 }
 
@@ -100,6 +195,19 @@ void VmProcSimple::SetEnv(std::vector<std::string> env) {
     env_data_ = env;
 }
 
+void VmProcSimple::SetLogPolicy(const ProcLogPolicy &policy) {
+    log_.SetPolicy(policy);
+}
+
+void VmProcSimple::SetLogTag(const std::string &vm_name, uint32_t cid) {
+    vm_name_ = vm_name;
+    cid_ = cid;
+}
+
+uint64_t VmProcSimple::ReadLog(uint64_t from, size_t max, std::string *out) {
+    return log_.Read(from, max, out);
+}
+
 void VmProcSimple::SetLogDir(const char *path) {
     if (!path)
         return;
@@ -117,20 +225,28 @@ void VmProcSimple::SetLogDir(const char *path) {
     log_dir_.assign(boost::filesystem::absolute(p, ec).c_str()).append("/");
 }
 
+/* Signal the child if it is still running, through the pidfd as the pid may be reused once it is reaped */
+bool VmProcSimple::Signal(int sig) {
+    std::scoped_lock lock(proc_mutex_);
+    if (!running_)
+        return false;
+    LOG(info) << ((sig == SIGKILL) ? "Kill" : "Terminate") << " CoProc: " << pid_;
+    if ((pidfd_ < 0) || (syscall(SYS_pidfd_send_signal, pidfd_, sig, nullptr, 0) != 0))
+        kill(pid_, sig);
+    return true;
+}
+
 void VmProcSimple::Stop(void) {
     try {
-        if (!mon_ || !c_)
+        if (!mon_)
             return;
 
-        if (!mon_.get())
-            return;
-
-        if (!c_->running())
-            return;
-
-        LOG(info) << "Terminate CoProc: " << c_->id();
-        kill(c_->id(), SIGTERM);
-        mon_->try_join_for(boost::chrono::seconds(10));
+        /* The monitor thread still writes log_ after the child is gone, always join it */
+        Signal(SIGTERM);
+        if (mon_->joinable() && !mon_->try_join_for(boost::chrono::seconds(10))) {
+            Signal(SIGKILL);
+            mon_->join();
+        }
         mon_.reset(nullptr);
     } catch (std::exception& e) {
         LOG(error) << "Exception: " << e.what();
@@ -138,9 +254,12 @@ void VmProcSimple::Stop(void) {
 }
 
 bool VmProcSimple::Running(void) {
-    if (c_)
-        return c_->running();
-    return false;
+    return running_;
+}
+
+pid_t VmProcSimple::GetPid(void) {
+    std::scoped_lock lock(proc_mutex_);
+    return running_ ? pid_ : -1;
 }
 
 VmProcSimple::~VmProcSimple() {
@@ -153,11 +272,11 @@ void VmCoProcRpmb::Run(void) {
     boost::system::error_code bec;
     if (!boost::filesystem::exists(data_dir_ + "/" + kRpmbData, bec)) {
         std::error_code ec;
-        boost::process::child init_data(bin_ + " --dev " + data_dir_ + "/" + kRpmbData + " --init --size 2048");
+        boost::process::child init_data(bin_, "--dev", data_dir_ + "/" + kRpmbData, "--init", "--size", "2048");
         init_data.wait(ec);
         int ret = init_data.exit_code();
     }
-    cmd_ = bin_ + " --dev " + data_dir_ + "/" + kRpmbData + " --sock " + sock_file_;
+    argv_ = { bin_, "--dev", data_dir_ + "/" + kRpmbData, "--sock", sock_file_ };
 
     VmProcSimple::Run();
 }
@@ -181,6 +300,34 @@ VmCoProcRpmb::~VmCoProcRpmb() {
     VmCoProcRpmb::Stop();
 }
 
+void VmCoProcPasst::Run(void) {
+    /* A stale socket would be taken as ready */
+    boost::system::error_code bec;
+    boost::filesystem::remove(sock_file_, bec);
+
+    VmProcSimple::Run();
+
+    /* The emulator connects once at startup, so passt must be listening by then */
+    for (int waited = 0; waited < kPasstSockWaitMs; waited += 10) {
+        if (boost::filesystem::exists(sock_file_, bec) || !Running())
+            break;
+        usleep(10 * 1000);
+    }
+    if (!boost::filesystem::exists(sock_file_, bec))
+        LOG(warning) << "passt socket not ready: " << sock_file_;
+}
+
+void VmCoProcPasst::Stop(void) {
+    VmProcSimple::Stop();
+
+    boost::system::error_code bec;
+    boost::filesystem::remove(sock_file_, bec);
+}
+
+VmCoProcPasst::~VmCoProcPasst() {
+    VmCoProcPasst::Stop();
+}
+
 void VmCoProcVtpm::Run(void) {
     LOG(info) << bin_ << " " << data_dir_;
 
@@ -190,8 +337,8 @@ void VmCoProcVtpm::Run(void) {
         return;
     }
 
-    cmd_ = bin_ + " socket --tpmstate dir=" + data_dir_ +
-           " --tpm2 --ctrl type=unixio,path=" + data_dir_ + "/" + kVtpmSock;
+    argv_ = { bin_, "socket", "--tpmstate", "dir=" + data_dir_,
+              "--tpm2", "--ctrl", "type=unixio,path=" + data_dir_ + "/" + kVtpmSock };
 
     VmProcSimple::Run();
 }
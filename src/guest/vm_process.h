@@ -9,14 +9,19 @@
 #ifndef SRC_GUEST_VM_PROCESS_H_
 #define SRC_GUEST_VM_PROCESS_H_
 
+#include <sys/types.h>
+
 #include <string>
 #include <vector>
 #include <memory>
+#include <mutex>
+#include <atomic>
 
 #include <boost/thread.hpp>
 #include <boost/asio.hpp>
 #include <boost/thread/latch.hpp>
 
+#include "guest/proc_log.h"
 #include "utils/log.h"
 
 namespace vm_manager {
@@ -24,6 +29,7 @@ namespace vm_manager {
 inline constexpr const char *kRpmbData = "RPMB_DATA";
 inline constexpr const char *kRpmbSockPrefix = "/tmp/rpmb_sock_";
 inline constexpr const char *kVtpmSock = "swtpm-sock";
+inline constexpr int kPasstSockWaitMs = 2000;
 
 class VmProcess {
  public:
@@ -32,19 +38,28 @@ class VmProcess {
     virtual bool Running(void) = 0;
     virtual void Join(void) = 0;
     virtual void SetLogDir(const char *path) = 0;
+    virtual void SetLogPolicy(const ProcLogPolicy &policy) = 0;
+    virtual void SetLogTag(const std::string &vm_name, uint32_t cid) = 0;
+    virtual uint64_t ReadLog(uint64_t from, size_t max, std::string *out) = 0;
     virtual void SetEnv(std::vector<std::string> env) = 0;
+    virtual pid_t GetPid(void) = 0;
     virtual ~VmProcess() = default;
 };
 
 class VmProcSimple : public VmProcess {
  public:
-    explicit VmProcSimple(std::string cmd) : cmd_(cmd), child_latch_(1) {}
+    explicit VmProcSimple(std::vector<std::string> argv) : argv_(std::move(argv)), child_latch_(1) {}
+    explicit VmProcSimple(const std::string &cmd);
     void Run(void);
     void Stop(void);
     bool Running(void);
     void Join(void);
     void SetEnv(std::vector<std::string> env);
+    pid_t GetPid(void);
     void SetLogDir(const char *path);
+    void SetLogPolicy(const ProcLogPolicy &policy);
+    void SetLogTag(const std::string &vm_name, uint32_t cid);
+    uint64_t ReadLog(uint64_t from, size_t max, std::string *out);
     virtual ~VmProcSimple();
 
  protected:
@@ -52,13 +67,20 @@ class VmProcSimple : public VmProcess {
     VmProcSimple& operator=(const VmProcSimple&) = delete;
 
     void ThreadMon(void);
+    bool Signal(int sig);
 
 
-    std::string cmd_;
+    std::vector<std::string> argv_;
     std::vector<std::string> env_data_;
     std::string log_dir_ = "/tmp/";
-
-    std::unique_ptr<boost::process::child> c_;
+    ProcLog log_;
+    std::string vm_name_;
+    uint32_t cid_ = 0;
+
+    pid_t pid_ = -1;
+    int pidfd_ = -1;
+    std::atomic<bool> running_ = false;
+    std::mutex proc_mutex_;
     boost::latch child_latch_;
 
  private:
@@ -68,7 +90,7 @@ class VmProcSimple : public VmProcess {
 class VmCoProcRpmb : public VmProcSimple {
  public:
     VmCoProcRpmb(std::string bin, std::string data_dir, std::string sock_file) :
-          VmProcSimple(""), bin_(bin), data_dir_(data_dir), sock_file_(sock_file) {}
+          VmProcSimple(std::vector<std::string>()), bin_(bin), data_dir_(data_dir), sock_file_(sock_file) {}
 
     void Run(void);
     void Stop(void);
@@ -83,10 +105,27 @@ class VmCoProcRpmb : public VmProcSimple {
     std::string sock_file_;
 };
 
+/* passt serving the emulator on a unix socket, Run() returns once the socket is listening */
+class VmCoProcPasst : public VmProcSimple {
+ public:
+    VmCoProcPasst(std::string sock_file, std::vector<std::string> argv) :
+          VmProcSimple(std::move(argv)), sock_file_(sock_file) {}
+
+    void Run(void);
+    void Stop(void);
+    ~VmCoProcPasst();
+
+ private:
+    VmCoProcPasst(const VmCoProcPasst&) = delete;
+    VmCoProcPasst& operator=(const VmCoProcPasst&) = delete;
+
+    std::string sock_file_;
+};
+
 class VmCoProcVtpm : public VmProcSimple {
  public:
     VmCoProcVtpm(std::string bin, std::string data_dir) :
-          VmProcSimple(""), bin_(bin), data_dir_(data_dir) {}
+          VmProcSimple(std::vector<std::string>()), bin_(bin), data_dir_(data_dir) {}
 
     void Run(void);
     void Stop(void);
@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2022 Intel Corporation.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+#include <unistd.h>
+
+#include <utility>
+
+#include <boost/filesystem.hpp>
+
+#include "guest/vm_switch.h"
+#include "utils/log.h"
+
+namespace vm_manager {
+
+std::string VmSwitchSockDir(const std::string &name) {
+    return "/tmp/civ_switch_" + name;
+}
+
+VmSwitch &VmSwitch::Get(void) {
+    static VmSwitch vm_switch;
+    return vm_switch;
+}
+
+bool VmSwitch::StartSwitch(const std::string &name, const std::string &bin, Switch *sw) {
+    std::string dir = VmSwitchSockDir(name);
+    std::string ctl = dir + "/ctl";
+    boost::system::error_code ec;
+    boost::filesystem::remove_all(dir, ec);
+
+    /* Without --nostdin the switch quits on EOF of the server's stdin */
+    sw->proc = std::make_unique<VmProcSimple>(std::vector<std::string>{ bin, "--sock", dir, "--nostdin" });
+    sw->proc->SetLogTag("switch_" + name, 0);
+    sw->proc->Run();
+
+    for (int waited = 0; waited < kVmSwitchReadyMs; waited += 10) {
+        if (boost::filesystem::exists(ctl, ec) || !sw->proc->Running())
+            break;
+        usleep(10 * 1000);
+    }
+    if (!boost::filesystem::exists(ctl, ec)) {
+        LOG(error) << "Failed to start vm switch " << name;
+        sw->proc->Stop();
+        sw->proc.reset();
+        return false;
+    }
+    LOG(info) << "Vm switch " << name << " started: " << dir;
+    return true;
+}
+
+bool VmSwitch::Join(const std::string &name, const std::string &vm, const std::string &bin) {
+    std::scoped_lock lock(mutex_);
+    Switch &sw = switches_[name];
+    if (!sw.proc || !sw.proc->Running()) {
+        if (!StartSwitch(name, bin, &sw)) {
+            if (sw.members.empty())
+                switches_.erase(name);
+            return false;
+        }
+    }
+    sw.members.insert(vm);
+    return true;
+}
+
+void VmSwitch::Leave(const std::string &vm) {
+    std::scoped_lock lock(mutex_);
+    for (auto it = switches_.begin(); it != switches_.end(); ++it) {
+        if (it->second.members.erase(vm) == 0)
+            continue;
+        if (it->second.members.empty()) {
+            LOG(info) << "Vm switch " << it->first << " has no member, stopping";
+            if (it->second.proc)
+                it->second.proc->Stop();
+            boost::system::error_code ec;
+            boost::filesystem::remove_all(VmSwitchSockDir(it->first), ec);
+            switches_.erase(it);
+        }
+        return;
+    }
+}
+
+}  // namespace vm_manager
@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2022 Intel Corporation.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#ifndef SRC_GUEST_VM_SWITCH_H_
+#define SRC_GUEST_VM_SWITCH_H_
+
+#include <string>
+#include <map>
+#include <set>
+#include <memory>
+#include <mutex>
+
+#include "guest/vm_process.h"
+
+namespace vm_manager {
+
+inline constexpr const char *kVmSwitchDefault = "civ";
+inline constexpr const char *kVmSwitchBin = "vde_switch";
+inline constexpr int kVmSwitchReadyMs = 2000;
+
+/* Control socket directory of switch name, the emulator attaches with -netdev vde,sock=<dir> */
+std::string VmSwitchSockDir(const std::string &name);
+
+/*
+ * Local L2 switches shared by guests of this server. A switch is a vde_switch
+ * co-process started when its first member joins and stopped when the last
+ * member leaves, so guest to guest traffic never enters the host network stack.
+ */
+class VmSwitch final {
+ public:
+    static VmSwitch &Get(void);
+
+    /* Add vm to switch name, starting the switch with bin if it is not running */
+    bool Join(const std::string &name, const std::string &vm, const std::string &bin);
+    /* Remove vm from the switch it joined, if any */
+    void Leave(const std::string &vm);
+
+ private:
+    VmSwitch() = default;
+    ~VmSwitch() = default;
+    VmSwitch(const VmSwitch &) = delete;
+    VmSwitch& operator=(const VmSwitch&) = delete;
+
+    struct Switch {
+        std::unique_ptr<VmProcSimple> proc;
+        std::set<std::string> members;
+    };
+
+    bool StartSwitch(const std::string &name, const std::string &bin, Switch *sw);
+
+    std::map<std::string, Switch> switches_;
+    std::mutex mutex_;
+};
+
+}  // namespace vm_manager
+
+#endif  // SRC_GUEST_VM_SWITCH_H_
@@ -38,6 +38,13 @@ bool VsockCidPool::ReleaseCid(uint32_t cid) {
     return true;
 }
 
+bool VsockCidPool::Available(uint32_t cid) {
+    if ((cid < 3) || (cid >= kCivMaxCidNum))
+        return false;
+    std::lock_guard<std::mutex> lock(mutex_);
+    return bs_[cid];
+}
+
 VsockCidPool &VsockCidPool::Pool(void) {
     static VsockCidPool vcp_;
     return vcp_;
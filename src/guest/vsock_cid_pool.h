@@ -26,6 +26,8 @@ class VsockCidPool {
 
     bool ReleaseCid(uint32_t cid);
 
+    bool Available(uint32_t cid);
+
     static VsockCidPool &Pool(void);
 
  private:
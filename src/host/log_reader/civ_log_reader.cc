@@ -0,0 +1,166 @@
+/*
+ * Copyright (c) 2022 Intel Corporation.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+#include <time.h>
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include <boost/program_options.hpp>
+
+#include "../../utils/log_record.h"
+
+/* Value of a string field in one JSON line written by the server, empty if absent */
+static std::string JsonField(const std::string &line, const std::string &key) {
+    std::string pattern = "\"" + key + "\":\"";
+    size_t pos = line.find(pattern);
+    if (pos == std::string::npos)
+        return std::string();
+    pos += pattern.size();
+
+    std::string value;
+    for (size_t i = pos; i < line.size(); i++) {
+        if (line[i] == '\\' && (i + 1 < line.size())) {
+            value.push_back(line[i]);
+            value.push_back(line[++i]);
+            continue;
+        }
+        if (line[i] == '"')
+            break;
+        value.push_back(line[i]);
+    }
+    return value;
+}
+
+static void PrintRecordJson(const logger::LogRecord &r) {
+    time_t sec = r.ts_us / 1000000;
+    struct tm tm;
+    char t_buf[32];
+    char us_buf[8];
+    gmtime_r(&sec, &tm);
+    strftime(t_buf, sizeof(t_buf), "%Y-%m-%dT%H:%M:%S", &tm);
+    snprintf(us_buf, sizeof(us_buf), ".%06u", static_cast<unsigned>(r.ts_us % 1000000));
+
+    std::cout << "{\"ts\":\"" << t_buf << us_buf << "\""
+              << ",\"sev\":\"" << logger::SeverityName(r.severity) << "\""
+              << ",\"vm\":\"";
+    logger::JsonEscape(std::cout, r.vm);
+    std::cout << "\",\"cid\":" << r.cid << ",\"subsys\":\"";
+    logger::JsonEscape(std::cout, r.subsys);
+    std::cout << "\",\"event\":\"";
+    logger::JsonEscape(std::cout, r.event);
+    std::cout << "\",\"msg\":\"";
+    logger::JsonEscape(std::cout, r.msg);
+    std::cout << "\"}\n";
+}
+
+static bool ReadBinaryLog(std::ifstream &in, const std::string &vm, const std::string &event) {
+    logger::LogRecord r;
+    while (logger::ReadLogRecord(in, &r, vm)) {
+        if (!event.empty() && (r.event.compare(event) != 0))
+            continue;
+        PrintRecordJson(r);
+    }
+    if (!in.eof()) {
+        std::cerr << "Corrupted record at offset " << in.tellg() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+static bool ReadJsonLog(std::ifstream &in, const std::string &vm, const std::string &event) {
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty())
+            continue;
+        if (!vm.empty() && (JsonField(line, "vm").compare(vm) != 0))
+            continue;
+        if (!event.empty() && (JsonField(line, "event").compare(event) != 0))
+            continue;
+        std::cout << line << "\n";
+    }
+    return true;
+}
+
+namespace po = boost::program_options;
+class LogReaderOptions final {
+ public:
+    LogReaderOptions() {
+        cmdline_options_.add_options()
+            ("help,h",  "Show this help message")
+            ("file,f",  po::value<std::string>(), "Log file written by vm-manager --log-format=json|binary")
+            ("vm,n",    po::value<std::string>(), "Only show records of this guest")
+            ("event,e", po::value<std::string>(), "Only show records of this event type");
+        positional_.add("file", 1);
+    }
+
+    LogReaderOptions(LogReaderOptions &) = delete;
+    LogReaderOptions& operator=(const LogReaderOptions &) = delete;
+
+    bool ParseOptions(int argc, char* argv[]) {
+        po::store(po::command_line_parser(argc, argv).options(cmdline_options_).positional(positional_).run(), vm_);
+        po::notify(vm_);
+
+        if (vm_.count("help")) {
+            PrintHelp();
+            return true;
+        }
+
+        if (vm_.count("file") != 1) {
+            PrintHelp();
+            return false;
+        }
+        std::string file = vm_["file"].as<std::string>();
+        std::string vm = vm_.count("vm") ? vm_["vm"].as<std::string>() : std::string();
+        std::string event = vm_.count("event") ? vm_["event"].as<std::string>() : std::string();
+
+        std::ifstream in(file, std::ios_base::in | std::ios_base::binary);
+        if (!in.is_open()) {
+            std::cerr << "Failed to open " << file << std::endl;
+            return false;
+        }
+
+        char magic[sizeof(logger::kLogBinMagic)] = { 0 };
+        if (in.read(magic, sizeof(magic)) && (memcmp(magic, logger::kLogBinMagic, sizeof(magic)) == 0))
+            return ReadBinaryLog(in, vm, event);
+
+        in.clear();
+        in.seekg(0);
+        return ReadJsonLog(in, vm, event);
+    }
+
+ private:
+    void PrintHelp(void) {
+        std::cout << "Usage:\n";
+        std::cout << "  civ-log-reader"
+                  << " <file> [-n vm_name] [-e event]\n";
+        std::cout << "Options:\n";
+
+        std::cout << cmdline_options_ << std::endl;
+        std::cout << "Example:\n";
+        std::cout << " ./civ-log-reader /tmp/civ_server.bin -n civ-1 -e vm_ready" << std::endl;
+    }
+
+    po::options_description cmdline_options_;
+    po::positional_options_description positional_;
+    po::variables_map vm_;
+};
+
+int main(int argc, char *argv[]) {
+    int ret = -1;
+    try {
+        LogReaderOptions o;
+
+        if (o.ParseOptions(argc, argv))
+            ret = 0;
+    } catch (std::exception& e) {
+        std::cerr << "Exception: " << e.what() << std::endl;
+    }
+    return ret;
+}
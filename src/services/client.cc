@@ -81,6 +81,94 @@ CivVmInfo Client::GetCivVmInfo(const char *vm_name) {
     return std::move(*vm_info);
 }
 
+void Client::PrepareGetGuestLogsClientShm(const char *vm_name, uint64_t offset) {
+    client_shm_.destroy<bstring>("LogVmName");
+    client_shm_.destroy<uint64_t>("LogOffset");
+    client_shm_.destroy<bstring>("VmLogs");
+    client_shm_.zero_free_memory();
+
+    client_shm_.construct<bstring>
+                ("LogVmName")
+                (vm_name, client_shm_.get_segment_manager());
+    client_shm_.construct<uint64_t>
+                ("LogOffset")
+                (offset);
+}
+
+bool Client::GetGuestLogs(const char *vm_name, uint64_t *offset, std::string *logs) {
+    if (!offset || !logs)
+        return false;
+    PrepareGetGuestLogsClientShm(vm_name, *offset);
+    if (!Notify(kCivMsgGetVmLogs))
+        return false;
+
+    std::pair<uint64_t *, size_t> next = client_shm_.find<uint64_t>("LogOffset");
+    std::pair<bstring *, size_t> data = client_shm_.find<bstring>("VmLogs");
+    if (!next.first || !data.first)
+        return false;
+    *offset = *next.first;
+    logs->assign(data.first->c_str(), data.first->size());
+    return true;
+}
+
+void Client::PrepareCheckGuestClientShm(const char *cfg_path) {
+    client_shm_.destroy<bstring>("CheckVmCfgPath");
+    client_shm_.destroy<bstring>("CheckVmProblems");
+    client_shm_.zero_free_memory();
+
+    client_shm_.construct<bstring>
+                ("CheckVmCfgPath")
+                (cfg_path, client_shm_.get_segment_manager());
+}
+
+std::vector<std::string> Client::GetCheckProblems(void) {
+    std::vector<std::string> problems;
+    std::pair<bstring *, size_t> res = client_shm_.find<bstring>("CheckVmProblems");
+    for (size_t i = 0; i < res.second; i++) {
+        problems.push_back(res.first[i].c_str());
+    }
+    return problems;
+}
+
+void Client::PrepareSetNetQosClientShm(const char *vm_name, const char *spec) {
+    client_shm_.destroy<bstring>("NetQosVmName");
+    client_shm_.destroy<bstring>("NetQosSpec");
+    client_shm_.zero_free_memory();
+
+    client_shm_.construct<bstring>
+                ("NetQosVmName")
+                (vm_name, client_shm_.get_segment_manager());
+    client_shm_.construct<bstring>
+                ("NetQosSpec")
+                (spec, client_shm_.get_segment_manager());
+}
+
+void Client::PrepareSetDiskThrottleClientShm(const char *vm_name, const char *group, const char *spec) {
+    client_shm_.destroy<bstring>("DiskThrottleVmName");
+    client_shm_.destroy<bstring>("DiskThrottleGroup");
+    client_shm_.destroy<bstring>("DiskThrottleSpec");
+    client_shm_.zero_free_memory();
+
+    client_shm_.construct<bstring>
+                ("DiskThrottleVmName")
+                (vm_name, client_shm_.get_segment_manager());
+    client_shm_.construct<bstring>
+                ("DiskThrottleGroup")
+                (group, client_shm_.get_segment_manager());
+    client_shm_.construct<bstring>
+                ("DiskThrottleSpec")
+                (spec, client_shm_.get_segment_manager());
+}
+
+std::vector<std::string> Client::GetStats(void) {
+    std::vector<std::string> stats;
+    std::pair<bstring *, size_t> res = client_shm_.find<bstring>("Stats");
+    for (size_t i = 0; i < res.second; i++) {
+        stats.push_back(res.first[i].c_str());
+    }
+    return stats;
+}
+
 bool Client::Notify(CivMsgType t) {
     std::pair<CivMsgSync*, boost::interprocess::managed_shared_memory::size_type> sync;
     sync = server_shm_.find<CivMsgSync>(kCivServerObjSync);
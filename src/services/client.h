@@ -27,6 +27,13 @@ class Client {
     void PrepareStopGuestClientShm(const char *vm_name);
     void PrepareGetGuestInfoClientShm(const char *vm_name);
     CivVmInfo GetCivVmInfo(const char *vm_name);
+    void PrepareGetGuestLogsClientShm(const char *vm_name, uint64_t offset);
+    bool GetGuestLogs(const char *vm_name, uint64_t *offset, std::string *logs);
+    void PrepareCheckGuestClientShm(const char *cfg_path);
+    std::vector<std::string> GetCheckProblems(void);
+    void PrepareSetNetQosClientShm(const char *vm_name, const char *spec);
+    void PrepareSetDiskThrottleClientShm(const char *vm_name, const char *group, const char *spec);
+    std::vector<std::string> GetStats(void);
     bool Notify(CivMsgType t);
 
  private:
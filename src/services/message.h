@@ -27,6 +27,8 @@ inline constexpr const char *kCivServerMemName = "CivServerShm";
 inline constexpr const char *kCivServerObjSync = "Civ Message Sync";
 inline constexpr const char *kCivServerObjData = "Civ Message Data";
 
+inline constexpr const size_t kCivMaxLogChunk = 32768U;
+
 
 enum CivMsgType {
     kCiVMsgStopServer = 100U,
@@ -36,6 +38,11 @@ enum CivMsgType {
     kCivMsgStopVm,
     kCivMsgGetVmInfo,
     kCivMsgTest,
+    kCivMsgGetVmLogs,
+    kCivMsgCheckVm,
+    kCivMsgSetNetQos,
+    kCivMsgGetStats,
+    kCivMsgSetDiskThrottle,
     kCivMsgRespondSuccess = 500U,
     kCivMsgRespondFail,
 };
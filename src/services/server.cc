@@ -15,6 +15,7 @@
 #include <string>
 #include <memory>
 #include <vector>
+#include <chrono>
 
 #include <boost/interprocess/managed_shared_memory.hpp>
 #include <boost/interprocess/mapped_region.hpp>
@@ -30,6 +31,12 @@
 #include "services/message.h"
 #include "guest/vm_powerctl.h"
 #include "guest/vm_builder_qemu.h"
+#include "guest/host_inventory.h"
+#include "guest/balloon_controller.h"
+#include "guest/ksm_controller.h"
+#include "guest/config_validator.h"
+#include "guest/cpu_allocator.h"
+#include "guest/cpu_affinity.h"
 #include "utils/log.h"
 #include "utils/utils.h"
 #include "include/constants/vm_manager.h"
@@ -63,7 +70,8 @@ int Server::StopVm(const char payload[]) {
     size_t id = FindVmInstance(std::string(vm_name.first->c_str()));
 
     if (id != -1UL) {
-        LOG(info) << "StopVm: " << vmis_[id]->GetName();
+        logger::ScopedVmTag tag(vmis_[id]->GetName(), vmis_[id]->GetCid());
+        LOG(info) << logger::event("vm_stop") << "StopVm: " << vmis_[id]->GetName();
         char listener_address[50] = { 0 };
         snprintf(listener_address, sizeof(listener_address) - 1, "vsock:%u:%u",
                 vmis_[id]->GetCid(),
@@ -109,6 +117,9 @@ int Server::ListVm(const char payload[]) {
 
     for (size_t i = 0; i < vmis_.size(); ++i) {
         std::string s(vmis_[i]->GetName() + ":" + VmStateToStr(vmis_[i]->GetState()));
+        std::vector<int> cpus = CpuAllocator::Get().Assigned(vmis_[i]->GetName());
+        if (!cpus.empty())
+            s.append(":" + CpuListToString(cpus));
         vm_lists[i].assign(s.c_str());
     }
 
@@ -139,6 +150,7 @@ int Server::ImportVm(const char payload[]) {
     if (vm_name.empty())
         return -1;
 
+    logger::ScopedVmTag tag(vm_name, 0);
     auto id = FindVmInstance(vm_name);
     if (id != -1UL) {
         VmBuilder::VmState st = vmis_[id].get()->GetState();
@@ -150,7 +162,7 @@ int Server::ImportVm(const char payload[]) {
         DeleteVmInstance(vm_name);
     }
 
-    std::vector<std::unique_ptr<VmBuilder>>::iterator vmi;
+    std::vector<std::shared_ptr<VmBuilder>>::iterator vmi;
     if (cfg.GetValue(kGroupEmul, kEmulType) == kEmulTypeQemu) {
         std::unique_ptr<VmBuilderQemu> vbq = std::make_unique<VmBuilderQemu>(vm_name, std::move(cfg));
         if (!vbq->BuildVmArgs())
@@ -167,31 +179,54 @@ int Server::ImportVm(const char payload[]) {
 }
 
 void Server::VmThread(VmBuilder *vb, boost::latch *notify_cont) {
-    LOG(info) << "Starting VM:  " << vb->GetName();
+    logger::ScopedVmTag tag(vb->GetName(), vb->GetCid());
+    LOG(info) << logger::event("vm_booting") << "Starting VM:  " << vb->GetName();
     /* Start VM */
     vb->StartVm();
 
     if (notify_cont->try_count_down()) {
         vb->SetVmReady();
+        startup_listener_.listener.AddPendingVM(vb->GetCid(), [vb](){
+            vb->GetBootTrace().Mark("vm_ready");
+            vb->GetBootTrace().Persist();
+        });
         vb->WaitVmExit();
+        LOG(info) << logger::event("vm_exit") << "VM exited: " << vb->GetName();
+        startup_listener_.listener.RemovePendingVM(vb->GetCid());
+        vb->GetBootTrace().Persist();
         DeleteVmInstance(vb->GetName());
         return;
     }
 
     startup_listener_.listener.AddPendingVM(vb->GetCid(), [vb](){
+        vb->GetBootTrace().Mark("vm_ready");
         vb->SetVmReady();
     });
 
     if (vb->WaitVmReady()) {
+        LOG(info) << logger::event("vm_ready") << "VM ready: " << vb->GetName();
+        vb->GetBootTrace().Persist();
         notify_cont->try_count_down();
         vb->WaitVmExit();
+        LOG(info) << logger::event("vm_exit") << "VM exited: " << vb->GetName();
         DeleteVmInstance(vb->GetName());
     } else {
+        LOG(warning) << logger::event("vm_exit") << "VM exited before ready: " << vb->GetName();
+        vb->GetBootTrace().Persist();
         DeleteVmInstance(vb->GetName());
         notify_cont->try_count_down();
     }
 }
 
+static bool PreflightCheck(CivConfig &cfg) {
+    std::vector<std::string> problems;
+    if (ConfigValidator(cfg).Validate(&problems))
+        return true;
+    for (auto &p : problems)
+        LOG(error) << "Config check: " << p;
+    return false;
+}
+
 int Server::StartVm(const char payload[]) {
     boost::interprocess::managed_shared_memory shm(
         boost::interprocess::open_read_only,
@@ -204,6 +239,8 @@ int Server::StartVm(const char payload[]) {
     if (p.empty())
         return -1;
 
+    auto start_time = std::chrono::steady_clock::now();
+
     CivConfig cfg;
     if (!cfg.ReadConfigFile(p)) {
         LOG(error) << "Failed to read config file";
@@ -216,21 +253,34 @@ int Server::StartVm(const char payload[]) {
     if (vm_name.empty())
         return -1;
 
+    logger::ScopedVmTag tag(vm_name, 0);
+    LOG(info) << logger::event("vm_start") << "StartVm: " << vm_name << ", config: " << p;
+
     if (FindVmInstance(vm_name) != -1UL) {
         LOG(error) << vm_name << " is already running!";
         return -1;
     }
 
-    std::vector<std::unique_ptr<VmBuilder>>::iterator vmi;
+    std::vector<std::shared_ptr<VmBuilder>>::iterator vmi;
     if (cfg.GetValue(kGroupEmul, kEmulType) == kEmulTypeQemu) {
         std::unique_ptr<VmBuilderQemu> vbq = std::make_unique<VmBuilderQemu>(vm_name, cfg);
-        if (!vbq->BuildVmArgs())
+        vbq->GetBootTrace().Begin(start_time);
+        vbq->GetBootTrace().Mark("config_read");
+        if (!PreflightCheck(cfg))
+            return -1;
+        vbq->GetBootTrace().Mark("config_check");
+        if (!vbq->BuildVmArgs() || !vbq->PrepareHost())
             return -1;
         vmi = vmis_.insert(vmis_.end(), std::move(vbq));
     } else {
         /* Default try to contruct for QEMU */
         std::unique_ptr<VmBuilderQemu> vbq = std::make_unique<VmBuilderQemu>(vm_name, cfg);
-        if (!vbq->BuildVmArgs())
+        vbq->GetBootTrace().Begin(start_time);
+        vbq->GetBootTrace().Mark("config_read");
+        if (!PreflightCheck(cfg))
+            return -1;
+        vbq->GetBootTrace().Mark("config_check");
+        if (!vbq->BuildVmArgs() || !vbq->PrepareHost())
             return -1;
         vmi = vmis_.insert(vmis_.end(), std::move(vbq));
     }
@@ -243,6 +293,8 @@ int Server::StartVm(const char payload[]) {
     }
 
     VmBuilder *vb = vmi->get();
+    tag.SetCid(vb->GetCid());
+    LOG(info) << logger::event("vm_build") << "VM arguments built: " << vm_name;
     vb->SetProcessEnv(std::move(env_data));
 
     boost::latch notify_cont(1);
@@ -286,6 +338,127 @@ int Server::GetVmInfo(const char payload[]) {
     return 0;
 }
 
+int Server::GetVmLogs(const char payload[]) {
+    boost::interprocess::managed_shared_memory shm(
+        boost::interprocess::open_only,
+        payload);
+
+    std::pair<bstring *, int> vm_name = shm.find<bstring>("LogVmName");
+    std::pair<uint64_t *, int> offset = shm.find<uint64_t>("LogOffset");
+    if (!vm_name.first || !offset.first)
+        return -1;
+
+    std::scoped_lock lock(vmis_mutex_);
+    size_t id = FindVmInstance(std::string(vm_name.first->c_str()));
+    if (id == -1UL)
+        return -1;
+
+    std::string logs;
+    *offset.first = vmis_[id]->ReadLog(*offset.first, kCivMaxLogChunk, &logs);
+
+    shm.destroy<bstring>("VmLogs");
+    bstring *vm_logs = shm.construct<bstring>
+                ("VmLogs")
+                (shm.get_segment_manager());
+    vm_logs->assign(logs.data(), logs.size());
+    return 0;
+}
+
+int Server::CheckVm(const char payload[]) {
+    boost::interprocess::managed_shared_memory shm(
+        boost::interprocess::open_only,
+        payload);
+
+    auto cfg_path = shm.find<bstring>("CheckVmCfgPath");
+    if (!cfg_path.first)
+        return -1;
+
+    std::vector<std::string> problems;
+    CivConfig cfg;
+    if (!cfg.ReadConfigFile(cfg_path.first->c_str()))
+        problems.push_back("failed to read config file");
+    else
+        ConfigValidator(cfg).Validate(&problems);
+
+    shm.destroy<bstring>("CheckVmProblems");
+    bstring *res = shm.construct<bstring>
+                ("CheckVmProblems")
+                [problems.size()]
+                (shm.get_segment_manager());
+    for (size_t i = 0; i < problems.size(); ++i)
+        res[i].assign(problems[i].c_str());
+
+    return problems.empty() ? 0 : -1;
+}
+
+int Server::SetNetQos(const char payload[]) {
+    boost::interprocess::managed_shared_memory shm(
+        boost::interprocess::open_only,
+        payload);
+
+    std::pair<bstring *, int> vm_name = shm.find<bstring>("NetQosVmName");
+    std::pair<bstring *, int> spec = shm.find<bstring>("NetQosSpec");
+    if (!vm_name.first || !spec.first)
+        return -1;
+
+    std::scoped_lock lock(vmis_mutex_);
+    size_t id = FindVmInstance(std::string(vm_name.first->c_str()));
+    if (id == -1UL) {
+        LOG(warning) << "CiV: " << vm_name.first->c_str() << " is not running!";
+        return -1;
+    }
+
+    logger::ScopedVmTag tag(vmis_[id]->GetName(), vmis_[id]->GetCid());
+    LOG(info) << "SetNetQos: " << spec.first->c_str();
+    return vmis_[id]->SetNetQos(spec.first->c_str()) ? 0 : -1;
+}
+
+int Server::SetDiskThrottle(const char payload[]) {
+    boost::interprocess::managed_shared_memory shm(
+        boost::interprocess::open_only,
+        payload);
+
+    std::pair<bstring *, int> vm_name = shm.find<bstring>("DiskThrottleVmName");
+    std::pair<bstring *, int> group = shm.find<bstring>("DiskThrottleGroup");
+    std::pair<bstring *, int> spec = shm.find<bstring>("DiskThrottleSpec");
+    if (!vm_name.first || !group.first || !spec.first)
+        return -1;
+
+    /* The QMP round trip runs unlocked, a slow monitor must not hold up requests for other guests */
+    std::shared_ptr<VmBuilder> vmi;
+    {
+        std::scoped_lock lock(vmis_mutex_);
+        size_t id = FindVmInstance(std::string(vm_name.first->c_str()));
+        if (id == -1UL) {
+            LOG(warning) << "CiV: " << vm_name.first->c_str() << " is not running!";
+            return -1;
+        }
+        vmi = vmis_[id];
+    }
+
+    logger::ScopedVmTag tag(vmi->GetName(), vmi->GetCid());
+    LOG(info) << "SetDiskThrottle: " << group.first->c_str() << " " << spec.first->c_str();
+    return vmi->SetDiskThrottle(group.first->c_str(), spec.first->c_str()) ? 0 : -1;
+}
+
+int Server::GetStats(const char payload[]) {
+    boost::interprocess::managed_shared_memory shm(
+        boost::interprocess::open_only,
+        payload);
+
+    std::vector<std::string> stats = KsmController::Get().Stats();
+
+    shm.destroy<bstring>("Stats");
+    shm.zero_free_memory();
+    bstring *res = shm.construct<bstring>
+                ("Stats")
+                [stats.size()]
+                (shm.get_segment_manager());
+    for (size_t i = 0; i < stats.size(); ++i)
+        res[i].assign(stats[i].c_str());
+    return 0;
+}
+
 static void HandleSIG(int num) {
     LOG(info) << "Signal(" << num << ") received!";
     Server::Get().Stop();
@@ -298,6 +471,10 @@ void Server::Start(void) {
 
         SetupStartupListenerService();
 
+        HostInventory::Get().Start();
+        BalloonController::Get().Start();
+        KsmController::Get().Start();
+
         struct shm_remove {
             shm_remove() { boost::interprocess::shared_memory_object::remove(kCivServerMemName); }
             ~shm_remove() { boost::interprocess::shared_memory_object::remove(kCivServerMemName); }
@@ -367,6 +544,41 @@ void Server::Start(void) {
                         data.first->type = kCivMsgRespondFail;
                     }
                     break;
+                case kCivMsgGetVmLogs:
+                    if (GetVmLogs(data.first->payload) == 0) {
+                        data.first->type = kCivMsgRespondSuccess;
+                    } else {
+                        data.first->type = kCivMsgRespondFail;
+                    }
+                    break;
+                case kCivMsgCheckVm:
+                    if (CheckVm(data.first->payload) == 0) {
+                        data.first->type = kCivMsgRespondSuccess;
+                    } else {
+                        data.first->type = kCivMsgRespondFail;
+                    }
+                    break;
+                case kCivMsgSetNetQos:
+                    if (SetNetQos(data.first->payload) == 0) {
+                        data.first->type = kCivMsgRespondSuccess;
+                    } else {
+                        data.first->type = kCivMsgRespondFail;
+                    }
+                    break;
+                case kCivMsgGetStats:
+                    if (GetStats(data.first->payload) == 0) {
+                        data.first->type = kCivMsgRespondSuccess;
+                    } else {
+                        data.first->type = kCivMsgRespondFail;
+                    }
+                    break;
+                case kCivMsgSetDiskThrottle:
+                    if (SetDiskThrottle(data.first->payload) == 0) {
+                        data.first->type = kCivMsgRespondSuccess;
+                    } else {
+                        data.first->type = kCivMsgRespondFail;
+                    }
+                    break;
                 case kCivMsgTest:
                     break;
                 default:
@@ -379,6 +591,10 @@ void Server::Start(void) {
 
         shm.destroy_ptr(sync_);
 
+        KsmController::Get().Stop();
+        BalloonController::Get().Stop();
+        HostInventory::Get().Stop();
+
         LOG(info) << "CiV Server exited!";
     } catch (std::exception &e) {
         LOG(error) << "CiV Server: Exception:" << e.what() << ", pid=" << getpid();
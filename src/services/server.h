@@ -48,6 +48,11 @@ class Server final {
     int StartVm(const char payload[]);
     int StopVm(const char payload[]);
     int GetVmInfo(const char payload[]);
+    int GetVmLogs(const char payload[]);
+    int CheckVm(const char payload[]);
+    int SetNetQos(const char payload[]);
+    int SetDiskThrottle(const char payload[]);
+    int GetStats(const char payload[]);
 
     void VmThread(VmBuilder *vb, boost::latch *wait_continue);
 
@@ -61,7 +66,8 @@ class Server final {
 
     CivMsgSync *sync_ = nullptr;
 
-    std::vector<std::unique_ptr<VmBuilder>> vmis_;
+    /* Shared, so a request may keep using a guest after dropping vmis_mutex_ */
+    std::vector<std::shared_ptr<VmBuilder>> vmis_;
 
     std::mutex vmis_mutex_;
 
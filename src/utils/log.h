@@ -11,6 +11,10 @@
 #pragma once
 
 #include <string>
+#include <sstream>
+#include <fstream>
+#include <functional>
+#include <memory>
 
 #include <boost/log/trivial.hpp>
 #include <boost/log/support/date_time.hpp>
@@ -22,29 +26,35 @@
 #include <boost/log/utility/setup/common_attributes.hpp>
 #include <boost/log/utility/exception_handler.hpp>
 #include <boost/log/attributes/current_process_name.hpp>
+#include <boost/log/utility/manipulators/add_value.hpp>
+#include <boost/log/sinks/async_frontend.hpp>
+#include <boost/log/sinks/bounded_fifo_queue.hpp>
+#include <boost/log/sinks/drop_on_overflow.hpp>
+#include <boost/log/sinks/block_on_overflow.hpp>
+#include <boost/log/sinks/text_file_backend.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/log/sinks/basic_sink_backend.hpp>
+#include <boost/log/attributes/constant.hpp>
+#include <boost/log/attributes/value_extraction.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/make_shared.hpp>
 
-#ifdef DEBUG
-#define LOG_ADD_FILE boost::log::attribute_cast<boost::log::attributes::mutable_constant<std::string>>( \
-                     logger::gLogger.get_attributes()["File"]).set( \
-                         logger::path_to_filename(__FILE__))
-
-#define LOG_ADD_LINE boost::log::attribute_cast<boost::log::attributes::mutable_constant<int>>( \
-                     logger::gLogger.get_attributes()["Line"]).set(__LINE__)
+#include "utils/log_record.h"
 
-#define LOG_ADD_FUNC boost::log::attribute_cast<boost::log::attributes::mutable_constant<std::string>>( \
-                     logger::gLogger.get_attributes()["Func"]).set(__FUNCTION__)
-
-#define DEBUG_OUTPUT LOG_ADD_FILE; \
-                     LOG_ADD_LINE; \
-                     LOG_ADD_FUNC;
+#ifdef DEBUG
+#define LOG_SRC_LOCATION \
+    << ::boost::log::add_value("File", logger::path_to_filename(__FILE__)) \
+    << ::boost::log::add_value("Line", __LINE__) \
+    << ::boost::log::add_value("Func", std::string(__FUNCTION__))
 #else
-#define DEBUG_OUTPUT
+#define LOG_SRC_LOCATION
 #endif
 
 #define LOG(sev) \
-    DEBUG_OUTPUT \
     BOOST_LOG_STREAM_WITH_PARAMS(logger::gLogger, \
-                                (::boost::log::keywords::severity = ::boost::log::trivial::sev))
+                                (::boost::log::keywords::severity = ::boost::log::trivial::sev)) \
+    << ::boost::log::add_value("Subsystem", logger::path_to_subsystem(__FILE__)) \
+    LOG_SRC_LOCATION
 
 namespace logger {
     namespace logging = boost::log;
@@ -52,32 +62,95 @@ namespace logger {
     namespace expr = boost::log::expressions;
     namespace src = boost::log::sources;
     namespace keywords = boost::log::keywords;
+    namespace sinks = boost::log::sinks;
 
     inline boost::log::trivial::logger::logger_type &gLogger = boost::log::trivial::logger::get();
 
-    template<typename ValueType>
-    ValueType set_get_attrib(const char* name, ValueType value) {
-        auto attr = logging::attribute_cast<attrs::mutable_constant<ValueType>>
-                        (gLogger.get_attributes()[name]);
-        attr.set(value);
-        return attr.get();
-    }
+    enum class LogFormat {
+        kText,
+        kJson,
+        kBinary,
+    };
+
+    enum class OverflowPolicy {
+        kBlock,
+        kDrop,
+    };
+
+    inline constexpr const size_t kAsyncQueueMax = 8192U;
+    inline constexpr const int kAsyncFlushIntervalMs = 1000;
+
+    inline boost::shared_ptr<sinks::sink> gAsyncSink;
+    inline std::function<void(void)> gAsyncStop;
+    inline std::unique_ptr<boost::thread> gAsyncFlusher;
+    inline boost::shared_ptr<sinks::synchronous_sink<sinks::text_ostream_backend>> gConsoleSink;
 
     inline std::string path_to_filename(std::string path) {
         return path.substr(path.find_last_of("/\\") + 1);
     }
 
-    inline void init(void) {
-#ifdef DEBUG
-        gLogger.add_attribute("File", attrs::mutable_constant<std::string>(""));
-        gLogger.add_attribute("Line", attrs::mutable_constant<int>(0));
-        gLogger.add_attribute("Func", attrs::mutable_constant<std::string>(""));
-#endif
-        gLogger.add_attribute("ProcName", attrs::current_process_name());
+    inline std::string path_to_subsystem(std::string path) {
+        std::string name = path_to_filename(path);
+        return name.substr(0, name.find_last_of('.'));
+    }
+
+    struct EventTag {
+        const char *type;
+    };
+
+    /* Tag a record with an event type: LOG(info) << logger::event("vm_ready") << ... */
+    inline EventTag event(const char *type) {
+        return EventTag{ type };
+    }
 
-        logging::add_console_log(std::cout,
-            keywords::format = (
-                expr::stream
+    inline logging::record_ostream &operator<<(logging::record_ostream &strm, const EventTag &tag) {
+        return strm << logging::add_value("Event", std::string(tag.type));
+    }
+
+    /*
+     * Tag all records logged by the current thread with the VM name and vsock CID.
+     * An outer tag of the same thread wins, nested tags are no-op.
+     */
+    class ScopedVmTag final {
+     public:
+        ScopedVmTag(const std::string &vm_name, uint32_t cid) : cid_attr_(cid) {
+            auto core = logging::core::get();
+            auto name = core->add_thread_attribute("VmName", attrs::constant<std::string>(vm_name));
+            if (!name.second)
+                return;
+            auto c = core->add_thread_attribute("Cid", cid_attr_);
+            if (!c.second) {
+                core->remove_thread_attribute(name.first);
+                return;
+            }
+            name_ = name.first;
+            cid_ = c.first;
+            owned_ = true;
+        }
+        ~ScopedVmTag() {
+            if (!owned_)
+                return;
+            logging::core::get()->remove_thread_attribute(name_);
+            logging::core::get()->remove_thread_attribute(cid_);
+        }
+
+        /* The CID is only known once the VM arguments are built */
+        void SetCid(uint32_t cid) {
+            cid_attr_.set(cid);
+        }
+
+     private:
+        ScopedVmTag(const ScopedVmTag&) = delete;
+        ScopedVmTag& operator=(const ScopedVmTag&) = delete;
+
+        bool owned_ = false;
+        attrs::mutable_constant<uint32_t> cid_attr_;
+        logging::attribute_set::iterator name_;
+        logging::attribute_set::iterator cid_;
+    };
+
+    inline logging::formatter text_formatter(void) {
+        return expr::stream
                 << expr::format_date_time<boost::posix_time::ptime>("TimeStamp", "%Y-%m-%d_%H:%M:%S.%f")
                 << " [" << expr::attr<std::string>("ProcName") << "]"
                 << " [" << std::setw(8) << logging::trivial::severity << "] "
@@ -86,30 +159,168 @@ namespace logger {
                 << ':' << expr::attr<int>("Line") << ""
                 << ':' << expr::attr<std::string>("Func") << "()]:  "
 #endif
-                << expr::smessage));
+                << expr::smessage;
+    }
+
+    inline LogRecord to_log_record(const logging::record_view &rec) {
+        LogRecord r;
+        auto ts = logging::extract<boost::posix_time::ptime>("TimeStamp", rec);
+        if (ts) {
+            boost::posix_time::ptime epoch(boost::gregorian::date(1970, 1, 1));
+            r.ts_us = (*ts - epoch).total_microseconds();
+        }
+        auto sev = logging::extract<logging::trivial::severity_level>("Severity", rec);
+        if (sev)
+            r.severity = static_cast<uint8_t>(*sev);
+        r.vm = logging::extract_or_default<std::string>("VmName", rec, std::string());
+        r.cid = logging::extract_or_default<uint32_t>("Cid", rec, 0U);
+        r.subsys = logging::extract_or_default<std::string>("Subsystem", rec, std::string());
+        r.event = logging::extract_or_default<std::string>("Event", rec, std::string("log"));
+        r.msg = logging::extract_or_default<std::string>("Message", rec, std::string());
+        return r;
+    }
+
+    inline void json_formatter(const logging::record_view &rec, logging::formatting_ostream &strm) {
+        LogRecord r = to_log_record(rec);
+        auto ts = logging::extract<boost::posix_time::ptime>("TimeStamp", rec);
+        std::ostringstream os;
+        os << "{\"ts\":\"" << (ts ? boost::posix_time::to_iso_extended_string(*ts) : std::string()) << "\""
+           << ",\"sev\":\"" << SeverityName(r.severity) << "\""
+           << ",\"vm\":\"";
+        JsonEscape(os, r.vm);
+        os << "\",\"cid\":" << r.cid << ",\"subsys\":\"";
+        JsonEscape(os, r.subsys);
+        os << "\",\"event\":\"";
+        JsonEscape(os, r.event);
+        os << "\",\"msg\":\"";
+        JsonEscape(os, r.msg);
+        os << "\"}";
+        strm << os.str();
+    }
+
+    /* Writes each record in the compact binary format of log_record.h */
+    class binary_file_backend : public sinks::basic_sink_backend<sinks::synchronized_feeding> {
+     public:
+        explicit binary_file_backend(const char *file, bool auto_flush) : auto_flush_(auto_flush) {
+            out_.open(file, std::ios_base::out | std::ios_base::app | std::ios_base::binary);
+            if (out_.tellp() == 0)
+                out_.write(kLogBinMagic, sizeof(kLogBinMagic));
+        }
+        void consume(const logging::record_view &rec) {
+            WriteLogRecord(out_, to_log_record(rec));
+            if (auto_flush_)
+                out_.flush();
+        }
+        void flush() {
+            out_.flush();
+        }
+
+     private:
+        std::ofstream out_;
+        bool auto_flush_;
+    };
+
+    inline void init(void) {
+        gLogger.add_attribute("ProcName", attrs::current_process_name());
+
+        gConsoleSink = logging::add_console_log(std::cout, keywords::format = text_formatter());
 
         logging::add_common_attributes();
 
         logging::core::get()->set_exception_handler(logging::make_exception_suppressor());
     }
 
-    inline void log2file(const char *file) {
+    inline void remove_console_log(void) {
+        if (gConsoleSink) {
+            logging::core::get()->remove_sink(gConsoleSink);
+            gConsoleSink.reset();
+        }
+    }
+
+    inline boost::shared_ptr<sinks::text_file_backend> make_text_backend(const char *file, bool auto_flush) {
+        return boost::make_shared<sinks::text_file_backend>(
+            keywords::file_name = file,
+            keywords::open_mode = std::ios_base::out | std::ios_base::app,
+            keywords::auto_flush = auto_flush);
+    }
+
+    template<template<typename> class Frontend>
+    inline boost::shared_ptr<sinks::sink> make_file_sink(const char *file, LogFormat format, bool auto_flush) {
+        if (format == LogFormat::kBinary) {
+            auto sink = boost::make_shared<Frontend<binary_file_backend>>(
+                boost::make_shared<binary_file_backend>(file, auto_flush));
+            return sink;
+        }
+        auto sink = boost::make_shared<Frontend<sinks::text_file_backend>>(make_text_backend(file, auto_flush));
+        if (format == LogFormat::kJson)
+            sink->set_formatter(&json_formatter);
+        else
+            sink->set_formatter(text_formatter());
+        return sink;
+    }
+
+    inline void log2file(const char *file, LogFormat format = LogFormat::kText) {
         if (file) {
-            logging::add_file_log(
-                file,
-                keywords::format = (
-                    expr::stream
-                    << expr::format_date_time<boost::posix_time::ptime>("TimeStamp", "%Y-%m-%d_%H:%M:%S.%f")
-                    << " [" << expr::attr<std::string>("ProcName") << "]"
-                    << " [" << std::setw(8) << logging::trivial::severity << "] "
-#ifdef DEBUG
-                    << '[' << expr::attr<std::string>("File")
-                    << ':' << expr::attr<int>("Line") << ""
-                    << ':' << expr::attr<std::string>("Func") << "()]:  "
-#endif
-                    << expr::smessage),
-                keywords::open_mode = std::ios_base::app,
-                keywords::auto_flush = (true));
+            logging::core::get()->add_sink(make_file_sink<sinks::synchronous_sink>(file, format, true));
+        }
+    }
+
+    template<typename Backend>
+    using AsyncBlockSink = sinks::asynchronous_sink<Backend,
+                                sinks::bounded_fifo_queue<kAsyncQueueMax, sinks::block_on_overflow>>;
+    template<typename Backend>
+    using AsyncDropSink = sinks::asynchronous_sink<Backend,
+                                sinks::bounded_fifo_queue<kAsyncQueueMax, sinks::drop_on_overflow>>;
+
+    template<template<typename> class Frontend>
+    inline void add_async_sink(const char *file, LogFormat format) {
+        auto sink = make_file_sink<Frontend>(file, format, false);
+        gAsyncSink = sink;
+        gAsyncStop = [sink, format]() {
+            if (format == LogFormat::kBinary)
+                boost::static_pointer_cast<Frontend<binary_file_backend>>(sink)->stop();
+            else
+                boost::static_pointer_cast<Frontend<sinks::text_file_backend>>(sink)->stop();
+        };
+        logging::core::get()->add_sink(sink);
+    }
+
+    /*
+     * Records are only queued by the logging threads, a dedicated thread formats and
+     * writes them in batches, and the file is flushed periodically instead of per record.
+     */
+    inline void log2file_async(const char *file, OverflowPolicy policy, LogFormat format = LogFormat::kText) {
+        if (!file)
+            return;
+
+        if (policy == OverflowPolicy::kDrop)
+            add_async_sink<AsyncDropSink>(file, format);
+        else
+            add_async_sink<AsyncBlockSink>(file, format);
+
+        gAsyncFlusher = std::make_unique<boost::thread>([]() {
+            try {
+                while (true) {
+                    boost::this_thread::sleep_for(boost::chrono::milliseconds(kAsyncFlushIntervalMs));
+                    gAsyncSink->flush();
+                }
+            } catch (boost::thread_interrupted &) {
+            }
+        });
+    }
+
+    inline void shutdown(void) {
+        if (gAsyncFlusher) {
+            gAsyncFlusher->interrupt();
+            gAsyncFlusher->join();
+            gAsyncFlusher.reset();
+        }
+        if (gAsyncSink) {
+            logging::core::get()->remove_sink(gAsyncSink);
+            gAsyncStop();
+            gAsyncSink->flush();
+            gAsyncSink.reset();
+            gAsyncStop = nullptr;
         }
     }
 
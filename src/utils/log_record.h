@@ -0,0 +1,142 @@
+/*
+ * Copyright (c) 2022 Intel Corporation.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+#ifndef SRC_UTILS_LOG_RECORD_H_
+#define SRC_UTILS_LOG_RECORD_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <istream>
+#include <ostream>
+
+/*
+ * Structured daemon log records, shared by the server and civ-log-reader.
+ *
+ * Binary file layout: kLogBinMagic, then records of
+ *   u32 len          size of the record after this field
+ *   u64 ts_us        local time in microseconds since 1970-01-01
+ *   u32 cid
+ *   u8  severity
+ *   u8  vm_len, u8 subsys_len, u8 event_len
+ *   vm, subsys, event, message bytes (message fills the rest of len)
+ * so a reader can filter on the VM name without decoding the message.
+ */
+namespace logger {
+
+inline constexpr const char kLogBinMagic[8] = { 'C', 'I', 'V', 'L', 'O', 'G', '1', '\n' };
+inline constexpr const size_t kLogRecHeaderSize = 8 + 4 + 1 + 3;
+
+struct LogRecord {
+    uint64_t ts_us = 0;
+    uint32_t cid = 0;
+    uint8_t severity = 0;
+    std::string vm;
+    std::string subsys;
+    std::string event;
+    std::string msg;
+};
+
+inline constexpr const char *kLogSeverityNames[] = {
+    "trace", "debug", "info", "warning", "error", "fatal"
+};
+
+inline const char *SeverityName(uint8_t sev) {
+    if (sev < sizeof(kLogSeverityNames) / sizeof(kLogSeverityNames[0]))
+        return kLogSeverityNames[sev];
+    return "unknown";
+}
+
+inline void WriteLogRecord(std::ostream &os, const LogRecord &r) {
+    uint8_t vm_len = static_cast<uint8_t>(std::min<size_t>(r.vm.size(), UINT8_MAX));
+    uint8_t subsys_len = static_cast<uint8_t>(std::min<size_t>(r.subsys.size(), UINT8_MAX));
+    uint8_t event_len = static_cast<uint8_t>(std::min<size_t>(r.event.size(), UINT8_MAX));
+    uint32_t len = kLogRecHeaderSize + vm_len + subsys_len + event_len + r.msg.size();
+
+    os.write(reinterpret_cast<const char *>(&len), sizeof(len));
+    os.write(reinterpret_cast<const char *>(&r.ts_us), sizeof(r.ts_us));
+    os.write(reinterpret_cast<const char *>(&r.cid), sizeof(r.cid));
+    os.write(reinterpret_cast<const char *>(&r.severity), sizeof(r.severity));
+    os.write(reinterpret_cast<const char *>(&vm_len), sizeof(vm_len));
+    os.write(reinterpret_cast<const char *>(&subsys_len), sizeof(subsys_len));
+    os.write(reinterpret_cast<const char *>(&event_len), sizeof(event_len));
+    os.write(r.vm.data(), vm_len);
+    os.write(r.subsys.data(), subsys_len);
+    os.write(r.event.data(), event_len);
+    os.write(r.msg.data(), r.msg.size());
+}
+
+/*
+ * Read next record, if vm_filter is not empty, records of other VMs are skipped
+ * without reading their payload. Return false at end of file or on corruption.
+ */
+inline bool ReadLogRecord(std::istream &is, LogRecord *r, const std::string &vm_filter) {
+    while (true) {
+        uint32_t len = 0;
+        char hdr[kLogRecHeaderSize];
+        if (!is.read(reinterpret_cast<char *>(&len), sizeof(len)))
+            return false;
+        if (len < kLogRecHeaderSize || !is.read(hdr, sizeof(hdr)))
+            return false;
+
+        memcpy(&r->ts_us, hdr, 8);
+        memcpy(&r->cid, hdr + 8, 4);
+        r->severity = static_cast<uint8_t>(hdr[12]);
+        uint8_t vm_len = static_cast<uint8_t>(hdr[13]);
+        uint8_t subsys_len = static_cast<uint8_t>(hdr[14]);
+        uint8_t event_len = static_cast<uint8_t>(hdr[15]);
+        size_t remain = len - kLogRecHeaderSize;
+        if (remain < static_cast<size_t>(vm_len) + subsys_len + event_len)
+            return false;
+
+        r->vm.resize(vm_len);
+        if (!is.read(r->vm.data(), vm_len))
+            return false;
+        remain -= vm_len;
+
+        if (!vm_filter.empty() && (r->vm.compare(vm_filter) != 0)) {
+            if (!is.seekg(remain, std::ios_base::cur))
+                return false;
+            continue;
+        }
+
+        r->subsys.resize(subsys_len);
+        r->event.resize(event_len);
+        r->msg.resize(remain - subsys_len - event_len);
+        if (!is.read(r->subsys.data(), subsys_len) ||
+            !is.read(r->event.data(), event_len) ||
+            !is.read(r->msg.data(), r->msg.size()))
+            return false;
+        return true;
+    }
+}
+
+inline void JsonEscape(std::ostream &os, const std::string &s) {
+    for (char c : s) {
+        switch (c) {
+        case '"':  os << "\\\""; break;
+        case '\\': os << "\\\\"; break;
+        case '\n': os << "\\n"; break;
+        case '\r': os << "\\r"; break;
+        case '\t': os << "\\t"; break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20) {
+                char buf[8];
+                snprintf(buf, sizeof(buf), "\\u%04x", c);
+                os << buf;
+            } else {
+                os << c;
+            }
+        }
+    }
+}
+
+}  // namespace logger
+
+#endif  // SRC_UTILS_LOG_RECORD_H_
@@ -131,3 +131,35 @@ int Daemonize(void) {
     return 0;
 }
 
+/* Parse size string like "4096", "512K", "8M" or "2G" into bytes, return 0 if invalid */
+size_t ParseSize(const std::string &str) {
+    if (str.empty())
+        return 0;
+
+    size_t pos = 0;
+    unsigned long long v = 0;
+    try {
+        v = std::stoull(str, &pos, 10);
+    } catch (std::exception &e) {
+        return 0;
+    }
+
+    std::string unit = str.substr(pos);
+    if (!unit.empty() && (toupper(unit.back()) == 'B'))
+        unit.pop_back();
+    if (unit.size() > 1)
+        return 0;
+
+    switch (unit.empty() ? 0 : toupper(unit[0])) {
+    case 0:
+        return v;
+    case 'K':
+        return v * 1_KB;
+    case 'M':
+        return v * 1_MB;
+    case 'G':
+        return v * 1_GB;
+    default:
+        return 0;
+    }
+}
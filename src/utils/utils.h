@@ -12,10 +12,13 @@
 #define MAX_PATH 2048U
 #endif
 
+#include <string>
+
 #define CIV_GUEST_QMP_SUFFIX     ".qmp.unix.socket"
 
 const char *GetConfigPath(void);
 int Daemonize(void);
+size_t ParseSize(const std::string &str);
 
 constexpr std::size_t operator""_KB(unsigned long long v) {
     return 1024u * v;
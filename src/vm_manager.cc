@@ -6,11 +6,15 @@
  *
  */
 #include <sys/syslog.h>
+#include <signal.h>
 #include <iostream>
 #include <map>
 #include <string>
+#include <vector>
+#include <algorithm>
 
 #include <boost/program_options.hpp>
+#include <boost/algorithm/string.hpp>
 #include <boost/interprocess/shared_memory_object.hpp>
 #include <boost/interprocess/mapped_region.hpp>
 #include <boost/interprocess/sync/scoped_lock.hpp>
@@ -19,7 +23,10 @@
 #include "utils/log.h"
 #include "utils/utils.h"
 #include "guest/vm_builder.h"
+#include "guest/boot_trace.h"
 #include "guest/vm_flash.h"
+#include "guest/disk_image.h"
+#include "guest/proc_log.h"
 #include "guest/tui.h"
 #include "services/server.h"
 #include "services/client.h"
@@ -57,6 +64,23 @@ static bool ListGuest(void) {
     return true;
 }
 
+static bool ShowStats(void) {
+    if (!IsServerRunning()) {
+        LOG(info) << "server is not running! Please start server!";
+        return false;
+    }
+
+    Client c;
+    if (!c.Notify(kCivMsgGetStats)) {
+        LOG(error) << "Get stats: " << " Failed!";
+        return false;
+    }
+    for (auto &it : c.GetStats()) {
+        std::cout << it << std::endl;
+    }
+    return true;
+}
+
 static int GetGuestState(std::string name) {
     if (name.empty())
         return -1;
@@ -73,7 +97,7 @@ static int GetGuestState(std::string name) {
     for (auto& it : vm_list) {
         std::vector<std::string> sp;
         boost::split(sp, it, boost::is_any_of(":"));
-        if (sp.size() != 2)
+        if (sp.size() < 2)
             continue;
         if (sp[0].compare(name) == 0) {
             for (auto i = 0; i < VmBuilder::kVmUnknown; i++) {
@@ -86,23 +110,31 @@ static int GetGuestState(std::string name) {
     return VmBuilder::kVmUnknown;
 }
 
-static bool StartGuest(std::string path) {
-    if (!IsServerRunning()) {
-        LOG(info) << "server is not running! Please start server!";
-        return false;
-    }
-
+/* Accept either a config file path or a guest name under the config path */
+static bool ResolveConfigPath(const std::string &path, boost::filesystem::path *p) {
     boost::system::error_code ec;
-    boost::filesystem::path p(path);
+    p->assign(path);
 
-    if (!boost::filesystem::exists(p, ec) || !boost::filesystem::is_regular_file(p, ec)) {
-        p.clear();
-        p.assign(GetConfigPath() + std::string("/") + path + ".ini");
-        if (!boost::filesystem::exists(p, ec)) {
+    if (!boost::filesystem::exists(*p, ec) || !boost::filesystem::is_regular_file(*p, ec)) {
+        p->clear();
+        p->assign(GetConfigPath() + std::string("/") + path + ".ini");
+        if (!boost::filesystem::exists(*p, ec)) {
             LOG(error) << "CiV config not exists: " << path;
             return false;
         }
     }
+    return true;
+}
+
+static bool StartGuest(std::string path) {
+    if (!IsServerRunning()) {
+        LOG(info) << "server is not running! Please start server!";
+        return false;
+    }
+
+    boost::filesystem::path p;
+    if (!ResolveConfigPath(path, &p))
+        return false;
 
     Client c;
     c.PrepareStartGuestClientShm(p.c_str());
@@ -114,6 +146,31 @@ static bool StartGuest(std::string path) {
     return true;
 }
 
+static bool CheckGuest(std::string path) {
+    if (!IsServerRunning()) {
+        LOG(info) << "server is not running! Please start server!";
+        return false;
+    }
+
+    boost::filesystem::path p;
+    if (!ResolveConfigPath(path, &p))
+        return false;
+
+    Client c;
+    c.PrepareCheckGuestClientShm(p.c_str());
+    bool ok = c.Notify(kCivMsgCheckVm);
+    std::vector<std::string> problems = c.GetCheckProblems();
+    for (auto &it : problems) {
+        std::cout << "  " << it << std::endl;
+    }
+    if (!ok) {
+        std::cout << path << ": " << problems.size() << " problem(s) found" << std::endl;
+        return false;
+    }
+    std::cout << path << ": OK" << std::endl;
+    return true;
+}
+
 static bool StopGuest(std::string name) {
     if (!IsServerRunning()) {
         LOG(info) << "server is not running! Please start server!";
@@ -131,6 +188,131 @@ static bool StopGuest(std::string name) {
 }
 
 
+static bool SetGuestNetQos(std::string name, std::string spec) {
+    if (!IsServerRunning()) {
+        LOG(info) << "server is not running! Please start server!";
+        return false;
+    }
+
+    Client c;
+    c.PrepareSetNetQosClientShm(name.c_str(), spec.c_str());
+    if (!c.Notify(kCivMsgSetNetQos)) {
+        LOG(error) << "Set net QoS of guest: " << name << " Failed!";
+        return false;
+    }
+    LOG(info) << "Set net QoS of guest: " << name << " Done.";
+    return true;
+}
+
+static bool SetGuestDiskThrottle(std::string name, std::string group, std::string spec) {
+    if (!IsServerRunning()) {
+        LOG(info) << "server is not running! Please start server!";
+        return false;
+    }
+
+    Client c;
+    c.PrepareSetDiskThrottleClientShm(name.c_str(), group.c_str(), spec.c_str());
+    if (!c.Notify(kCivMsgSetDiskThrottle)) {
+        LOG(error) << "Set disk throttle of guest: " << name << " Failed!";
+        return false;
+    }
+    LOG(info) << "Set disk throttle of guest: " << name << " Done.";
+    return true;
+}
+
+/* Disks of all guest configs on golden image, other than disk group of config self */
+static std::vector<std::string> GoldenImageUsers(const std::string &golden, const boost::filesystem::path &self,
+                                                 const std::string &group) {
+    boost::system::error_code ec;
+    boost::filesystem::path image = boost::filesystem::weakly_canonical(golden, ec);
+    std::vector<std::string> users;
+    for (auto &x : boost::filesystem::directory_iterator(GetConfigPath(), ec)) {
+        if (x.path().extension().string().compare(".ini") != 0)
+            continue;
+        CivConfig cfg;
+        if (!cfg.ReadConfigFile(x.path().string()))
+            continue;
+        bool is_self = boost::filesystem::equivalent(x.path(), self, ec);
+        for (auto &g : cfg.GetDiskGroups()) {
+            std::string other = cfg.GetValue(g, kDiskGolden);
+            if (other.empty() || (is_self && (g.compare(group) == 0)))
+                continue;
+            if (boost::filesystem::weakly_canonical(other, ec) == image)
+                users.push_back(x.path().stem().string() + "[" + g + "]");
+        }
+    }
+    return users;
+}
+
+/* commit|rebase|flatten the overlay of disk group of a guest on its golden image */
+static bool DiskOverlayOp(std::string path, std::string group, std::string op, std::string backing, bool force) {
+    boost::filesystem::path p;
+    if (!ResolveConfigPath(path, &p))
+        return false;
+
+    CivConfig cfg;
+    if (!cfg.ReadConfigFile(p.string())) {
+        LOG(error) << "Failed to read config file: " << p.string();
+        return false;
+    }
+    std::vector<std::string> groups = cfg.GetDiskGroups();
+    if (std::find(groups.begin(), groups.end(), group) == groups.end()) {
+        LOG(error) << "No disk group [" << group << "] in guest: " << path;
+        return false;
+    }
+    std::string disk = cfg.GetValue(group, kDiskPath);
+    std::string golden = cfg.GetValue(group, kDiskGolden);
+    if (golden.empty()) {
+        LOG(error) << "No golden image for disk [" << group << "] of guest: " << path;
+        return false;
+    }
+
+    int state = GetGuestState(cfg.GetValue(kGroupGlob, kGlobName));
+    if ((state == VmBuilder::kVmBooting) || (state == VmBuilder::kVmRunning) || (state == VmBuilder::kVmPaused)) {
+        LOG(error) << "Guest is running, stop it first: " << path;
+        return false;
+    }
+
+    if (op.compare("commit") == 0) {
+        /* The other overlays would silently read a mix of old and new golden data */
+        std::vector<std::string> users = GoldenImageUsers(golden, p, group);
+        if (!users.empty() && !force) {
+            LOG(error) << "Golden image " << golden << " is shared with: " << boost::algorithm::join(users, " ")
+                       << ", their disks would be corrupted. Use --force to commit anyway";
+            return false;
+        }
+        if (!users.empty())
+            LOG(warning) << "Committing into shared " << golden << ", recreate the overlays of: "
+                         << boost::algorithm::join(users, " ");
+        return CommitOverlay(disk);
+    }
+
+    if (op.compare("rebase") == 0) {
+        if (!RebaseOverlay(disk, backing))
+            return false;
+        golden = backing;
+    } else if (op.compare("flatten") == 0) {
+        if (!FlattenOverlay(disk))
+            return false;
+        golden.clear();
+    } else {
+        LOG(error) << "Invalid disk operation: " << op;
+        return false;
+    }
+
+    /* Keep the config in line with the image, a later flash or start must not recreate it */
+    if (golden.empty())
+        cfg.RemoveValue(group, kDiskGolden);
+    else
+        cfg.SetValue(group, kDiskGolden, boost::filesystem::absolute(golden).string());
+    if (!cfg.WriteConfigFile(p.string())) {
+        LOG(error) << "Failed to update config file: " << p.string();
+        return false;
+    }
+    LOG(info) << "Disk " << op << " of guest: " << path << " Done.";
+    return true;
+}
+
 static bool GetGuestCid(std::string name) {
     if (!IsServerRunning()) {
         LOG(info) << "server is not running! Please start server first!";
@@ -147,7 +329,43 @@ static bool GetGuestCid(std::string name) {
     return true;
 }
 
-static bool StartServer(bool daemon) {
+static volatile sig_atomic_t stop_follow_logs = 0;
+
+static void HandleFollowSIG(int num) {
+    stop_follow_logs = 1;
+}
+
+static bool ShowGuestLogs(std::string name, bool follow) {
+    if (!IsServerRunning()) {
+        LOG(info) << "server is not running! Please start server first!";
+        return false;
+    }
+
+    Client c;
+    uint64_t offset = kProcLogTail;
+    std::string logs;
+    if (!c.GetGuestLogs(name.c_str(), &offset, &logs)) {
+        LOG(error) << "Failed to get logs of guest: " << name;
+        return false;
+    }
+    std::cout << logs << std::flush;
+
+    if (!follow)
+        return true;
+
+    signal(SIGINT, HandleFollowSIG);
+    signal(SIGTERM, HandleFollowSIG);
+    while (!stop_follow_logs) {
+        if (!c.GetGuestLogs(name.c_str(), &offset, &logs))
+            break;
+        std::cout << logs << std::flush;
+        if (logs.size() < kCivMaxLogChunk)
+            boost::this_thread::sleep_for(boost::chrono::milliseconds(500));
+    }
+    return true;
+}
+
+static bool StartServer(bool daemon, std::string log_async, logger::LogFormat log_format) {
     if (IsServerRunning()) {
         LOG(info) << "Server already running!";
         return false;
@@ -155,6 +373,10 @@ static bool StartServer(bool daemon) {
 
     if (daemon) {
         const char *log_file = "/tmp/civ_server.log";
+        if (log_format == logger::LogFormat::kJson)
+            log_file = "/tmp/civ_server.jsonl";
+        else if (log_format == logger::LogFormat::kBinary)
+            log_file = "/tmp/civ_server.bin";
         int ret = Daemonize();
         if (ret > 0) {
             LOG(info) << "Starting service as daemon (PID=" << ret << ")";
@@ -165,7 +387,16 @@ static bool StartServer(bool daemon) {
             return false;
         }
 
-        logger::log2file(log_file);
+        /* stdout is /dev/null now, no need to format records for it */
+        logger::remove_console_log();
+        if (log_async.empty()) {
+            logger::log2file(log_file, log_format);
+        } else {
+            logger::log2file_async(log_file, (log_async.compare("drop") == 0) ?
+                                             logger::OverflowPolicy::kDrop :
+                                             logger::OverflowPolicy::kBlock,
+                                             log_format);
+        }
         LOG(info) << "\n--------------------- "
                   << "CiV VM Manager Service started in background!"
                   << "(PID=" << getpid() << ")"
@@ -177,6 +408,8 @@ static bool StartServer(bool daemon) {
     LOG(info) << "Starting Server!";
     srv.Start();
 
+    logger::shutdown();
+
     return true;
 }
 
@@ -205,14 +438,43 @@ class CivOptions final {
             // ("delete,d",  po::value<std::string>(), "Delete a CiV guest")
             ("start,b",   po::value<std::string>(), "Start a CiV guest")
             ("stop,q",    po::value<std::string>(), "Stop a CiV guest")
+            ("check",     po::value<std::string>(), "Check config of a CiV guest without starting it")
             ("flash,f",   po::value<std::string>(), "Flash a CiV guest")
             // ("update,u",  po::value<std::string>(), "Update an existing CiV guest")
             ("get-cid", po::value<std::string>(), "Get cid of a guest")
+            ("boot-report", po::value<std::string>(), "Show boot-time breakdown history of a guest")
+            ("logs", po::value<std::string>(), "Show recent emulator output of a guest")
+            ("follow", "Keep printing new output, used with --logs")
+            ("net-qos", po::value<std::string>(), "Change network limits of a running guest, used with --qos")
+            ("qos", po::value<std::string>(),
+                    "Limits for --net-qos, e.g. egress_rate=100mbit,ingress_rate=1gbit,burst=256k,pps=20000,"
+                    " 0 removes a limit")
+            ("disk-throttle", po::value<std::string>(),
+                    "Change disk limits of a running guest, used with --throttle-group and --limits")
+            ("throttle-group", po::value<std::string>(), "Throttle group for --disk-throttle")
+            ("limits", po::value<std::string>(),
+                    "Limits for --disk-throttle, e.g. iops_total=2000,bps_total=200M,bps_total_max=400M,"
+                    "burst_length=10, 0 removes a limit")
+            ("disk-commit", po::value<std::string>(),
+                    "Merge the disk overlay of a stopped guest into its golden image, shared by other guests")
+            ("disk-rebase", po::value<std::string>(),
+                    "Move the disk overlay of a stopped guest onto another golden image, used with --backing")
+            ("backing", po::value<std::string>(), "New golden image for --disk-rebase")
+            ("disk-flatten", po::value<std::string>(),
+                    "Copy the golden image into the disk overlay of a stopped guest, detaching it")
+            ("disk", po::value<std::string>(),
+                    "Disk group [disk] by default, for --disk-commit, --disk-rebase and --disk-flatten, e.g. disk2")
+            ("force", "Commit into a golden image other guests still use, used with --disk-commit")
             ("list,l",    "List existing CiV guest")
+            ("stats",     "Show host resource sharing stats of the server")
             ("version,v", "Show CiV vm-manager version")
             ("start-server",  "Start host server")
             ("stop-server",  "Stop host server")
-            ("daemon", "start server as a daemon");
+            ("daemon", "start server as a daemon")
+            ("log-async", po::value<std::string>()->implicit_value("block"),
+                "Write daemon log asynchronously, arg is the policy when the queue is full: block|drop")
+            ("log-format", po::value<std::string>(),
+                "Format of daemon log: text(default)|json|binary");
     }
 
     CivOptions(CivOptions &) = delete;
@@ -242,13 +504,35 @@ class CivOptions final {
             return true;
         }
 
+        if (vm_.count("boot-report")) {
+            return BootTrace::Report(vm_["boot-report"].as<std::string>(), std::cout);
+        }
+
         if (vm_.count("stop-server")) {
             return StopServer();
         }
 
         if (vm_.count("start-server")) {
             bool daemon = (vm_.count("daemon") == 0) ? false : true;
-            return StartServer(daemon);
+            std::string log_async;
+            if (vm_.count("log-async")) {
+                log_async = vm_["log-async"].as<std::string>();
+                if ((log_async.compare("block") != 0) && (log_async.compare("drop") != 0)) {
+                    LOG(error) << "Invalid log-async policy: " << log_async;
+                    return false;
+                }
+            }
+            logger::LogFormat log_format = logger::LogFormat::kText;
+            std::string format = vm_.count("log-format") ? vm_["log-format"].as<std::string>() : "text";
+            if (format.compare("json") == 0) {
+                log_format = logger::LogFormat::kJson;
+            } else if (format.compare("binary") == 0) {
+                log_format = logger::LogFormat::kBinary;
+            } else if (format.compare("text") != 0) {
+                LOG(error) << "Invalid log-format: " << format;
+                return false;
+            }
+            return StartServer(daemon, log_async, log_format);
         } else {
             if (!IsServerRunning()) {
                 boost::filesystem::path cmd(args[0]);
@@ -285,6 +569,10 @@ class CivOptions final {
             return StartGuest(vm_["start"].as<std::string>());
         }
 
+        if (vm_.count("check")) {
+            return CheckGuest(vm_["check"].as<std::string>());
+        }
+
         if (vm_.count("stop")) {
             return StopGuest(vm_["stop"].as<std::string>());
         }
@@ -306,6 +594,51 @@ class CivOptions final {
             return ListGuest();
         }
 
+        if (vm_.count("stats")) {
+            return ShowStats();
+        }
+
+        if (vm_.count("net-qos")) {
+            if (!vm_.count("qos")) {
+                std::cout << "--net-qos requires --qos" << std::endl;
+                return false;
+            }
+            return SetGuestNetQos(vm_["net-qos"].as<std::string>(), vm_["qos"].as<std::string>());
+        }
+
+        if (vm_.count("disk-throttle")) {
+            if (!vm_.count("throttle-group") || !vm_.count("limits")) {
+                std::cout << "--disk-throttle requires --throttle-group and --limits" << std::endl;
+                return false;
+            }
+            return SetGuestDiskThrottle(vm_["disk-throttle"].as<std::string>(),
+                                        vm_["throttle-group"].as<std::string>(), vm_["limits"].as<std::string>());
+        }
+
+        std::string disk_group = vm_.count("disk") ? vm_["disk"].as<std::string>() : kGroupDisk;
+        if (vm_.count("disk-commit")) {
+            bool force = (vm_.count("force") == 0) ? false : true;
+            return DiskOverlayOp(vm_["disk-commit"].as<std::string>(), disk_group, "commit", "", force);
+        }
+
+        if (vm_.count("disk-rebase")) {
+            if (!vm_.count("backing")) {
+                std::cout << "--disk-rebase requires --backing" << std::endl;
+                return false;
+            }
+            return DiskOverlayOp(vm_["disk-rebase"].as<std::string>(), disk_group, "rebase",
+                                 vm_["backing"].as<std::string>(), false);
+        }
+
+        if (vm_.count("disk-flatten")) {
+            return DiskOverlayOp(vm_["disk-flatten"].as<std::string>(), disk_group, "flatten", "", false);
+        }
+
+        if (vm_.count("logs")) {
+            bool follow = (vm_.count("follow") == 0) ? false : true;
+            return ShowGuestLogs(vm_["logs"].as<std::string>(), follow);
+        }
+
         return false;
     }
 
@@ -314,7 +647,12 @@ class CivOptions final {
         std::cout << "Usage:\n";
         std::cout << "  vm-manager"
                   << " [-c vm_name] [-b vm_name] [-q vm_name] [-f vm_name] [--get-cid vm_name]"
-                  << " [-l] [-v] [-h]\n";
+                  << " [--boot-report vm_name] [--logs vm_name [--follow]]"
+                  << " [--net-qos vm_name --qos limits]"
+                  << " [--disk-throttle vm_name --throttle-group name --limits limits]"
+                  << " [--disk-commit vm_name [--force]|--disk-flatten vm_name|--disk-rebase vm_name --backing image"
+                  << " [--disk group]]"
+                  << " [-l] [--stats] [-v] [-h]\n";
         std::cout << "Options:\n";
 
         std::cout << cmdline_options_ << std::endl;